@@ -11,13 +11,335 @@
 #include <assert.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stddef.h>
 #include <stdint.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <errno.h>
+#include <limits.h>
+#include <sys/uio.h>
 #include "framer.h"
 
+#ifdef FRAMER_COMPACT_LINKS
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
 
 const char* framer_version = "0.0.1";
 
-static fn_t alloc_node( fr_t pos );
+static fr_size_t node_align( void );
+#ifdef FRAMER_COMPACT_LINKS
+static void* space_alloc( fr_size_t bytes );
+static void  space_free( void* ptr, fr_size_t bytes );
+#endif
+static fn_t      alloc_node( fr_t pos );
+static fn_t alloc_node_min( fr_t pos, fr_size_t min );
+static fn_t release_node( fr_t pos, fn_t node );
+static void leave_node( fr_t pos, fn_t node );
+static fr_arena_t arena_new( fr_size_t cnt, fr_size_t size );
+static void       arena_del( fr_arena_t arena );
+static void       arena_chain( fr_arena_t arena, fr_size_t gen );
+static void*      clone_run( void* arg );
+struct merge_s;
+static fn_t merge_node( struct merge_s* m, fr_t pos );
+static void merge_grow( struct merge_s* m, fn_t node );
+static void merge_emit( struct merge_s* m, fn_t node, fr_size_t idx, fr_cmp_f comp, int unique );
+static void merge_recycle( struct merge_s* m, fn_t node, fr_t owner );
+static void merge_even( struct merge_s* m );
+static fr_size_t filter_pass( fr_t pos, int ( *keep )( void* ctx, void* item ), void* ctx );
+static int       unique_keep( void* ctx, void* item );
+static int       unique_hashed_keep( void* ctx, void* item );
+static fr_size_t set_run( fr_t a, fr_t b, fr_cmp_f comp, int op, fr_emit_f emit, void* ctx );
+static void      set_gallop( fr_t it, void* key, fr_cmp_f comp );
+static fr_size_t set_span( fr_t it, fr_t stop, fr_emit_f emit, void* ctx );
+static void      set_skip( fr_t it );
+static void      set_push( void* ctx, void* item );
+static fr_t      set_new( fr_t a, fr_t b, fr_cmp_f comp, int op );
+static void      reverse_items( void** data, fr_size_t n );
+static int        io_writev( int fd, struct iovec* iov, int cnt );
+static int        io_write( int fd, void* buf, fr_size_t bytes );
+static int        io_read( int fd, void* buf, fr_size_t bytes );
+static int        io_end( int fd );
+static void       load_fill( fn_t node, fr_size_t fill, fr_source_f source, void* ctx, int* end );
+static void       load_link( fr_t pos, fn_t* last, fn_t node );
+static void*      load_run( void* arg );
+static int        io_fill(
+           int fd, char** buf, fr_size_t* cap, fr_size_t* len, fr_size_t* off, fr_size_t need );
+static fn_t       read_node( fr_t pos, fn_t node );
+#ifdef FRAMER_COMPACT_LINKS
+struct fr_map_head_s;
+static void map_head( struct fr_map_head_s* head, fr_size_t size, fr_size_t max );
+static struct fr_map_struct_s* map_new( int fd, struct fr_map_head_s* head, int shm );
+static struct fr_map_struct_s* map_attach( int fd, int shm );
+static struct fr_map_struct_s* map_mmap( int fd, struct fr_map_head_s* head, int shm );
+static void                    map_load( struct fr_map_struct_s* map );
+static void                    map_store( struct fr_map_struct_s* map );
+static int                     map_grow( struct fr_map_struct_s* map, fr_size_t need );
+static fn_t                    map_alloc( fr_t pos, void* env );
+static fn_t                    map_free( fr_t pos, void* env );
+#endif
+static fn_t       arena_alloc( fr_t pos, void* env );
+static fn_t       arena_free( fr_t pos, void* env );
+static fn_t       arena_close( fr_t pos, void* env );
+#ifdef FRAMER_USE_CURSORS
+static void cursor_move( fn_t src, fr_size_t a, fr_size_t n, fn_t dst, fr_size_t b );
+static void cursor_rehome( fn_t node, fn_t dst, fr_size_t idx );
+static void cursor_link( fr_cursor_t cur );
+static void cursor_unlink( fr_cursor_t cur );
+#endif
+static fn_t       queue_node( fr_queue_t queue );
+static fn_t       epoch_alloc( fr_t pos, void* env );
+static fn_t       epoch_free( fr_t pos, void* env );
+static fn_t       epoch_close( fr_t pos, void* env );
+static void       epoch_lock( fr_epoch_t epoch );
+static void       epoch_unlock( fr_epoch_t epoch );
+static void       epoch_advance( fr_epoch_t epoch, fr_t pos );
+static void       epoch_flush( fr_epoch_t epoch, fr_t pos, int list );
+static fn_t       log_node( fr_log_t log );
+static int        node_cas_next( fn_t node, fn_t peer );
+#ifdef FRAMER_USE_NODE_LOCKS
+static int  node_lock( fn_t node );
+static int  node_trylock( fn_t node );
+static void node_unlock( fn_t node );
+static void lock_home( fr_t pos );
+static void lock_peers( fr_t pos );
+static void unlock_peers( fn_t prev, fn_t node, fn_t next );
+static fn_t retire_node( fr_t pos, fn_t node );
+#endif
+#if defined( FRAMER_USE_SNAPSHOTS ) || defined( FRAMER_USE_DIRTY ) || defined( FRAMER_USE_GAPS )
+static void node_touch_all( fr_t pos, fn_t node, fn_t stop );
+#endif
+#ifdef FRAMER_USE_GAPS
+static void gap_move( fn_t node, fr_size_t idx );
+static void seg_copy( void** dst, fn_t node, fr_size_t idx, fr_size_t n );
+#endif
+static void seg_open( fr_t pos, fn_t node, fr_size_t idx );
+static void seg_shut( fr_t pos, fn_t node, fr_size_t idx );
+static void items_move( fr_t pos, void** dst, void** src, fr_size_t n );
+#ifdef FRAMER_USE_SNAPSHOTS
+static void      snap_save( struct fr_snap_dom_struct_s* dom, fn_t node );
+static void      snap_lock( struct fr_snap_dom_struct_s* dom );
+static void      snap_unlock( struct fr_snap_dom_struct_s* dom );
+static void      snap_detach( fr_t pos );
+static void      snap_put( fr_snap_t snap, fn_t node, fn_t copy );
+static fn_t      snap_get( fr_snap_t snap, fn_t node );
+static fr_size_t snap_hash( fn_t node, fr_size_t cap );
+#endif
+static void       small_grow( fr_small_t sm );
+static void       small_shrink( fr_small_t sm );
+static void       small_seek( fr_t pos, fr_size_t idx );
+
+
+/**
+ * Shared Framer.
+ */
+struct fr_sync_struct_s
+{
+    fr_t             pos;  /**< Home Position. */
+    fr_size_t        gen;  /**< Generation, i.e. write section count. */
+    pthread_rwlock_t lock; /**< Reader/writer lock. */
+};
+
+
+/**
+ * Framer file header.
+ */
+struct fr_file_head_s
+{
+    char     magic[ 4 ]; /**< "FRMR". */
+    uint32_t version;    /**< Format version. */
+    uint32_t order;      /**< Byte order mark. */
+    uint16_t flags;      /**< Format flags. */
+    uint16_t item;       /**< Item size. */
+    uint64_t icnt;       /**< Item count. */
+    uint64_t size;       /**< Segment size. */
+};
+typedef struct fr_file_head_s fr_file_head_s; /**< File header struct. */
+
+
+#ifdef FRAMER_COMPACT_LINKS
+
+/**
+ * Mapped Framer file header.
+ *
+ * Header is followed by Node slots, and Nodes refer to each other
+ * with relative links, hence the file can be mapped to any address.
+ */
+struct fr_map_head_s
+{
+    char     magic[ 4 ]; /**< "FRMP". */
+    uint32_t version;    /**< Format version. */
+    uint32_t order;      /**< Byte order mark. */
+    uint32_t unit;       /**< Link unit. */
+    uint32_t node;       /**< Node header size. */
+    uint32_t item;       /**< Item size. */
+    uint64_t size;       /**< Segment size. */
+    uint64_t slot;       /**< Slot byte size. */
+    uint64_t cnt;        /**< Slot count in file. */
+    uint64_t max;        /**< Maximum slot count. */
+    uint64_t top;        /**< Count of slots taken into use. */
+    uint64_t free;       /**< First released slot + 1 (or 0). */
+    uint64_t first;      /**< First Node slot. */
+    uint64_t icnt;       /**< Item count. */
+    uint64_t ncnt;       /**< Node count. */
+    uint64_t gen;        /**< Snapshot generation (write section count in shm). */
+
+    pthread_rwlock_t lock; /**< Reader/writer lock (shm). */
+};
+typedef struct fr_map_head_s fr_map_head_s; /**< Mapped Framer header struct. */
+
+
+/**
+ * Mapped Framer.
+ */
+struct fr_map_struct_s
+{
+    fr_t           pos;   /**< Home Position. */
+    int            fd;    /**< File descriptor. */
+    int            shm;   /**< Shared memory. */
+    char*          base;  /**< Mapping. */
+    size_t         bytes; /**< Mapping byte size. */
+    fr_map_head_s* head;  /**< File header. */
+};
+
+#endif
+
+
+/**
+ * Clone job, i.e. chunk of source Nodes to copy.
+ */
+struct clone_job_s
+{
+    fr_arena_t arena; /**< Clone arena. */
+    fn_p       src;   /**< Source Nodes. */
+    fr_size_t* base;  /**< Item offset of source Nodes. */
+    fr_size_t  a;     /**< First source Node. */
+    fr_size_t  b;     /**< End of source Nodes. */
+    int        pack;  /**< Pack to full segments. */
+};
+typedef struct clone_job_s clone_job_s; /**< Clone job struct. */
+typedef clone_job_s*       clone_job_t; /**< Clone job. */
+
+
+/**
+ * Merge state, i.e. output Nodes and consumed input Nodes.
+ */
+struct merge_s
+{
+    fr_t      dst;   /**< Destination Position. */
+    fr_t      src;   /**< Source Position. */
+    int       share; /**< Source Nodes are reused. */
+    fn_t      pool;  /**< Consumed Nodes (linked with next). */
+    fn_t      head;  /**< First output Node. */
+    fn_t      out;   /**< Last output Node. */
+    fn_t      last;  /**< Node of the last output item. */
+    fr_size_t lidx;  /**< Index of the last output item. */
+    fr_size_t icnt;  /**< Output item count. */
+    fr_size_t ncnt;  /**< Output Node count. */
+};
+typedef struct merge_s merge_s; /**< Merge state struct. */
+typedef merge_s*       merge_t; /**< Merge state. */
+
+
+/**
+ * Item filter for compacting pass.
+ *
+ * Return 1 if item is kept.
+ */
+typedef int ( *filter_f )( void* ctx, void* item );
+
+
+/**
+ * Filter context of fr_unique().
+ */
+struct unique_s
+{
+    fr_cmp_f comp; /**< Compare function. */
+    void*    last; /**< Last kept item. */
+    int      some; /**< Some item is kept. */
+};
+typedef struct unique_s unique_s; /**< Unique filter struct. */
+
+
+/**
+ * Filter context of fr_unique_hashed(), i.e. open addressing table.
+ */
+struct unique_hashed_s
+{
+    fr_hash_f hash;  /**< Hash function. */
+    fr_cmp_f  eq;    /**< Compare function. */
+    void**    slots; /**< Seen items. */
+    uint8_t*  occ;   /**< Slot occupancy bits. */
+    fr_size_t mask;  /**< Slot count - 1. */
+};
+typedef struct unique_hashed_s unique_hashed_s; /**< Hashed unique filter struct. */
+
+
+/** Set operations. */
+enum set_op_e { SET_INTERSECT, SET_UNION, SET_DIFFERENCE };
+
+
+/**
+ * Load job, i.e. double buffered Nodes filled by helper thread.
+ *
+ * Buffer states: 0 is with loader, 1 is given for filling, 2 is
+ * filled, and 3 is filled at the end of source.
+ */
+struct load_job_s
+{
+    fr_source_f     source;     /**< Item source. */
+    void*           ctx;        /**< Source context. */
+    fr_size_t       fill;       /**< Segment fill count. */
+    fn_t            buf[ 2 ];   /**< Node buffers. */
+    int             state[ 2 ]; /**< Buffer states. */
+    pthread_mutex_t lock;       /**< Buffer state lock. */
+    pthread_cond_t  cond;       /**< Buffer state change. */
+};
+typedef struct load_job_s load_job_s; /**< Load job struct. */
+typedef load_job_s*       load_job_t; /**< Load job. */
+
+
+#ifdef FRAMER_USE_SNAPSHOTS
+
+/**
+ * Snapshot domain, i.e. snapshots of one Framer.
+ */
+struct fr_snap_dom_struct_s
+{
+    fr_size_t gen;   /**< Generation of the latest snapshot. */
+    fr_snap_t snaps; /**< Snapshots, latest first. */
+    int       live;  /**< Framer exists. */
+    char      lock;  /**< Spinlock. */
+};
+typedef struct fr_snap_dom_struct_s fr_snap_dom_s; /**< Snapshot domain struct. */
+typedef fr_snap_dom_s*              fr_snap_dom_t; /**< Snapshot domain. */
+
+
+/**
+ * Snapshot.
+ *
+ * Node copies are stored to a hash table, keyed by the original Node
+ * address. Nodes not in the table are shared with the Framer.
+ */
+struct fr_snap_struct_s
+{
+    fr_snap_dom_t dom;    /**< Snapshot domain. */
+    fr_size_t     gen;    /**< Snapshot generation. */
+    fn_t          anchor; /**< Node of Position at snapshot. */
+    fn_t          first;  /**< First Node (or NULL if not yet resolved). */
+    fr_size_t     icnt;   /**< Item count. */
+    fn_p          keys;   /**< Original Nodes. */
+    fn_p          vals;   /**< Node copies. */
+    fr_size_t     cnt;    /**< Copy count. */
+    fr_size_t     cap;    /**< Table capacity. */
+    fr_snap_t     next;   /**< Older snapshot. */
+};
+
+#endif
+
 
 
 /* ------------------------------------------------------------
@@ -29,6 +351,35 @@ static fn_t alloc_node( fr_t pos );
 /** Boolean false. */
 #define fr_false 0
 
+/** File items are encoded records. */
+#define FR_FILE_ENCODED 0x1
+
+/** Node lock value of retired Node. */
+#define FR_LOCK_DEAD 2
+
+/** Node dirty value, i.e. no Node index at checkpoint. */
+#define FR_DIRTY -1
+
+/** Staging buffer size for encoded items. */
+#define FR_IO_BUF ( 64 * 1024 )
+
+/** Mapped Framer header size, i.e. offset of first slot. */
+#define FR_MAP_HEAD 4096
+
+/** Initial slot count of Mapped Framer file. */
+#define FR_MAP_GROW 64
+
+/** Mapped Framer slot by index. */
+#define map_slot( map, i ) \
+    ( (fn_t)( ( map )->base + FR_MAP_HEAD + ( i ) * ( map )->head->slot ) )
+
+#ifdef IOV_MAX
+/** Maximum iovec count for writev(). */
+#define FR_IOV_MAX ( IOV_MAX < 1024 ? IOV_MAX : 1024 )
+#else
+#define FR_IOV_MAX 1024
+#endif
+
 
 /** Call custom alloc function. */
 #define memapi_alloc( pos ) ( pos )->mem->alloc( ( pos ), ( pos )->mem->env )
@@ -36,9 +387,208 @@ static fn_t alloc_node( fr_t pos );
 /** Call custom free function. */
 #define memapi_free( pos ) ( pos )->mem->free( ( pos ), ( pos )->mem->env )
 
-/** Half size of segment. */
-#define half_seg( pos ) \
-    ( ( ( pos )->size & 0x1L ) == 0 ? ( pos )->size / 2 : ( pos )->size / 2 + 1 )
+/** Call custom close function. */
+#define memapi_close( pos ) ( pos )->mem->close( ( pos ), ( pos )->mem->env )
+
+/** Arena slot by index. */
+#define arena_slot( arena, i ) ( (fn_t)( ( arena )->base + ( i ) * ( arena )->slot ) )
+
+/** Is Node in arena block? */
+#define arena_has( arena, node )                  \
+    ( (char*)( node ) >= ( arena )->base &&       \
+      (char*)( node ) < ( arena )->base + ( arena )->cnt * ( arena )->slot )
+
+/** Half size of Node segment. */
+#define half_seg( node ) \
+    ( ( ( node )->size & 0x1L ) == 0 ? ( node )->size / 2 : ( node )->size / 2 + 1 )
+
+/** Free space in Node segment. */
+#define free_seg( node ) ( ( node )->size - ( node )->used )
+
+/** Round n up to multiple of a. */
+#define align_up( n, a ) ( ( ( n ) + ( a ) - 1 ) / ( a ) * ( a ) )
+
+/** Node allocation byte size, i.e. in whole cache lines. */
+#define node_alloc_bytes( size ) align_up( FR_NODE_SIZE + ( size ) * FR_ITEM_SIZE, node_align() )
+
+#ifdef FRAMER_COMPACT_LINKS
+
+/** Reserve Node memory from Node space. */
+#define node_malloc( bytes ) space_alloc( bytes )
+
+/** Release Node memory to Node space. */
+#define node_free( ptr, bytes ) space_free( ( ptr ), ( bytes ) )
+
+#else
+
+/** Reserve Node memory. */
+#define node_malloc( bytes ) fr_malloc_aligned( node_align(), ( bytes ) )
+
+/** Release Node memory. */
+#define node_free( ptr, bytes ) fr_free( ptr )
+
+#endif
+
+/** Node byte size, as allocated. */
+#define node_bytes( node ) node_alloc_bytes( ( node )->size )
+
+/** Pack limit for Node segment. */
+#define pack_seg( node, limit ) ( ( node )->size < ( limit ) ? ( node )->size : ( limit ) )
+
+#ifdef FRAMER_COMPACT_LINKS
+
+/** Next Node, with acquire load. */
+#define fn_next_acquire( node ) \
+    fn_link_node( ( node ), __atomic_load_n( &( ( node )->next ), __ATOMIC_ACQUIRE ) )
+
+/** Set next Node, with release store. */
+#define fn_set_next_release( node, peer ) \
+    __atomic_store_n( &( ( node )->next ), fn_link( ( node ), ( peer ) ), __ATOMIC_RELEASE )
+
+#else
+
+/** Next Node, with acquire load. */
+#define fn_next_acquire( node ) __atomic_load_n( &( ( node )->next ), __ATOMIC_ACQUIRE )
+
+/** Set next Node, with release store. */
+#define fn_set_next_release( node, peer ) \
+    __atomic_store_n( &( ( node )->next ), ( peer ), __ATOMIC_RELEASE )
+
+#endif
+
+#ifdef FRAMER_USE_SNAPSHOTS
+
+/** Save Node for snapshots, before Node is modified. */
+#define snap_touch( pos, node )                                                  \
+    do {                                                                         \
+        if ( ( pos )->snap && ( node ) && ( node )->gen < ( pos )->snap->gen ) \
+            snap_save( ( pos )->snap, ( node ) );                                \
+    } while ( 0 )
+
+/** Snapshot generation for new Nodes. */
+#define snap_gen( pos ) ( ( pos )->snap ? ( pos )->snap->gen : 0 )
+
+/** Reference count of Node copy. */
+#define snap_ref( copy ) ( (fr_size_t*)( (char*)( copy ) - node_align() ) )
+
+#ifdef FRAMER_COMPACT_LINKS
+
+/** Previous of original Node, from Node copy (links are relative to original). */
+#define snap_prev( node, copy ) fn_link_node( ( node ), ( copy )->prev )
+
+/** Next of original Node, from Node copy. */
+#define snap_next( node, copy ) fn_link_node( ( node ), ( copy )->next )
+
+#else
+
+/** Previous of original Node, from Node copy. */
+#define snap_prev( node, copy ) ( ( copy )->prev )
+
+/** Next of original Node, from Node copy. */
+#define snap_next( node, copy ) ( ( copy )->next )
+
+#endif
+
+#else
+
+/* Snapshot save is void without snapshots. */
+
+/** Save Node for snapshots, before Node is modified. */
+#define snap_touch( pos, node ) \
+    do {                        \
+    } while ( 0 )
+
+/** Snapshot generation for new Nodes. */
+#define snap_gen( pos ) 0
+
+#endif
+
+#ifdef FRAMER_USE_DIRTY
+
+/** Mark Node changed since checkpoint. */
+#define dirty_mark( node )              \
+    do {                                \
+        if ( node )                     \
+            ( node )->dirty = FR_DIRTY; \
+    } while ( 0 )
+
+#else
+
+/** Mark Node changed since checkpoint. */
+#define dirty_mark( node ) \
+    do {                   \
+    } while ( 0 )
+
+#endif
+
+#ifdef FRAMER_USE_GAPS
+
+/** Item count before segment gap. */
+#define gap_head( node ) ( ( node )->used - ( node )->gap )
+
+/** Segment slot of item idx, i.e. past the gap for items after it. */
+#define node_slot( node, idx )                                  \
+    ( ( idx ) >= gap_head( node ) && ( idx ) < ( node )->used \
+          ? ( idx ) + free_seg( node )                        \
+          : ( idx ) )
+
+/** Close segment gap, i.e. move it after the last item. */
+#define gap_close( node )                         \
+    do {                                          \
+        if ( ( node ) && ( node )->gap )          \
+            gap_move( ( node ), ( node )->used ); \
+    } while ( 0 )
+
+#else
+
+/* Segment is contiguous without gaps. */
+
+/** Segment slot of item idx. */
+#define node_slot( node, idx ) ( idx )
+
+/** Close segment gap. */
+#define gap_close( node ) \
+    do {                  \
+    } while ( 0 )
+
+/** Copy n items of Node segment from idx. */
+#define seg_copy( dst, node, idx, n ) \
+    memcpy( ( dst ), &( ( node )->data[ idx ] ), ( n ) * FR_ITEM_SIZE )
+
+#endif
+
+/** Store Node used count, with release for epoch readers. */
+#define used_store( node, n ) __atomic_store_n( &( ( node )->used ), ( n ), __ATOMIC_RELEASE )
+
+/** Store item idx of Node, atomically for epoch readers. */
+#define item_store( node, idx, item ) \
+    __atomic_store_n( &( ( node )->data[ idx ] ), ( item ), __ATOMIC_RELAXED )
+
+/** Is Framer scanned by epoch readers? */
+#define epoch_on( pos ) ( ( pos )->mem && ( pos )->mem->alloc == epoch_alloc )
+
+/** Item idx of Node. */
+#define node_item( node, idx ) ( ( node )->data[ node_slot( ( node ), ( idx ) ) ] )
+
+/** Prepare Node for modification, i.e. save for snapshots, mark dirty and close gap. */
+#define node_touch( pos, node )          \
+    do {                                 \
+        snap_touch( ( pos ), ( node ) ); \
+        dirty_mark( node );              \
+        gap_close( node );               \
+    } while ( 0 )
+
+#ifndef FRAMER_USE_CURSORS
+
+/* Cursor fix-up is void without cursors. */
+
+/** Move cursors of n items from src at a, to dst at b. */
+#define cursor_move( src, a, n, dst, b )
+
+/** Move all cursors of Node to dst at idx. */
+#define cursor_rehome( node, dst, idx )
+
+#endif
 
 
 
@@ -48,7 +598,7 @@ static fn_t alloc_node( fr_t pos );
 
 fr_t fr_create( void )
 {
-    return fr_create_sized( FR_SEG_DEFAULT );
+    return fr_create_sized( fr_seg_lines( 1 ) );
 }
 
 
@@ -58,14 +608,86 @@ fr_t fr_create_sized( fr_size_t size )
     fr_t pos;
 
     fn = fn_new_sized( size );
+    if ( fn == NULL )
+        return NULL;
     pos = fr_pos_new( size );
+    if ( pos == NULL ) {
+        node_free( fn, node_alloc_bytes( size ) );
+        return NULL;
+    }
     pos->seg = fn;
     pos->ncnt = 1;
+    pos->bcnt = node_bytes( fn );
+
+    return pos;
+}
+
+
+fr_t fr_create_adaptive( fr_size_t size, fr_size_t max )
+{
+    fr_t pos;
+
+    assert( max >= size );
+
+    pos = fr_create_sized( size );
+    if ( pos == NULL )
+        return NULL;
+    pos->max = max;
 
     return pos;
 }
 
 
+fr_size_t fr_cache_line_size( void )
+{
+    static fr_size_t line = 0;
+
+    if ( line == 0 ) {
+
+        fr_size_t size = 0;
+
+#ifdef _SC_LEVEL1_DCACHE_LINESIZE
+        size = sysconf( _SC_LEVEL1_DCACHE_LINESIZE );
+#endif
+
+        if ( size <= 0 ) {
+
+            FILE* fh;
+
+            fh = fopen( "/sys/devices/system/cpu/cpu0/cache/index0/coherency_line_size", "r" );
+            if ( fh ) {
+                long val;
+                if ( fscanf( fh, "%ld", &val ) == 1 )
+                    size = val;
+                fclose( fh );
+            }
+        }
+
+        /* Accept only sane values, i.e. power of 2. */
+        if ( size < 16 || size > 4096 || ( size & ( size - 1 ) ) != 0 )
+            size = FR_CACHE_LINE_SIZE;
+
+        line = size;
+    }
+
+    return line;
+}
+
+
+fr_size_t fr_seg_lines( fr_size_t lines )
+{
+    fr_size_t line = fr_cache_line_size();
+    fr_size_t size;
+
+    for ( ;; ) {
+        size = ( lines * line - (fr_size_t)FR_NODE_SIZE ) / (fr_size_t)FR_ITEM_SIZE;
+        if ( lines * line > (fr_size_t)FR_NODE_SIZE && size >= FR_SEG_MIN )
+            return size;
+        lines++;
+    }
+}
+
+
 fr_t fr_create_using( fr_t pos )
 {
     pos->seg = alloc_node( pos );
@@ -78,21 +700,33 @@ fr_t fr_destroy( fr_t pos )
 {
     fn_t next;
 
+#ifdef FRAMER_USE_SNAPSHOTS
+    if ( pos->snap )
+        snap_detach( pos );
+#endif
+
+#ifdef FRAMER_USE_NODE_LOCKS
+    fr_locked_reclaim( pos );
+#endif
+
     pos->seg = fn_first( pos->seg );
 
     if ( pos->mem ) {
 
         while ( pos->seg ) {
-            next = pos->seg->next;
+            next = fn_next( pos->seg );
             memapi_free( pos );
             pos->seg = next;
         }
 
+        if ( pos->mem->close )
+            memapi_close( pos );
+
     } else {
 
         while ( pos->seg ) {
-            next = pos->seg->next;
-            fr_free( pos->seg );
+            next = fn_next( pos->seg );
+            node_free( pos->seg, node_alloc_bytes( pos->seg->size ) );
             pos->seg = next;
         }
     }
@@ -108,49 +742,38 @@ void fr_insert( fr_t pos, void* item )
     pos->icnt++;
     s = pos->seg;
 
-    if ( pos->idx > 0 && s->used < pos->size ) {
+    if ( pos->idx > 0 && s->used < s->size ) {
 
         /* xx.-x..
          *      ^
          */
 
-        if ( pos->idx < s->used ) {
-
-            memmove( &( s->data[ pos->idx + 1 ] ),
-                     &( s->data[ pos->idx ] ),
-                     ( s->used - pos->idx ) * FR_ITEM_SIZE );
-        }
-
-        s->data[ pos->idx ] = item;
-        s->used++;
+        seg_open( pos, s, pos->idx );
+        item_store( s, pos->idx, item );
+        used_store( s, s->used + 1 );
 
-    } else if ( pos->idx == 0 && s->prev && ( s->prev->used < pos->size ) ) {
+    } else if ( pos->idx == 0 && fn_prev( s ) && ( fn_prev( s )->used < fn_prev( s )->size ) ) {
 
         /* xx.-x..
          *     ^
          */
 
-        s = s->prev;
-        s->data[ s->used ] = item;
-        s->used++;
+        s = fn_prev( s );
+        node_touch( pos, s );
+        item_store( s, s->used, item );
+        used_store( s, s->used + 1 );
         pos->seg = s;
         pos->idx = s->used - 1;
 
-    } else if ( s->used < pos->size ) {
+    } else if ( s->used < s->size ) {
 
         /* xx.-x..
          *      ^
          */
 
-        if ( pos->idx < s->used ) {
-
-            memmove( &( s->data[ pos->idx + 1 ] ),
-                     &( s->data[ pos->idx ] ),
-                     ( s->used - pos->idx ) * FR_ITEM_SIZE );
-        }
-
-        s->data[ pos->idx ] = item;
-        s->used++;
+        seg_open( pos, s, pos->idx );
+        item_store( s, pos->idx, item );
+        used_store( s, s->used + 1 );
 
     } else {
 
@@ -166,10 +789,11 @@ void fr_insert( fr_t pos, void* item )
 
             pos->ncnt++;
 
+            node_touch( pos, s );
             s = fn_append( s, alloc_node( pos ) );
 
-            s->data[ 0 ] = item;
-            s->used++;
+            item_store( s, 0, item );
+            used_store( s, s->used + 1 );
 
             pos->seg = s;
             pos->idx = 0;
@@ -178,11 +802,11 @@ void fr_insert( fr_t pos, void* item )
 
             /* Check if peers have space. */
 
-            if ( pos->idx < half_seg( pos ) && pos->seg->prev ) {
+            if ( pos->idx < half_seg( s ) && fn_prev( pos->seg ) ) {
 
-                fn_t prev = pos->seg->prev;
+                fn_t prev = fn_prev( pos->seg );
 
-                if ( pos->idx != 0 && pos->idx <= ( pos->size - prev->used ) ) {
+                if ( pos->idx != 0 && pos->idx <= free_seg( prev ) ) {
 
                     /* All fit to left. */
 
@@ -190,31 +814,36 @@ void fr_insert( fr_t pos, void* item )
                      *        ^
                      */
 
-                    memcpy(
-                        &( prev->data[ prev->used ] ), pos->seg->data, pos->idx * FR_ITEM_SIZE );
-                    prev->used += pos->idx;
+                    node_touch( pos, prev );
+                    node_touch( pos, pos->seg );
+
+                    items_move( pos, &( prev->data[ prev->used ] ), pos->seg->data, pos->idx );
+                    cursor_move( pos->seg, 0, pos->idx, prev, prev->used );
+                    used_store( prev, prev->used + pos->idx );
 
-                    pos->seg->used -= pos->idx;
+                    used_store( pos->seg, pos->seg->used - pos->idx );
 
                     if ( pos->idx > 1 ) {
-                        memmove( &( pos->seg->data[ 1 ] ),
-                                 &( pos->seg->data[ pos->idx ] ),
-                                 pos->seg->used * FR_ITEM_SIZE );
+                        items_move( pos,
+                                    &( pos->seg->data[ 1 ] ),
+                                    &( pos->seg->data[ pos->idx ] ),
+                                    pos->seg->used );
+                        cursor_move( pos->seg, pos->idx, pos->seg->used, pos->seg, 1 );
                     }
 
-                    pos->seg->data[ 0 ] = item;
-                    pos->seg->used++;
+                    item_store( pos->seg, 0, item );
+                    used_store( pos->seg, pos->seg->used + 1 );
                     pos->idx = 0;
 
                     return;
                 }
 
-            } else if ( pos->idx >= half_seg( pos ) && pos->seg->next ) {
+            } else if ( pos->idx >= half_seg( s ) && fn_next( pos->seg ) ) {
 
-                fn_t      next = pos->seg->next;
+                fn_t      next = fn_next( pos->seg );
                 fr_size_t cnt = pos->seg->used - pos->idx;
 
-                if ( cnt <= ( pos->size - next->used ) ) {
+                if ( cnt <= free_seg( next ) ) {
 
                     /* All fit to right. */
 
@@ -222,14 +851,19 @@ void fr_insert( fr_t pos, void* item )
                      *    ^
                      */
 
-                    memmove( &( next->data[ cnt ] ), next->data, cnt * FR_ITEM_SIZE );
+                    node_touch( pos, next );
+                    node_touch( pos, pos->seg );
 
-                    memcpy( next->data, &( pos->seg->data[ pos->idx ] ), cnt * FR_ITEM_SIZE );
+                    items_move( pos, &( next->data[ cnt ] ), next->data, next->used );
+                    cursor_move( next, 0, next->used, next, cnt );
 
-                    next->used += cnt;
-                    pos->seg->used -= cnt;
-                    pos->seg->data[ pos->idx ] = item;
-                    pos->seg->used++;
+                    items_move( pos, next->data, &( pos->seg->data[ pos->idx ] ), cnt );
+                    cursor_move( pos->seg, pos->idx, cnt, next, 0 );
+
+                    used_store( next, next->used + cnt );
+                    used_store( pos->seg, pos->seg->used - cnt );
+                    item_store( pos->seg, pos->idx, item );
+                    used_store( pos->seg, pos->seg->used + 1 );
 
                     return;
                 }
@@ -241,17 +875,21 @@ void fr_insert( fr_t pos, void* item )
              * even out.
              */
 
+            fr_size_t tail_cnt = s->used - pos->idx;
+
             pos->ncnt++;
 
-            fn_append( s, alloc_node( pos ) );
+            node_touch( pos, s );
+            node_touch( pos, fn_next( s ) );
+            fn_append( s, alloc_node_min( pos, tail_cnt ) );
 
-            fr_size_t tail_cnt = s->used - pos->idx;
-            memcpy( s->next->data, &( s->data[ pos->idx ] ), tail_cnt * FR_ITEM_SIZE );
+            items_move( pos, fn_next( s )->data, &( s->data[ pos->idx ] ), tail_cnt );
+            cursor_move( s, pos->idx, tail_cnt, fn_next( s ), 0 );
 
-            s->next->used = tail_cnt;
+            used_store( fn_next( s ), tail_cnt );
 
-            s->data[ pos->idx ] = item;
-            s->used = pos->idx + 1;
+            item_store( s, pos->idx, item );
+            used_store( s, pos->idx + 1 );
 
             fr_even( pos );
         }
@@ -261,13 +899,14 @@ void fr_insert( fr_t pos, void* item )
 
 void fr_append( fr_t pos, void* item )
 {
-    if ( pos->icnt != 0 && ( pos->idx == pos->seg->used - 1 ) && pos->seg->next == NULL &&
-         pos->seg->used < pos->size ) {
+    if ( pos->icnt != 0 && ( pos->idx == pos->seg->used - 1 ) && fn_next( pos->seg ) == NULL &&
+         pos->seg->used < pos->seg->size ) {
 
+        node_touch( pos, pos->seg );
         pos->icnt++;
-        pos->seg->used++;
         pos->idx++;
-        pos->seg->data[ pos->idx ] = item;
+        item_store( pos->seg, pos->idx, item );
+        used_store( pos->seg, pos->seg->used + 1 );
 
     } else {
 
@@ -278,7 +917,7 @@ void fr_append( fr_t pos, void* item )
 
         } else {
 
-            if ( pos->seg->used < pos->size ) {
+            if ( pos->seg->used < pos->seg->size ) {
 
                 /* xx.-xx.-xx.  ->  xx.-xx.-xx.
                  *      ^                 ^
@@ -287,7 +926,7 @@ void fr_append( fr_t pos, void* item )
 
             } else {
 
-                if ( pos->seg->next == NULL ) {
+                if ( fn_next( pos->seg ) == NULL ) {
 
                     /* xx.-xxx  ->  xx.-xxx
                      *       ^             ^
@@ -312,51 +951,46 @@ void fr_append( fr_t pos, void* item )
 void* fr_delete( fr_t pos )
 {
     fn_t  s = pos->seg;
-    void* ret = s->data[ pos->idx ];
+    void* ret = node_item( s, pos->idx );
 
     if ( s->used > 1 ) {
 
         pos->icnt--;
 
         if ( pos->idx < s->used - 1 ) {
-            memmove( &( s->data[ pos->idx ] ),
-                     &( s->data[ pos->idx + 1 ] ),
-                     ( s->used - ( pos->idx + 1 ) ) * FR_ITEM_SIZE );
+            seg_shut( pos, s, pos->idx );
         } else {
-            if ( s->next ) {
-                pos->seg = s->next;
+            node_touch( pos, s );
+            if ( fn_next( s ) ) {
+                cursor_move( s, pos->idx, 1, fn_next( s ), 0 );
+                pos->seg = fn_next( s );
                 pos->idx = 0;
             } else {
+                cursor_move( s, pos->idx, 1, s, pos->idx - 1 );
                 pos->idx--;
             }
         }
 
-        s->used--;
+        used_store( s, s->used - 1 );
 
     } else if ( s->used == 1 ) {
 
         pos->icnt--;
+        node_touch( pos, fn_prev( s ) );
+        node_touch( pos, s );
+        node_touch( pos, fn_next( s ) );
 
-        if ( s->next == NULL && s->prev == NULL ) {
+        if ( fn_next( s ) == NULL && fn_prev( s ) == NULL ) {
 
             /* Leave first node. */
-            s->used--;
+            used_store( s, s->used - 1 );
             pos->idx = 0;
-            s->data[ 0 ] = NULL;
+            item_store( s, 0, NULL );
 
         } else {
 
-            if ( s->next == NULL )
-                pos->idx = s->prev->used - 1;
-            else
-                pos->idx = 0;
-
-            pos->ncnt--;
-
-            if ( pos->mem )
-                memapi_free( pos );
-            else
-                pos->seg = fn_delete( pos->seg );
+            leave_node( pos, s );
+            pos->seg = release_node( pos, pos->seg );
         }
     }
 
@@ -374,12 +1008,13 @@ void* fr_delete_even( fr_t pos )
 
 void fr_push( fr_t pos, void* item )
 {
-    if ( pos->icnt != 0 && pos->seg->used < pos->size ) {
+    if ( pos->icnt != 0 && pos->seg->used < pos->seg->size ) {
 
+        node_touch( pos, pos->seg );
         pos->icnt++;
-        pos->seg->used++;
         pos->idx++;
-        pos->seg->data[ pos->idx ] = item;
+        item_store( pos->seg, pos->idx, item );
+        used_store( pos->seg, pos->seg->used + 1 );
 
     } else {
 
@@ -394,9 +1029,11 @@ void* fr_pop( fr_t pos )
 
         void* ret;
 
+        node_touch( pos, pos->seg );
         ret = pos->seg->data[ pos->idx ];
+        cursor_move( pos->seg, pos->idx, 1, pos->seg, pos->idx - 1 );
         pos->idx--;
-        pos->seg->used--;
+        used_store( pos->seg, pos->seg->used - 1 );
         pos->icnt--;
 
         return ret;
@@ -410,27 +1047,32 @@ void* fr_pop( fr_t pos )
 
 int fr_even( fr_t pos )
 {
-    if ( pos->seg->next ) {
+    if ( fn_next( pos->seg ) ) {
 
-        fn_t next = pos->seg->next;
+        fn_t next = fn_next( pos->seg );
 
-        if ( ( pos->seg->used + next->used ) <= pos->size ) {
+        if ( ( pos->seg->used + next->used ) <= pos->seg->size ) {
 
             /* xx..-xx..
              *  ^
              */
 
-            memcpy( &( pos->seg->data[ pos->seg->used ] ), next->data, next->used * FR_ITEM_SIZE );
+            node_touch( pos, pos->seg );
+            node_touch( pos, next );
+            node_touch( pos, fn_next( next ) );
 
-            pos->seg->used += next->used;
+            items_move( pos, &( pos->seg->data[ pos->seg->used ] ), next->data, next->used );
+            cursor_move( next, 0, next->used, pos->seg, pos->seg->used );
+
+            used_store( pos->seg, pos->seg->used + next->used );
 
             pos->ncnt--;
 
-            fn_delete( next );
+            release_node( pos, next );
 
             return 2;
 
-        } else if ( ( pos->seg->used * 2 ) < pos->size ) {
+        } else if ( ( pos->seg->used * 2 ) < pos->seg->size ) {
 
             /* Fill upto half from next. */
 
@@ -440,14 +1082,19 @@ int fr_even( fr_t pos )
 
             fr_size_t cnt;
 
-            cnt = half_seg( pos ) - pos->seg->used;
+            node_touch( pos, pos->seg );
+            node_touch( pos, next );
+
+            cnt = half_seg( pos->seg ) - pos->seg->used;
 
-            memcpy( &( pos->seg->data[ pos->seg->used ] ), next->data, cnt * FR_ITEM_SIZE );
+            items_move( pos, &( pos->seg->data[ pos->seg->used ] ), next->data, cnt );
+            cursor_move( next, 0, cnt, pos->seg, pos->seg->used );
 
-            memmove( next->data, &( next->data[ cnt ] ), cnt * FR_ITEM_SIZE );
+            items_move( pos, next->data, &( next->data[ cnt ] ), next->used - cnt );
+            cursor_move( next, cnt, next->used - cnt, next, 0 );
 
-            pos->seg->used += cnt;
-            pos->seg->next->used -= cnt;
+            used_store( pos->seg, pos->seg->used + cnt );
+            used_store( fn_next( pos->seg ), fn_next( pos->seg )->used - cnt );
 
             return 1;
 
@@ -456,7 +1103,7 @@ int fr_even( fr_t pos )
             return 0;
         }
 
-    } else if ( pos->seg->prev && ( ( pos->seg->used * 2 ) < pos->size ) ) {
+    } else if ( fn_prev( pos->seg ) && ( ( pos->seg->used * 2 ) < pos->seg->size ) ) {
 
         /* Fill upto half from prev. */
 
@@ -465,17 +1112,29 @@ int fr_even( fr_t pos )
          *        ^                 ^
          */
 
-        fn_t      prev = pos->seg->prev;
+        fn_t      prev = fn_prev( pos->seg );
         fr_size_t cnt;
 
-        cnt = half_seg( pos ) - pos->seg->used;
+        cnt = half_seg( pos->seg ) - pos->seg->used;
+
+        /* Smaller prev (adaptive mode) can't give more than it has. */
+        if ( cnt >= prev->used )
+            cnt = prev->used - 1;
+
+        if ( cnt <= 0 )
+            return 0;
+
+        node_touch( pos, prev );
+        node_touch( pos, pos->seg );
 
-        memmove( &( pos->seg->data[ pos->seg->used ] ), pos->seg->data, cnt * FR_ITEM_SIZE );
+        items_move( pos, &( pos->seg->data[ cnt ] ), pos->seg->data, pos->seg->used );
+        cursor_move( pos->seg, 0, pos->seg->used, pos->seg, cnt );
 
-        memcpy( pos->seg->data, &( prev->data[ prev->used - cnt ] ), cnt * FR_ITEM_SIZE );
+        items_move( pos, pos->seg->data, &( prev->data[ prev->used - cnt ] ), cnt );
+        cursor_move( prev, prev->used - cnt, cnt, pos->seg, 0 );
 
-        prev->used -= cnt;
-        pos->seg->used += cnt;
+        used_store( prev, prev->used - cnt );
+        used_store( pos->seg, pos->seg->used + cnt );
         pos->idx += cnt;
 
         return 1;
@@ -500,52 +1159,64 @@ int fr_pack_range( fr_t pos, fr_t end, fr_size_t limit )
     fr_s      a;
     fr_s      b;
     fr_size_t b_used;
+    fn_t      stop;
+
+    stop = end ? end->seg : NULL;
 
     a = *pos;
-    while ( a.seg && a.seg->used >= limit && ( !end || a.seg != end->seg ) )
-        a.seg = a.seg->next;
+    while ( a.seg && a.seg->used >= pack_seg( a.seg, limit ) && ( !end || a.seg != end->seg ) )
+        a.seg = fn_next( a.seg );
 
-    if ( a.seg == NULL || a.seg->next == NULL || ( end && a.seg == end->seg ) )
+    if ( a.seg == NULL || fn_next( a.seg ) == NULL || ( end && a.seg == end->seg ) )
         return 0;
 
     a.idx = a.seg->used;
     b = a;
-    b.seg = b.seg->next;
+    b.seg = fn_next( b.seg );
     b.idx = 0;
     b_used = b.seg->used;
 
     if ( end && b.seg == end->seg )
         return 0;
 
-    while ( ( end == NULL && b.seg != NULL ) || b.seg != end->seg ) {
+#if defined( FRAMER_USE_SNAPSHOTS ) || defined( FRAMER_USE_DIRTY ) || defined( FRAMER_USE_GAPS )
+    node_touch_all( pos, a.seg, stop );
+#endif
 
-        a.seg->data[ a.idx++ ] = b.seg->data[ b.idx++ ];
-        a.seg->used++;
+    /* Writer a never passes reader b. Writer continues to the next
+     * Node only when it is consumed, or it is the reader Node, where
+     * writer index is behind reader index. Writer fills the reader
+     * Node beyond limit instead of passing it. */
+
+    while ( b.seg != stop ) {
 
-        if ( a.seg->used >= limit ) {
-            a.seg = a.seg->next;
+        if ( a.seg->used >= pack_seg( a.seg, limit ) && a.seg != b.seg ) {
+            a.seg = fn_next( a.seg );
             a.idx = 0;
             a.seg->used = 0;
         }
 
+        cursor_move( b.seg, b.idx, 1, a.seg, a.idx );
+        a.seg->data[ a.idx++ ] = b.seg->data[ b.idx++ ];
+        a.seg->used++;
+
         if ( b.idx >= b_used ) {
-            b.seg = b.seg->next;
-            if ( b.seg == NULL )
+            b.seg = fn_next( b.seg );
+            if ( b.seg == stop )
                 break;
             b_used = b.seg->used;
             b.idx = 0;
         }
     }
 
-    /* Remove left-over nodes. */
+    /* Remove left-over nodes, upto end. */
     fn_t na, nb;
-    na = a.seg->next;
-    a.seg->next = NULL;
+    na = fn_next( a.seg );
 
-    while ( na ) {
-        nb = na->next;
+    while ( na != stop ) {
+        nb = fn_next( na );
         pos->ncnt--;
-        fr_free( na );
+        release_node( pos, na );
         na = nb;
     }
 
@@ -553,67 +1224,468 @@ int fr_pack_range( fr_t pos, fr_t end, fr_size_t limit )
 }
 
 
-fr_size_t fr_length( fr_t pos )
+fr_size_t fr_compact_step( fr_t pos, fr_t cur, fr_size_t budget )
 {
-    return pos->icnt;
-}
+    fn_t      s = cur->seg;
+    fn_t      next;
+    fr_size_t cnt;
+    fr_size_t work = 0;
 
+    while ( work < budget && fn_next( s ) ) {
 
-fr_size_t fr_tail_length( fr_t pos )
-{
-    fr_size_t cnt = 0;
-    fr_s      tmp = *pos;
+        next = fn_next( s );
 
-    /* Tail of current segment. */
-    cnt = tmp.seg->used - tmp.idx;
+        if ( s->used >= s->size ) {
 
-    /* Rest with full "used" count. */
-    while ( tmp.seg->next ) {
-        tmp.seg = tmp.seg->next;
-        cnt += tmp.seg->used;
-    }
+            /* Full, step to next. */
 
-    return cnt;
-}
+            s = next;
+            cur->seg = s;
+            cur->idx = 0;
+            work++;
+            continue;
+        }
 
+        /* xx..-xxx.  ->  xxxx-x...
+         * ^              ^
+         */
 
-fr_size_t fr_node_count( fr_t pos )
-{
-    return pos->ncnt;
-}
+        node_touch( pos, s );
+        node_touch( pos, next );
+        if ( next->used <= free_seg( s ) )
+            node_touch( pos, fn_next( next ) );
+
+        cnt = free_seg( s );
+        if ( cnt > next->used )
+            cnt = next->used;
+        if ( cnt > budget - work )
+            cnt = budget - work;
+
+        /* Home Position follows its item. */
+        if ( pos->seg == next ) {
+            if ( pos->idx < cnt ) {
+                pos->seg = s;
+                pos->idx += s->used;
+            } else {
+                pos->idx -= cnt;
+            }
+        }
 
+        memcpy( &( s->data[ s->used ] ), next->data, cnt * FR_ITEM_SIZE );
+        cursor_move( next, 0, cnt, s, s->used );
+        s->used += cnt;
+        next->used -= cnt;
+        work += cnt;
 
-fr_size_t fr_size( fr_t pos )
-{
-    return pos->size;
+        if ( next->used == 0 ) {
+            pos->ncnt--;
+            release_node( pos, next );
+        } else {
+            memmove( next->data, &( next->data[ cnt ] ), next->used * FR_ITEM_SIZE );
+            cursor_move( next, cnt, next->used, next, 0 );
+        }
+    }
+
+    return work;
 }
 
 
-fr_size_t fr_index( fr_t pos )
+void fr_defrag( fr_t pos, fr_p live, fr_size_t cnt, int pack )
 {
-    return pos->idx;
-}
+    fr_arena_t arena;
+    fr_arena_t old;
+    fn_t       node;
+    fn_t       next;
+    fn_t       slot;
+    fr_t       p;
+    fr_size_t  ncnt = 0;
+    fr_size_t  icnt = 0;
+    fr_size_t  size = pos->size;
+    fr_size_t  ord;
+    fr_size_t  base;
+    fr_size_t  k;
+    fr_size_t* at;
+
+#if defined( FRAMER_USE_SNAPSHOTS ) || defined( FRAMER_USE_DIRTY ) || defined( FRAMER_USE_GAPS )
+    node_touch_all( pos, fn_first( pos->seg ), NULL );
+#endif
+
+    node = fn_first( pos->seg );
+    for ( ; node; node = fn_next( node ) ) {
+        ncnt++;
+        icnt += node->used;
+        if ( node->size > size )
+            size = node->size;
+    }
 
+    if ( pack ) {
+        ncnt = ( icnt + size - 1 ) / size;
+        if ( ncnt == 0 )
+            ncnt = 1;
+    }
 
-fr_size_t fr_used( fr_t pos )
-{
-    return pos->seg->used;
-}
+    /* Framer is left as is, if arena can't be reserved. */
+    arena = arena_new( ncnt, size );
+    if ( arena == NULL )
+        return;
 
 
-fr_s fr_find( fr_t pos, void* item )
-{
-    fr_s tmp = *pos;
+    /* Record live Positions, and pos as the last one, as Node order
+     * and index, or as item index when packing. */
 
-    while ( tmp.seg ) {
-        while ( tmp.idx < tmp.seg->used ) {
-            if ( tmp.seg->data[ tmp.idx ] == item ) {
-                return tmp;
+    at = fr_malloc( 2 * ( cnt + 1 ) * sizeof( fr_size_t ) );
+
+    ord = 0;
+    base = 0;
+    for ( node = fn_first( pos->seg ); node; node = fn_next( node ) ) {
+        for ( k = 0; k <= cnt; k++ ) {
+            p = ( k < cnt ) ? live[ k ] : pos;
+            if ( p->seg == node ) {
+                at[ 2 * k ] = ord;
+                at[ 2 * k + 1 ] = pack ? base + p->idx : p->idx;
+            }
+        }
+        ord++;
+        base += node->used;
+    }
+
+
+    /* Copy Nodes to arena in order. */
+
+    arena_chain( arena, snap_gen( pos ) );
+
+    ord = 0;
+    slot = arena_slot( arena, 0 );
+    for ( node = fn_first( pos->seg ); node; node = fn_next( node ) ) {
+
+        if ( pack ) {
+
+            fr_size_t idx = 0;
+            fr_size_t n;
+
+            while ( idx < node->used ) {
+                if ( slot->used >= size )
+                    slot = fn_next( slot );
+                n = node->used - idx;
+                if ( n > size - slot->used )
+                    n = size - slot->used;
+                memcpy( &( slot->data[ slot->used ] ), &( node->data[ idx ] ), n * FR_ITEM_SIZE );
+                cursor_move( node, idx, n, slot, slot->used );
+                slot->used += n;
+                idx += n;
+            }
+
+        } else {
+
+            slot = arena_slot( arena, ord++ );
+            memcpy( slot->data, node->data, node->used * FR_ITEM_SIZE );
+            cursor_move( node, 0, node->used, slot, 0 );
+            slot->used = node->used;
+        }
+    }
+
+
+    /* Release old Nodes. */
+
+    old = NULL;
+    if ( pos->mem && pos->mem->alloc == arena_alloc )
+        old = pos->mem->env;
+
+    node = fn_first( pos->seg );
+    while ( node ) {
+        next = fn_next( node );
+        /* Cursors of empty Framer. */
+        cursor_rehome( node, arena_slot( arena, 0 ), 0 );
+        if ( old == NULL ) {
+            release_node( pos, node );
+        } else if ( !arena_has( old, node ) ) {
+            if ( old->parent.alloc ) {
+                fr_s tmp = *pos;
+                tmp.seg = node;
+                old->parent.free( &tmp, old->parent.env );
+            } else {
+                fn_delete( node );
+            }
+        }
+        node = next;
+    }
+
+
+    /* Take arena into use. */
+
+    if ( old ) {
+        arena->parent = old->parent;
+        arena_del( old );
+    } else if ( pos->mem ) {
+        arena->parent = *( pos->mem );
+    } else {
+        pos->mem = fr_malloc( sizeof( fr_mem_s ) );
+        arena->parent.alloc = NULL;
+        arena->parent.free = NULL;
+        arena->parent.close = NULL;
+        arena->parent.env = NULL;
+    }
+
+    pos->mem->alloc = arena_alloc;
+    pos->mem->free = arena_free;
+    pos->mem->close = arena_close;
+    pos->mem->env = arena;
+
+
+    /* Update Positions. */
+
+    for ( k = 0; k <= cnt; k++ ) {
+
+        p = ( k < cnt ) ? live[ k ] : pos;
+
+        if ( p->seg == NULL )
+            continue;
+
+        if ( pack ) {
+            ord = at[ 2 * k + 1 ] / size;
+            if ( ord >= ncnt )
+                ord = ncnt - 1;
+            p->seg = arena_slot( arena, ord );
+            p->idx = at[ 2 * k + 1 ] - ord * size;
+        } else {
+            p->seg = arena_slot( arena, at[ 2 * k ] );
+            p->idx = at[ 2 * k + 1 ];
+        }
+
+        p->ncnt = ncnt;
+        p->bcnt = ncnt * node_bytes( arena_slot( arena, 0 ) );
+        p->mem = pos->mem;
+    }
+
+    fr_free( at );
+}
+
+
+fr_t fr_clone( fr_t pos, int pack )
+{
+    return fr_clone_parallel( pos, pack, 1 );
+}
+
+
+fr_t fr_clone_parallel( fr_t pos, int pack, int threads )
+{
+    fr_t         dup;
+    fr_arena_t   arena;
+    clone_job_s* jobs;
+    pthread_t*   tids;
+    fn_p         src;
+    fr_size_t*   base;
+    fn_t         node;
+    fr_size_t    scnt = 0;
+    fr_size_t    ncnt;
+    fr_size_t    icnt = 0;
+    fr_size_t    size = pos->size;
+    fr_size_t    ord;
+    int          started;
+
+    for ( node = fn_first( pos->seg ); node; node = fn_next( node ) ) {
+        scnt++;
+        if ( node->size > size )
+            size = node->size;
+    }
+
+
+    /* Source Nodes in order, with item offsets. */
+
+    src = fr_malloc( scnt * sizeof( fn_t ) );
+    base = fr_malloc( scnt * sizeof( fr_size_t ) );
+
+    ord = 0;
+    for ( node = fn_first( pos->seg ); node; node = fn_next( node ) ) {
+        src[ ord ] = node;
+        base[ ord ] = icnt;
+        icnt += node->used;
+        ord++;
+    }
+
+    if ( pack ) {
+        ncnt = ( icnt + size - 1 ) / size;
+        if ( ncnt == 0 )
+            ncnt = 1;
+    } else {
+        ncnt = scnt;
+    }
+
+
+    /* All Nodes at once, from one arena. */
+
+    arena = arena_new( ncnt, size );
+    if ( arena == NULL ) {
+        fr_free( base );
+        fr_free( src );
+        return NULL;
+    }
+    arena_chain( arena, 0 );
+
+    if ( pack ) {
+        for ( ord = 0; ord < ncnt; ord++ )
+            arena_slot( arena, ord )->used = ( ord < ncnt - 1 ) ? size : icnt - ord * size;
+    }
+
+
+    /* Copy segments, in parallel chunks of source Nodes. */
+
+    if ( threads > scnt )
+        threads = scnt;
+    if ( threads < 1 )
+        threads = 1;
+
+    jobs = fr_malloc( threads * sizeof( clone_job_s ) );
+    tids = fr_malloc( threads * sizeof( pthread_t ) );
+
+    for ( int t = 0; t < threads; t++ ) {
+        jobs[ t ].arena = arena;
+        jobs[ t ].src = src;
+        jobs[ t ].base = base;
+        jobs[ t ].a = scnt * t / threads;
+        jobs[ t ].b = scnt * ( t + 1 ) / threads;
+        jobs[ t ].pack = pack;
+    }
+
+    /* Chunks without a thread are copied by the calling thread. */
+    for ( started = 1; started < threads; started++ ) {
+        if ( pthread_create( &( tids[ started ] ), NULL, clone_run, &( jobs[ started ] ) ) )
+            break;
+    }
+    for ( int t = started; t < threads; t++ )
+        clone_run( &( jobs[ t ] ) );
+    clone_run( &( jobs[ 0 ] ) );
+    for ( int t = 1; t < started; t++ )
+        pthread_join( tids[ t ], NULL );
+
+    fr_free( tids );
+    fr_free( jobs );
+    fr_free( base );
+    fr_free( src );
+
+
+    /* Clone has the arena as Memory API. */
+
+    dup = fr_pos_new( pos->size );
+    dup->max = pos->max;
+    dup->seg = arena_slot( arena, 0 );
+    dup->icnt = icnt;
+    dup->ncnt = ncnt;
+    dup->bcnt = ncnt * node_bytes( dup->seg );
+
+    dup->mem = fr_malloc( sizeof( fr_mem_s ) );
+    dup->mem->alloc = arena_alloc;
+    dup->mem->free = arena_free;
+    dup->mem->close = arena_close;
+    dup->mem->env = arena;
+    arena->parent.alloc = NULL;
+    arena->parent.free = NULL;
+    arena->parent.close = NULL;
+    arena->parent.env = NULL;
+
+    return dup;
+}
+
+
+fr_size_t fr_length( fr_t pos )
+{
+    return pos->icnt;
+}
+
+
+fr_size_t fr_tail_length( fr_t pos )
+{
+    fr_size_t cnt = 0;
+    fr_s      tmp = *pos;
+
+    /* Tail of current segment. */
+    cnt = tmp.seg->used - tmp.idx;
+
+    /* Rest with full "used" count. */
+    while ( fn_next( tmp.seg ) ) {
+        tmp.seg = fn_next( tmp.seg );
+        cnt += tmp.seg->used;
+    }
+
+    return cnt;
+}
+
+
+fr_size_t fr_node_count( fr_t pos )
+{
+    return pos->ncnt;
+}
+
+
+fr_size_t fr_memory_bytes( fr_t pos )
+{
+    return pos->bcnt;
+}
+
+
+void fr_stats( fr_t pos, fr_stats_t stats )
+{
+    fn_t      node;
+    fr_size_t bin;
+
+    memset( stats, 0, sizeof( fr_stats_s ) );
+
+    for ( node = fn_first( pos->seg ); node; node = fn_next( node ) ) {
+
+        stats->nodes++;
+        stats->items += node->used;
+        stats->slots += node->size;
+        stats->bytes += node_bytes( node );
+
+        if ( node->used * 2 < node->size )
+            stats->under++;
+
+        bin = node->used * FR_STATS_BINS / node->size;
+        stats->fill[ bin ]++;
+    }
+
+    stats->header = stats->nodes * FR_NODE_SIZE;
+    stats->under_ratio = (double)stats->under / stats->nodes;
+}
+
+
+fr_size_t fr_size( fr_t pos )
+{
+    return pos->size;
+}
+
+
+fr_size_t fr_capacity( fr_t pos )
+{
+    return pos->seg->size;
+}
+
+
+fr_size_t fr_index( fr_t pos )
+{
+    return pos->idx;
+}
+
+
+fr_size_t fr_used( fr_t pos )
+{
+    return pos->seg->used;
+}
+
+
+fr_s fr_find( fr_t pos, void* item )
+{
+    fr_s tmp = *pos;
+
+    while ( tmp.seg ) {
+        while ( tmp.idx < tmp.seg->used ) {
+            if ( node_item( tmp.seg, tmp.idx ) == item ) {
+                return tmp;
             }
             tmp.idx++;
         }
 
-        tmp.seg = tmp.seg->next;
+        tmp.seg = fn_next( tmp.seg );
         tmp.idx = 0;
     }
 
@@ -629,12 +1701,12 @@ fr_s fr_find_with( fr_t pos, void* item, fr_cmp_f comp )
     for ( ;; ) {
 
         while ( tmp.idx < tmp.seg->used ) {
-            if ( comp( tmp.seg->data[ tmp.idx ], item ) == 0 )
+            if ( comp( node_item( tmp.seg, tmp.idx ), item ) == 0 )
                 return tmp;
             tmp.idx++;
         }
 
-        tmp.seg = tmp.seg->next;
+        tmp.seg = fn_next( tmp.seg );
         if ( tmp.seg == NULL ) {
             return tmp;
         } else {
@@ -651,9 +1723,9 @@ fr_s fr_find_sorted_with( fr_t pos, void* item, fr_cmp_f comp )
 
     /* Proceed segment by segment. */
     while ( tmp.seg ) {
-        if ( comp( item, tmp.seg->data[ tmp.idx ] ) > 0 ) {
+        if ( comp( item, node_item( tmp.seg, tmp.idx ) ) > 0 ) {
             prev = tmp.seg;
-            tmp.seg = tmp.seg->next;
+            tmp.seg = fn_next( tmp.seg );
             tmp.idx = 0;
         } else
             break;
@@ -669,410 +1741,4827 @@ fr_s fr_find_sorted_with( fr_t pos, void* item, fr_cmp_f comp )
 }
 
 
+void fr_merge( fr_t dst, fr_t src, fr_cmp_f comp, int unique )
+{
+    merge_s   m;
+    fn_t      a;
+    fn_t      b;
+    fn_t      next;
+    fr_t      owner;
+    fr_size_t ai = 0;
+    fr_size_t bi = 0;
 
-/* ------------------------------------------------------------
- * Framer Position:
- * ------------------------------------------------------------ */
+    assert( fn_first( dst->seg ) != fn_first( src->seg ) );
 
-fr_t fr_pos_new( fr_size_t size )
+#if defined( FRAMER_USE_SNAPSHOTS ) || defined( FRAMER_USE_DIRTY ) || defined( FRAMER_USE_GAPS )
+    node_touch_all( dst, fn_first( dst->seg ), NULL );
+    node_touch_all( src, fn_first( src->seg ), NULL );
+#endif
+
+    memset( &m, 0, sizeof( m ) );
+    m.dst = dst;
+    m.src = src;
+    m.share = ( dst->mem == src->mem );
+
+    a = fn_first( dst->seg );
+    b = fn_first( src->seg );
+
+
+    /* Merge while both inputs have items. */
+
+    for ( ;; ) {
+
+        while ( a && ai == a->used ) {
+            next = fn_next( a );
+            merge_recycle( &m, a, dst );
+            a = next;
+            ai = 0;
+        }
+
+        while ( b && bi == b->used ) {
+            next = fn_next( b );
+            merge_recycle( &m, b, src );
+            b = next;
+            bi = 0;
+        }
+
+        if ( a == NULL || b == NULL )
+            break;
+
+        if ( comp( b->data[ bi ], a->data[ ai ] ) < 0 )
+            merge_emit( &m, b, bi++, comp, unique );
+        else
+            merge_emit( &m, a, ai++, comp, unique );
+    }
+
+
+    /* Tail of the other input. Half full Nodes are relinked, when
+     * output Node is full. */
+
+    if ( a ) {
+        owner = dst;
+    } else {
+        a = b;
+        ai = bi;
+        owner = src;
+    }
+
+    while ( a ) {
+        next = fn_next( a );
+        if ( ai == 0 && !unique && ( owner == dst || m.share ) && a->used * 2 >= a->size &&
+             ( m.out == NULL || m.out->used == m.out->size ) ) {
+            fr_size_t used = a->used;
+            merge_grow( &m, a );
+            a->used = used;
+            m.icnt += used;
+        } else {
+            while ( ai < a->used )
+                merge_emit( &m, a, ai++, comp, unique );
+            merge_recycle( &m, a, owner );
+        }
+        a = next;
+        ai = 0;
+    }
+
+    merge_even( &m );
+
+
+    /* Framers have at least one Node. */
+
+    if ( m.head == NULL )
+        merge_grow( &m, merge_node( &m, dst ) );
+
+    src->seg = m.share ? merge_node( &m, src ) : alloc_node( src );
+    src->idx = 0;
+    src->icnt = 0;
+    src->ncnt = 1;
+    src->bcnt = node_bytes( src->seg );
+
+    while ( m.pool ) {
+        next = fn_next( m.pool );
+        fn_set_next( m.pool, NULL );
+        cursor_rehome( m.pool, m.head, 0 );
+        release_node( dst, m.pool );
+        m.pool = next;
+    }
+
+    dst->seg = m.head;
+    dst->idx = 0;
+    dst->icnt = m.icnt;
+    dst->ncnt = m.ncnt;
+    dst->bcnt = 0;
+    for ( a = m.head; a; a = fn_next( a ) )
+        dst->bcnt += node_bytes( a );
+}
+
+
+fr_size_t fr_unique( fr_t pos, fr_cmp_f comp )
 {
-    fr_t pos;
+    unique_s ctx;
 
-    pos = fr_malloc( sizeof( fr_s ) );
-    return fr_pos_init( pos, size );
+    ctx.comp = comp;
+    ctx.last = NULL;
+    ctx.some = 0;
+
+    return filter_pass( pos, unique_keep, &ctx );
 }
 
 
-fr_t fr_pos_new_with_mem( fr_t pos, fr_size_t size, fr_mem_f alloc, fr_mem_f free, void* env )
+fr_size_t fr_unique_hashed( fr_t pos, fr_hash_f hash, fr_cmp_f eq )
 {
-    fr_mem_t mem;
+    unique_hashed_s ctx;
+    fr_size_t       cnt = 16;
+    fr_size_t       ret;
 
-    mem = fr_malloc( sizeof( fr_mem_s ) );
-    mem->alloc = alloc;
-    mem->free = free;
-    mem->env = env;
+    /* Load factor is at most 3/4. */
+    while ( cnt * 3 < pos->icnt * 4 )
+        cnt *= 2;
 
-    if ( pos ) {
-        fr_pos_init( pos, size );
-    } else {
-        pos = fr_pos_new( size );
-    }
-    pos->mem = mem;
+    ctx.hash = hash;
+    ctx.eq = eq;
+    ctx.slots = fr_malloc( cnt * sizeof( void* ) );
+    ctx.occ = fr_malloc( cnt / 8 );
+    ctx.mask = cnt - 1;
+    memset( ctx.occ, 0, cnt / 8 );
 
-    return pos;
+    ret = filter_pass( pos, unique_hashed_keep, &ctx );
+
+    fr_free( ctx.occ );
+    fr_free( ctx.slots );
+
+    return ret;
 }
 
 
-fr_t fr_pos_init( fr_t pos, fr_size_t size )
+fr_t fr_intersect( fr_t a, fr_t b, fr_cmp_f comp )
 {
-    pos->seg = NULL;
-    pos->idx = 0;
-    pos->size = size;
-    pos->icnt = 0;
-    pos->ncnt = 0;
-    pos->mem = NULL;
+    return set_new( a, b, comp, SET_INTERSECT );
+}
 
-    return pos;
+
+fr_t fr_union( fr_t a, fr_t b, fr_cmp_f comp )
+{
+    return set_new( a, b, comp, SET_UNION );
 }
 
 
-fr_t fr_pos_del( fr_t pos )
+fr_t fr_difference( fr_t a, fr_t b, fr_cmp_f comp )
 {
-    if ( pos->mem )
-        fr_free( pos->mem );
-    fr_free( pos );
-    return NULL;
+    return set_new( a, b, comp, SET_DIFFERENCE );
 }
 
 
-fr_t fr_pos_dup( fr_t pos )
+fr_size_t fr_intersect_emit( fr_t a, fr_t b, fr_cmp_f comp, fr_emit_f emit, void* ctx )
 {
-    fr_t dup;
+    return set_run( a, b, comp, SET_INTERSECT, emit, ctx );
+}
 
-    dup = fr_malloc( sizeof( fr_s ) );
-    *dup = *pos;
 
-    return dup;
+fr_size_t fr_union_emit( fr_t a, fr_t b, fr_cmp_f comp, fr_emit_f emit, void* ctx )
+{
+    return set_run( a, b, comp, SET_UNION, emit, ctx );
 }
 
 
-void fr_pos_cpy( fr_t pos_a, fr_t pos_b )
+fr_size_t fr_difference_emit( fr_t a, fr_t b, fr_cmp_f comp, fr_emit_f emit, void* ctx )
 {
-    *pos_b = *pos_a;
+    return set_run( a, b, comp, SET_DIFFERENCE, emit, ctx );
 }
 
 
-fr_size_t fr_next_n( fr_t pos, fr_size_t n )
+void fr_reverse( fr_t pos )
+{
+    fn_t      node;
+    fn_t      next;
+    fn_link_t link;
+
+#if defined( FRAMER_USE_SNAPSHOTS ) || defined( FRAMER_USE_DIRTY ) || defined( FRAMER_USE_GAPS )
+    node_touch_all( pos, fn_first( pos->seg ), NULL );
+#endif
+
+    for ( node = fn_first( pos->seg ); node; node = next ) {
+
+        next = fn_next( node );
+
+        /* Links are swapped as is, since relative links are also
+         * relative to the Node itself. */
+        link = node->prev;
+        node->prev = node->next;
+        node->next = link;
+
+        reverse_items( node->data, node->used );
+
+#ifdef FRAMER_USE_CURSORS
+        for ( fr_cursor_t cur = node->curs; cur; cur = cur->next ) {
+            if ( cur->pos.idx < node->used )
+                cur->pos.idx = node->used - 1 - cur->pos.idx;
+        }
+#endif
+    }
+
+    if ( pos->idx < pos->seg->used )
+        pos->idx = pos->seg->used - 1 - pos->idx;
+}
+
+
+void fr_rotate( fr_t pos )
 {
-    fr_size_t steps;
     fn_t      seg = pos->seg;
+    fn_t      first = fn_first( seg );
+    fn_t      last = fn_last( seg );
+    fn_t      tail;
     fr_size_t idx = pos->idx;
 
-    if ( n > pos->size && seg->next ) {
+    if ( idx >= seg->used )
+        idx = 0;
 
-        /* Fast forwards with segment stepping. */
+    if ( first == last ) {
 
-        steps = n - ( seg->used - idx );
-        seg = seg->next;
-        idx = 0;
+        /* Single Node: rotate segment with three reversals. */
 
-        while ( seg->next && steps >= seg->used ) {
-            steps -= seg->used;
-            seg = seg->next;
+        if ( idx > 0 ) {
+            node_touch( pos, seg );
+            reverse_items( seg->data, idx );
+            reverse_items( &( seg->data[ idx ] ), seg->used - idx );
+            reverse_items( seg->data, seg->used );
+#ifdef FRAMER_USE_CURSORS
+            for ( fr_cursor_t cur = seg->curs; cur; cur = cur->next ) {
+                if ( cur->pos.idx < seg->used )
+                    cur->pos.idx = ( cur->pos.idx + seg->used - idx ) % seg->used;
+            }
+#endif
         }
 
-        if ( steps <= seg->used - 1 ) {
-            pos->idx = steps;
-            pos->seg = seg;
-            return n;
+        pos->idx = 0;
+        return;
+    }
+
+    node_touch( pos, seg );
+    node_touch( pos, first );
+    node_touch( pos, last );
+
+
+    /* Relink chain ends, so that seg is the first Node. */
+
+    if ( seg != first ) {
+        tail = fn_prev( seg );
+        node_touch( pos, tail );
+        fn_set_next( last, first );
+        fn_set_prev( first, last );
+        fn_set_next( tail, NULL );
+        fn_set_prev( seg, NULL );
+    } else {
+        tail = last;
+    }
+
+
+    /* Items before Position go to the tail. */
+
+    if ( idx > 0 ) {
+
+        if ( tail->size - tail->used < idx ) {
+            fn_append( tail, alloc_node_min( pos, idx ) );
+            tail = fn_next( tail );
+            pos->ncnt++;
+        }
+
+        memcpy( &( tail->data[ tail->used ] ), seg->data, idx * FR_ITEM_SIZE );
+        cursor_move( seg, 0, idx, tail, tail->used );
+        tail->used += idx;
+
+        memmove( seg->data, &( seg->data[ idx ] ), ( seg->used - idx ) * FR_ITEM_SIZE );
+        cursor_move( seg, idx, seg->used - idx, seg, 0 );
+        seg->used -= idx;
+    }
+
+    pos->idx = 0;
+}
+
+
+
+/* ------------------------------------------------------------
+ * Framer serialization:
+ * ------------------------------------------------------------ */
+
+int fr_write( fr_t pos, int fd, fr_encode_f encode )
+{
+    fr_file_head_s head;
+    fn_t           node;
+    fr_size_t      icnt = 0;
+    fr_size_t      size = pos->size;
+
+    for ( node = fn_first( pos->seg ); node; node = fn_next( node ) ) {
+        icnt += node->used;
+        if ( node->size > size )
+            size = node->size;
+    }
+
+    memcpy( head.magic, "FRMR", 4 );
+    head.version = FR_FILE_VERSION;
+    head.order = 0x01020304;
+    head.flags = encode ? FR_FILE_ENCODED : 0;
+    head.item = FR_ITEM_SIZE;
+    head.icnt = icnt;
+    head.size = size;
+
+    if ( encode == NULL ) {
+
+        /* Header and segment data runs, with vectored writes. */
+
+        struct iovec iov[ FR_IOV_MAX ];
+        int          cnt = 0;
+
+        iov[ cnt ].iov_base = &head;
+        iov[ cnt ].iov_len = sizeof( head );
+        cnt++;
+
+        for ( node = fn_first( pos->seg ); node; node = fn_next( node ) ) {
+
+            if ( node->used == 0 )
+                continue;
+
+            if ( cnt >= FR_IOV_MAX - 1 ) {
+                if ( io_writev( fd, iov, cnt ) < 0 )
+                    return -1;
+                cnt = 0;
+            }
+
+#ifdef FRAMER_USE_GAPS
+            if ( node->gap ) {
+                /* Runs before and after the gap. */
+                iov[ cnt ].iov_base = node->data;
+                iov[ cnt ].iov_len = gap_head( node ) * FR_ITEM_SIZE;
+                cnt++;
+                iov[ cnt ].iov_base = &( node->data[ node->size - node->gap ] );
+                iov[ cnt ].iov_len = node->gap * FR_ITEM_SIZE;
+                cnt++;
+                continue;
+            }
+#endif
+
+            iov[ cnt ].iov_base = node->data;
+            iov[ cnt ].iov_len = node->used * FR_ITEM_SIZE;
+            cnt++;
+        }
+
+        return io_writev( fd, iov, cnt );
+
+    } else {
+
+        /* Records of encoded items, through staging buffer. */
+
+        char*     buf;
+        fr_size_t cap = FR_IO_BUF;
+        fr_size_t len = sizeof( head );
+        fr_size_t room;
+        fr_size_t n;
+        uint32_t  rec;
+
+        buf = fr_malloc( cap );
+        memcpy( buf, &head, sizeof( head ) );
+
+        for ( node = fn_first( pos->seg ); node; node = fn_next( node ) ) {
+            for ( fr_size_t i = 0; i < node->used; i++ ) {
+
+                for ( ;; ) {
+                    room = cap - len - (fr_size_t)sizeof( rec );
+                    n = 0;
+                    if ( room >= 0 ) {
+                        n = encode( node_item( node, i ), buf + len + sizeof( rec ), room );
+                        if ( n <= room )
+                            break;
+                    }
+                    /* Flush, or grow if record is larger than buffer. */
+                    if ( len > 0 ) {
+                        if ( io_write( fd, buf, len ) < 0 ) {
+                            fr_free( buf );
+                            return -1;
+                        }
+                        len = 0;
+                    } else {
+                        cap = n + sizeof( rec );
+                        buf = fr_realloc( buf, cap );
+                    }
+                }
+
+                rec = n;
+                memcpy( buf + len, &rec, sizeof( rec ) );
+                len += sizeof( rec ) + n;
+            }
+        }
+
+        n = io_write( fd, buf, len );
+        fr_free( buf );
+
+        return n < 0 ? -1 : 0;
+    }
+}
+
+
+fr_t fr_read( int fd, fr_decode_f decode )
+{
+    fr_file_head_s head;
+    fr_t           pos;
+    fn_t           node;
+    fr_size_t      left;
+    fr_size_t      n;
+
+    if ( io_read( fd, &head, sizeof( head ) ) < 0 )
+        return NULL;
+
+    if ( memcmp( head.magic, "FRMR", 4 ) != 0 || head.version != FR_FILE_VERSION ||
+         head.order != 0x01020304 || head.item != FR_ITEM_SIZE || head.size < FR_SEG_MIN ||
+         head.size > INT32_MAX || head.icnt > INT64_MAX ||
+         ( ( head.flags & FR_FILE_ENCODED ) != 0 ) != ( decode != NULL ) )
+        return NULL;
+
+    pos = fr_create_sized( head.size );
+    if ( pos == NULL )
+        return NULL;
+    node = pos->seg;
+    left = head.icnt;
+
+    if ( decode == NULL ) {
+
+        /* Read segment data directly to packed Nodes. */
+
+        while ( left > 0 ) {
+
+            if ( node->used == node->size ) {
+                if ( ( node = read_node( pos, node ) ) == NULL )
+                    return NULL;
+            }
+
+            n = node->size - node->used;
+            if ( n > left )
+                n = left;
+
+            if ( io_read( fd, &( node->data[ node->used ] ), n * FR_ITEM_SIZE ) < 0 ) {
+                fr_destroy( pos );
+                return NULL;
+            }
+
+            node->used += n;
+            left -= n;
+        }
+
+        /* Item count must match the file. */
+        if ( !io_end( fd ) ) {
+            fr_destroy( pos );
+            return NULL;
+        }
+
+    } else {
+
+        /* Decode records to packed Nodes, through read buffer. */
+
+        char*     buf;
+        fr_size_t cap = FR_IO_BUF;
+        fr_size_t len = 0;
+        fr_size_t off = 0;
+        uint32_t  rec;
+        int       fail = 0;
+
+        buf = fr_malloc( cap );
+        if ( buf == NULL ) {
+            fr_destroy( pos );
+            return NULL;
+        }
+
+        while ( left > 0 && !fail ) {
+
+            /* Record length, and then record. */
+            if ( len - off < (fr_size_t)sizeof( rec ) ) {
+                fail = io_fill( fd, &buf, &cap, &len, &off, sizeof( rec ) );
+                if ( fail )
+                    break;
+            }
+            memcpy( &rec, buf + off, sizeof( rec ) );
+
+            if ( len - off < (fr_size_t)sizeof( rec ) + rec ) {
+                fail = io_fill( fd, &buf, &cap, &len, &off, sizeof( rec ) + rec );
+                if ( fail )
+                    break;
+            }
+
+            if ( node->used == node->size ) {
+                if ( ( node = read_node( pos, node ) ) == NULL ) {
+                    fr_free( buf );
+                    return NULL;
+                }
+            }
+
+            node->data[ node->used++ ] = decode( buf + off + sizeof( rec ), rec );
+            off += sizeof( rec ) + rec;
+            left--;
+        }
+
+        /* Record count must match the file. */
+        if ( !fail && ( off < len || !io_end( fd ) ) )
+            fail = 1;
+
+        fr_free( buf );
+
+        if ( fail ) {
+            fr_destroy( pos );
+            return NULL;
+        }
+    }
+
+    pos->icnt = head.icnt;
+
+    return pos;
+}
+
+
+fr_size_t fr_load_stream( fr_t pos, fr_source_f source, void* ctx, fr_size_t fill )
+{
+    fr_size_t icnt = pos->icnt;
+    fn_t      last;
+    fn_t      node;
+    int       end = 0;
+
+    last = fn_last( pos->seg );
+
+    while ( !end ) {
+        node = alloc_node( pos );
+        load_fill( node, fill, source, ctx, &end );
+        load_link( pos, &last, node );
+    }
+
+    return pos->icnt - icnt;
+}
+
+
+fr_size_t fr_load_stream_parallel( fr_t pos, fr_source_f source, void* ctx, fr_size_t fill )
+{
+    fr_size_t  icnt = pos->icnt;
+    load_job_s job;
+    pthread_t  tid;
+    fn_t       last;
+    fn_t       node;
+    int        b = 0;
+    int        end;
+
+    last = fn_last( pos->seg );
+
+    job.source = source;
+    job.ctx = ctx;
+    job.fill = fill;
+    pthread_mutex_init( &( job.lock ), NULL );
+    pthread_cond_init( &( job.cond ), NULL );
+
+    /* Memory API is called from the calling thread only, and the
+     * helper thread only fills the Nodes. */
+    for ( int i = 0; i < 2; i++ ) {
+        job.buf[ i ] = alloc_node( pos );
+        job.state[ i ] = 1;
+    }
+
+    /* Load with calling thread only, if loader can't be started. */
+    if ( pthread_create( &tid, NULL, load_run, &job ) ) {
+        for ( int i = 0; i < 2; i++ )
+            release_node( pos, job.buf[ i ] );
+        pthread_cond_destroy( &( job.cond ) );
+        pthread_mutex_destroy( &( job.lock ) );
+        return fr_load_stream( pos, source, ctx, fill );
+    }
+
+    for ( ;; ) {
+
+        /* Take filled buffer, and give next Node for filling. */
+
+        pthread_mutex_lock( &( job.lock ) );
+        while ( job.state[ b ] < 2 )
+            pthread_cond_wait( &( job.cond ), &( job.lock ) );
+        node = job.buf[ b ];
+        end = ( job.state[ b ] == 3 );
+        job.state[ b ] = 0;
+        pthread_mutex_unlock( &( job.lock ) );
+
+        if ( !end ) {
+
+            /* Reserve outside lock, since it may be slow. */
+            job.buf[ b ] = alloc_node( pos );
+
+            pthread_mutex_lock( &( job.lock ) );
+            job.state[ b ] = 1;
+            pthread_cond_broadcast( &( job.cond ) );
+            pthread_mutex_unlock( &( job.lock ) );
+        }
+
+        load_link( pos, &last, node );
+
+        if ( end )
+            break;
+
+        b = 1 - b;
+    }
+
+    pthread_join( tid, NULL );
+
+    /* Buffer given after the end was not filled. */
+    for ( int i = 0; i < 2; i++ ) {
+        if ( job.state[ i ] == 1 ) {
+            job.buf[ i ]->used = 0;
+            release_node( pos, job.buf[ i ] );
+        }
+    }
+
+    pthread_cond_destroy( &( job.cond ) );
+    pthread_mutex_destroy( &( job.lock ) );
+
+    return pos->icnt - icnt;
+}
+
+
+fr_size_t fr_source_fd( void* ctx, void** items, fr_size_t cnt )
+{
+    int     fd = *(int*)ctx;
+    ssize_t ret;
+    size_t  part;
+
+    do {
+        ret = read( fd, items, cnt * FR_ITEM_SIZE );
+    } while ( ret < 0 && errno == EINTR );
+
+    if ( ret <= 0 )
+        return 0;
+
+    /* Complete partial item. */
+    part = ret % FR_ITEM_SIZE;
+    if ( part > 0 ) {
+        if ( io_read( fd, (char*)items + ret, FR_ITEM_SIZE - part ) < 0 )
+            return ret / FR_ITEM_SIZE;
+        ret += FR_ITEM_SIZE - part;
+    }
+
+    return ret / FR_ITEM_SIZE;
+}
+
+
+
+#ifdef FRAMER_COMPACT_LINKS
+
+/* ------------------------------------------------------------
+ * Mapped Framer:
+ * ------------------------------------------------------------ */
+
+fr_map_t fr_map_create( const char* path, fr_size_t size, fr_size_t max )
+{
+    fr_map_head_s head;
+    int           fd;
+
+    if ( size < FR_SEG_MIN || size > INT32_MAX || max < 1 )
+        return NULL;
+
+    fd = open( path, O_RDWR | O_CREAT | O_TRUNC, 0644 );
+    if ( fd < 0 )
+        return NULL;
+
+    map_head( &head, size, max );
+
+    return map_new( fd, &head, 0 );
+}
+
+
+fr_map_t fr_map_open( const char* path )
+{
+    int fd;
+
+    fd = open( path, O_RDWR );
+    if ( fd < 0 )
+        return NULL;
+
+    return map_attach( fd, 0 );
+}
+
+
+fr_t fr_map_pos( fr_map_t map )
+{
+    return map->pos;
+}
+
+
+int fr_map_reserve( fr_map_t map, fr_size_t cnt )
+{
+    fr_map_head_s* head = map->head;
+    fr_size_t      need;
+
+    if ( cnt < 0 || map->pos->ncnt + cnt > (fr_size_t)head->max )
+        return -1;
+
+    /* Released slots cover the rest, when top is near maximum. */
+    need = head->top + cnt;
+    if ( need > (fr_size_t)head->max )
+        need = head->max;
+
+    if ( need > (fr_size_t)head->cnt )
+        return map_grow( map, need );
+
+    return 0;
+}
+
+
+int fr_map_sync( fr_map_t map )
+{
+    map_store( map );
+    return msync( map->base, FR_MAP_HEAD + map->head->cnt * map->head->slot, MS_SYNC );
+}
+
+
+fr_map_t fr_map_close( fr_map_t map )
+{
+#ifdef FRAMER_USE_SNAPSHOTS
+    /* Snapshots keep their copies after unmap. */
+    if ( map->pos->snap ) {
+        fr_size_t gen = map->pos->snap->gen;
+        snap_detach( map->pos );
+        if ( !map->shm )
+            map->head->gen = gen;
+    }
+#endif
+
+    /* Shared memory header is stored by write sections. */
+    if ( !map->shm )
+        fr_map_sync( map );
+
+    munmap( map->base, map->bytes );
+    close( map->fd );
+    fr_pos_del( map->pos );
+    fr_free( map );
+
+    return NULL;
+}
+
+
+
+/* ------------------------------------------------------------
+ * Shared memory Framer:
+ * ------------------------------------------------------------ */
+
+fr_map_t fr_shm_create( const char* name, fr_size_t size, fr_size_t max )
+{
+    fr_map_head_s head;
+    int           fd;
+
+    if ( size < FR_SEG_MIN || size > INT32_MAX || max < 1 )
+        return NULL;
+
+    fd = shm_open( name, O_RDWR | O_CREAT | O_TRUNC, 0600 );
+    if ( fd < 0 )
+        return NULL;
+
+    map_head( &head, size, max );
+
+    return map_new( fd, &head, 1 );
+}
+
+
+fr_map_t fr_shm_attach( const char* name )
+{
+    int fd;
+
+    fd = shm_open( name, O_RDWR, 0600 );
+    if ( fd < 0 )
+        return NULL;
+
+    return map_attach( fd, 1 );
+}
+
+
+int fr_shm_unlink( const char* name )
+{
+    return shm_unlink( name );
+}
+
+
+fr_s fr_shm_read_begin( fr_map_t map )
+{
+    fr_s pos;
+
+    pthread_rwlock_rdlock( &( map->head->lock ) );
+
+    fr_pos_init( &pos, map->head->size );
+    pos.seg = map_slot( map, map->head->first );
+    pos.icnt = map->head->icnt;
+    pos.ncnt = map->head->ncnt;
+    pos.bcnt = map->head->ncnt * node_bytes( pos.seg );
+
+    return pos;
+}
+
+
+void fr_shm_read_end( fr_map_t map )
+{
+    pthread_rwlock_unlock( &( map->head->lock ) );
+}
+
+
+fr_t fr_shm_write_begin( fr_map_t map )
+{
+    pthread_rwlock_wrlock( &( map->head->lock ) );
+
+    /* Previous write section may be from another process. */
+    map_load( map );
+
+    return map->pos;
+}
+
+
+void fr_shm_write_end( fr_map_t map )
+{
+    map_store( map );
+    __atomic_store_n( &( map->head->gen ), map->head->gen + 1, __ATOMIC_RELEASE );
+    pthread_rwlock_unlock( &( map->head->lock ) );
+}
+
+
+fr_size_t fr_shm_gen( fr_map_t map )
+{
+    return __atomic_load_n( &( map->head->gen ), __ATOMIC_ACQUIRE );
+}
+
+#endif
+
+
+
+/* ------------------------------------------------------------
+ * Small Framer:
+ * ------------------------------------------------------------ */
+
+void fr_small_init( fr_small_t sm )
+{
+    memset( sm, 0, sizeof( fr_small_s ) );
+}
+
+
+void fr_small_clear( fr_small_t sm )
+{
+    if ( sm->pos )
+        fr_destroy( sm->pos );
+    fr_small_init( sm );
+}
+
+
+fr_size_t fr_small_length( fr_small_t sm )
+{
+    if ( sm->pos )
+        return sm->pos->icnt;
+    else
+        return sm->used;
+}
+
+
+void* fr_small_item( fr_small_t sm, fr_size_t idx )
+{
+    if ( idx < 0 || idx >= fr_small_length( sm ) )
+        return NULL;
+
+    if ( sm->pos ) {
+        small_seek( sm->pos, idx );
+        return fr_item( sm->pos );
+    } else {
+        return sm->data[ idx ];
+    }
+}
+
+
+void fr_small_insert( fr_small_t sm, fr_size_t idx, void* item )
+{
+    assert( idx >= 0 && idx <= fr_small_length( sm ) );
+
+    if ( !sm->pos && sm->used >= (fr_size_t)FR_SMALL_SIZE )
+        small_grow( sm );
+
+    if ( sm->pos ) {
+
+        small_seek( sm->pos, idx );
+        fr_insert( sm->pos, item );
+
+    } else {
+
+        memmove( &( sm->data[ idx + 1 ] ),
+                 &( sm->data[ idx ] ),
+                 ( sm->used - idx ) * FR_ITEM_SIZE );
+        sm->data[ idx ] = item;
+        sm->used++;
+    }
+}
+
+
+void fr_small_push( fr_small_t sm, void* item )
+{
+    fr_small_insert( sm, fr_small_length( sm ), item );
+}
+
+
+void* fr_small_delete( fr_small_t sm, fr_size_t idx )
+{
+    void* ret;
+
+    if ( idx < 0 || idx >= fr_small_length( sm ) )
+        return NULL;
+
+    if ( sm->pos ) {
+
+        small_seek( sm->pos, idx );
+        ret = fr_delete( sm->pos );
+
+        if ( sm->pos->icnt <= (fr_size_t)FR_SMALL_SIZE / 2 )
+            small_shrink( sm );
+
+    } else {
+
+        ret = sm->data[ idx ];
+        sm->used--;
+        memmove( &( sm->data[ idx ] ),
+                 &( sm->data[ idx + 1 ] ),
+                 ( sm->used - idx ) * FR_ITEM_SIZE );
+    }
+
+    return ret;
+}
+
+
+fr_t fr_small_pos( fr_small_t sm )
+{
+    if ( !sm->pos )
+        small_grow( sm );
+
+    return sm->pos;
+}
+
+
+
+#ifdef FRAMER_USE_CURSORS
+
+/* ------------------------------------------------------------
+ * Framer cursor:
+ * ------------------------------------------------------------ */
+
+fr_cursor_t fr_cursor_new( fr_t pos )
+{
+    fr_cursor_t cur;
+
+    cur = fr_malloc_aligned( node_align(), align_up( sizeof( fr_cursor_s ), node_align() ) );
+    cur->pos = *pos;
+    cursor_link( cur );
+
+    return cur;
+}
+
+
+fr_cursor_t fr_cursor_del( fr_cursor_t cur )
+{
+    cursor_unlink( cur );
+    fr_free( cur );
+    return NULL;
+}
+
+
+void fr_cursor_set( fr_cursor_t cur, fr_t pos )
+{
+    cursor_unlink( cur );
+    cur->pos = *pos;
+    cursor_link( cur );
+}
+
+
+fr_s fr_cursor_pos( fr_cursor_t cur )
+{
+    return cur->pos;
+}
+
+
+void* fr_cursor_item( fr_cursor_t cur )
+{
+    return fr_item( &( cur->pos ) );
+}
+
+
+fr_size_t fr_cursor_next( fr_cursor_t cur )
+{
+    fr_s tmp = cur->pos;
+
+    if ( !fr_next( &tmp ) )
+        return 0;
+
+    fr_cursor_set( cur, &tmp );
+    return 1;
+}
+
+
+fr_size_t fr_cursor_prev( fr_cursor_t cur )
+{
+    fr_s tmp = cur->pos;
+
+    if ( !fr_prev( &tmp ) )
+        return 0;
+
+    fr_cursor_set( cur, &tmp );
+    return 1;
+}
+
+#endif
+
+
+
+#ifdef FRAMER_USE_NODE_LOCKS
+
+/* ------------------------------------------------------------
+ * Node locked access:
+ * ------------------------------------------------------------ */
+
+void fr_insert_locked( fr_t pos, void* item )
+{
+    fn_t prev;
+    fn_t node;
+    fn_t next;
+
+    lock_peers( pos );
+    node = pos->seg;
+    prev = fn_prev( node );
+    next = fn_next( node );
+
+    /* New Nodes are created unlocked. */
+    fr_insert( pos, item );
+
+    unlock_peers( prev, node, next );
+}
+
+
+void* fr_delete_locked( fr_t pos )
+{
+    fn_t  prev;
+    fn_t  node;
+    fn_t  next;
+    void* ret;
+
+    lock_peers( pos );
+    node = pos->seg;
+    prev = fn_prev( node );
+    next = fn_next( node );
+
+    if ( pos->idx >= node->used && node->used > 0 )
+        pos->idx = node->used - 1;
+
+    /* Node is retired when last item is deleted, since other threads
+     * may wait for its lock. */
+    if ( node->used == 1 && ( prev || next ) ) {
+        ret = node_item( node, 0 );
+        pos->icnt--;
+        node_touch( pos, prev );
+        node_touch( pos, node );
+        node_touch( pos, next );
+        leave_node( pos, node );
+        pos->seg = retire_node( pos, node );
+        unlock_peers( prev, NULL, next );
+    } else {
+        ret = fr_delete( pos );
+        unlock_peers( prev, node, next );
+    }
+
+    return ret;
+}
+
+
+void* fr_item_locked( fr_t pos )
+{
+    void* ret;
+
+    lock_home( pos );
+    if ( pos->idx >= pos->seg->used && pos->seg->used > 0 )
+        pos->idx = pos->seg->used - 1;
+    ret = fr_item( pos );
+    node_unlock( pos->seg );
+
+    return ret;
+}
+
+
+void fr_locked_reclaim( fr_t pos )
+{
+    fn_t node;
+
+    while ( pos->dead ) {
+        node = pos->dead;
+        pos->dead = node->data[ 0 ];
+
+        /* Links are stale, and not updated by release. */
+        fn_set_prev( node, NULL );
+        fn_set_next( node, NULL );
+        node->lock = 0;
+
+        if ( pos->mem ) {
+            fr_s tmp = *pos;
+            tmp.seg = node;
+            memapi_free( &tmp );
+        } else {
+            node_free( node, node_alloc_bytes( node->size ) );
+        }
+    }
+}
+
+#endif
+
+
+
+/* ------------------------------------------------------------
+ * Framer queue:
+ * ------------------------------------------------------------ */
+
+fr_queue_t fr_queue_new( fr_size_t size )
+{
+    fr_queue_t queue;
+
+    queue = fr_malloc_aligned( node_align(), align_up( sizeof( fr_queue_s ), node_align() ) );
+    queue->size = size;
+    queue->head = fn_new_sized( size );
+    queue->idx = 0;
+    queue->tail = queue->head;
+    queue->first = queue->head;
+    queue->seen = queue->head;
+
+    return queue;
+}
+
+
+fr_queue_t fr_queue_del( fr_queue_t queue )
+{
+    fn_t node;
+    fn_t next;
+
+    for ( node = queue->first; node; node = next ) {
+        next = fn_next( node );
+        node_free( node, node_alloc_bytes( node->size ) );
+    }
+
+    fr_free( queue );
+    return NULL;
+}
+
+
+void fr_queue_put( fr_queue_t queue, void* item )
+{
+    fr_queue_put_n( queue, &item, 1 );
+}
+
+
+void fr_queue_put_n( fr_queue_t queue, void** items, fr_size_t cnt )
+{
+    fn_t      tail = queue->tail;
+    fn_t      node;
+    fr_size_t n;
+
+    while ( cnt > 0 ) {
+
+        if ( tail->used >= tail->size ) {
+
+            /* Link new tail, consumer sees it after its items. */
+
+            node = queue_node( queue );
+            n = cnt < node->size ? cnt : node->size;
+            memcpy( node->data, items, n * FR_ITEM_SIZE );
+            node->used = n;
+            fn_set_next_release( tail, node );
+            tail = node;
+
+        } else {
+
+            n = free_seg( tail );
+            if ( n > cnt )
+                n = cnt;
+            memcpy( &( tail->data[ tail->used ] ), items, n * FR_ITEM_SIZE );
+            __atomic_store_n( &( tail->used ), tail->used + n, __ATOMIC_RELEASE );
+        }
+
+        items += n;
+        cnt -= n;
+    }
+
+    queue->tail = tail;
+}
+
+
+void* fr_queue_get( fr_queue_t queue )
+{
+    void* item;
+
+    if ( fr_queue_get_n( queue, &item, 1 ) )
+        return item;
+    else
+        return NULL;
+}
+
+
+fr_size_t fr_queue_get_n( fr_queue_t queue, void** items, fr_size_t cnt )
+{
+    fn_t      head = queue->head;
+    fn_t      next;
+    fr_size_t used;
+    fr_size_t n;
+    fr_size_t got = 0;
+
+    while ( got < cnt ) {
+
+        used = __atomic_load_n( &( head->used ), __ATOMIC_ACQUIRE );
+
+        if ( queue->idx < used ) {
+
+            n = used - queue->idx;
+            if ( n > cnt - got )
+                n = cnt - got;
+            memcpy( &( items[ got ] ), &( head->data[ queue->idx ] ), n * FR_ITEM_SIZE );
+            queue->idx += n;
+            got += n;
+
+        } else if ( queue->idx >= head->size && ( next = fn_next_acquire( head ) ) ) {
+
+            /* Head is consumed, release it to producer. */
+            __atomic_store_n( &( queue->head ), next, __ATOMIC_RELEASE );
+            queue->idx = 0;
+            head = next;
+
+        } else {
+
+            break;
+        }
+    }
+
+    return got;
+}
+
+
+
+/* ------------------------------------------------------------
+ * Framer log:
+ * ------------------------------------------------------------ */
+
+fr_log_t fr_log_new( fr_size_t size )
+{
+    fr_log_t log;
+
+    log = fr_malloc( sizeof( fr_log_s ) );
+    log->size = size;
+    log->first = log_node( log );
+    log->tail = log->first;
+
+    return log;
+}
+
+
+void fr_log_push( fr_log_t log, void* item )
+{
+    fn_t      tail;
+    fn_t      next;
+    fn_t      node;
+    fr_size_t idx;
+
+    for ( ;; ) {
+
+        tail = __atomic_load_n( &( log->tail ), __ATOMIC_ACQUIRE );
+        idx = __atomic_fetch_add( &( tail->used ), 1, __ATOMIC_RELAXED );
+
+        if ( idx < tail->size ) {
+            __atomic_store_n( &( tail->data[ idx ] ), item, __ATOMIC_RELEASE );
+            return;
+        }
+
+        /* Tail is full. Try to link new tail with the item. */
+
+        next = fn_next_acquire( tail );
+
+        if ( next == NULL ) {
+
+            node = log_node( log );
+            node->data[ 0 ] = item;
+            node->used = 1;
+            fn_set_prev( node, tail );
+
+            if ( node_cas_next( tail, node ) ) {
+                __atomic_compare_exchange_n(
+                    &( log->tail ), &tail, node, 0, __ATOMIC_RELEASE, __ATOMIC_RELAXED );
+                return;
+            }
+
+            node_free( node, node_alloc_bytes( node->size ) );
+            next = fn_next_acquire( tail );
+        }
+
+        /* Help to advance tail, and retry. */
+        __atomic_compare_exchange_n(
+            &( log->tail ), &tail, next, 0, __ATOMIC_RELEASE, __ATOMIC_RELAXED );
+    }
+}
+
+
+fr_s fr_log_first( fr_log_t log )
+{
+    fr_s pos;
+
+    fr_pos_init( &pos, log->size );
+    pos.seg = log->first;
+
+    return pos;
+}
+
+
+void* fr_log_read( fr_t pos )
+{
+    fn_t  next;
+    void* item;
+
+    for ( ;; ) {
+
+        if ( pos->idx < pos->seg->size ) {
+            item = __atomic_load_n( &( pos->seg->data[ pos->idx ] ), __ATOMIC_ACQUIRE );
+            if ( item )
+                pos->idx++;
+            return item;
+        }
+
+        next = fn_next_acquire( pos->seg );
+        if ( next == NULL )
+            return NULL;
+
+        pos->seg = next;
+        pos->idx = 0;
+    }
+}
+
+
+fr_t fr_log_close( fr_log_t log )
+{
+    fr_t pos;
+    fn_t node;
+
+    pos = fr_pos_new( log->size );
+    pos->seg = log->first;
+
+    /* Used count is overrun by producers that found Node full. */
+    for ( node = log->first; node; node = fn_next( node ) ) {
+        if ( node->used > node->size )
+            node->used = node->size;
+        pos->icnt += node->used;
+        pos->ncnt++;
+        pos->bcnt += node_bytes( node );
+    }
+
+    fr_free( log );
+
+    return pos;
+}
+
+
+
+/* ------------------------------------------------------------
+ * Epoch reclamation:
+ * ------------------------------------------------------------ */
+
+fr_epoch_t fr_epoch_use( fr_t pos )
+{
+    fr_epoch_t epoch;
+
+#ifdef FRAMER_USE_GAPS
+    /* Readers scan segments without gaps. */
+    fr_flatten( pos );
+#endif
+
+    epoch = fr_malloc( sizeof( fr_epoch_s ) );
+    memset( epoch, 0, sizeof( fr_epoch_s ) );
+    epoch->first = fn_first( pos->seg );
+
+    if ( pos->mem ) {
+        epoch->parent = *( pos->mem );
+    } else {
+        pos->mem = fr_malloc( sizeof( fr_mem_s ) );
+        epoch->parent.alloc = NULL;
+        epoch->parent.free = NULL;
+        epoch->parent.close = NULL;
+        epoch->parent.env = NULL;
+    }
+
+    pos->mem->alloc = epoch_alloc;
+    pos->mem->free = epoch_free;
+    pos->mem->close = epoch_close;
+    pos->mem->env = epoch;
+
+    return epoch;
+}
+
+
+fr_epoch_rec_t fr_epoch_reader( fr_epoch_t epoch )
+{
+    fr_epoch_rec_t rec;
+
+    rec = fr_malloc_aligned( node_align(), align_up( sizeof( fr_epoch_rec_s ), node_align() ) );
+    rec->state = 0;
+    rec->owner = epoch;
+    rec->next = __atomic_load_n( &( epoch->recs ), __ATOMIC_RELAXED );
+
+    while ( !__atomic_compare_exchange_n(
+        &( epoch->recs ), &( rec->next ), rec, 0, __ATOMIC_RELEASE, __ATOMIC_RELAXED ) )
+        ;
+
+    return rec;
+}
+
+
+fr_s fr_epoch_enter( fr_epoch_rec_t rec )
+{
+    fr_s      pos;
+    fr_size_t epoch;
+
+    /* Announce epoch before any Node is read. */
+    epoch = __atomic_load_n( &( rec->owner->epoch ), __ATOMIC_SEQ_CST );
+    __atomic_store_n( &( rec->state ), ( epoch << 1 ) | 1, __ATOMIC_SEQ_CST );
+    __atomic_thread_fence( __ATOMIC_SEQ_CST );
+
+    fr_pos_init( &pos, 0 );
+    pos.seg = __atomic_load_n( &( rec->owner->first ), __ATOMIC_ACQUIRE );
+
+    return pos;
+}
+
+
+fr_size_t fr_epoch_next( fr_t pos )
+{
+    fn_t next;
+
+    if ( pos->seg == NULL )
+        return 0;
+
+    if ( pos->idx < __atomic_load_n( &( pos->seg->used ), __ATOMIC_ACQUIRE ) - 1 ) {
+        pos->idx++;
+        return 1;
+    }
+
+    next = fn_next_acquire( pos->seg );
+    if ( next == NULL )
+        return 0;
+
+    /* Step to next segment. */
+    pos->seg = next;
+    pos->idx = 0;
+    return 1;
+}
+
+
+void* fr_epoch_item( fr_t pos )
+{
+    if ( pos->seg == NULL
+         || pos->idx >= __atomic_load_n( &( pos->seg->used ), __ATOMIC_ACQUIRE ) )
+        return NULL;
+
+    return __atomic_load_n( &( pos->seg->data[ pos->idx ] ), __ATOMIC_RELAXED );
+}
+
+
+void fr_epoch_exit( fr_epoch_rec_t rec )
+{
+    __atomic_store_n( &( rec->state ), 0, __ATOMIC_RELEASE );
+}
+
+
+fr_size_t fr_epoch_reclaim( fr_epoch_t epoch )
+{
+    fr_size_t cnt;
+    fr_s      tmp;
+
+    fr_pos_init( &tmp, 0 );
+
+    epoch_lock( epoch );
+    epoch_advance( epoch, &tmp );
+    cnt = epoch->rcnt[ 0 ] + epoch->rcnt[ 1 ] + epoch->rcnt[ 2 ];
+    epoch_unlock( epoch );
+
+    return cnt;
+}
+
+
+
+#ifdef FRAMER_USE_SNAPSHOTS
+
+/* ------------------------------------------------------------
+ * Framer snapshot:
+ * ------------------------------------------------------------ */
+
+fr_snap_t fr_snapshot( fr_t pos )
+{
+    fr_snap_t snap;
+
+    if ( pos->snap == NULL ) {
+        pos->snap = fr_malloc( sizeof( fr_snap_dom_s ) );
+        memset( pos->snap, 0, sizeof( fr_snap_dom_s ) );
+        pos->snap->live = 1;
+    }
+
+    snap = fr_malloc( sizeof( fr_snap_s ) );
+    memset( snap, 0, sizeof( fr_snap_s ) );
+    snap->dom = pos->snap;
+    snap->anchor = pos->seg;
+    snap->icnt = pos->icnt;
+
+    snap_lock( pos->snap );
+    pos->snap->gen++;
+    snap->gen = pos->snap->gen;
+    snap->next = pos->snap->snaps;
+    pos->snap->snaps = snap;
+    snap_unlock( pos->snap );
+
+    return snap;
+}
+
+
+fr_snap_t fr_snap_del( fr_snap_t snap )
+{
+    fr_snap_dom_t dom = snap->dom;
+    fr_snap_t*    ref;
+    fr_size_t*    cnt;
+    int           orphan;
+
+    snap_lock( dom );
+
+    for ( ref = &( dom->snaps ); *ref != snap; ref = &( ( *ref )->next ) )
+        ;
+    *ref = snap->next;
+
+    for ( fr_size_t i = 0; i < snap->cap; i++ ) {
+        if ( snap->keys[ i ] ) {
+            cnt = snap_ref( snap->vals[ i ] );
+            if ( --( *cnt ) == 0 )
+                fr_free( cnt );
+        }
+    }
+
+    orphan = !dom->live && dom->snaps == NULL;
+
+    snap_unlock( dom );
+
+    if ( orphan )
+        fr_free( dom );
+
+    fr_free( snap->keys );
+    fr_free( snap->vals );
+    fr_free( snap );
+
+    return NULL;
+}
+
+
+fr_size_t fr_snap_length( fr_snap_t snap )
+{
+    return snap->icnt;
+}
+
+
+fr_size_t fr_snap_copies( fr_snap_t snap )
+{
+    fr_size_t cnt;
+
+    snap_lock( snap->dom );
+    cnt = snap->cnt;
+    snap_unlock( snap->dom );
+
+    return cnt;
+}
+
+
+void fr_snap_iter( fr_snap_t snap, fr_snap_iter_t it )
+{
+    fn_t node;
+    fn_t copy;
+    fn_t prev;
+
+    it->snap = snap;
+    it->items = NULL;
+    it->cap = 0;
+
+    snap_lock( snap->dom );
+
+    if ( snap->first == NULL ) {
+
+        /* Resolve first Node once, by walking the snapshot view back
+         * from anchor. */
+
+        node = snap->anchor;
+        for ( ;; ) {
+            copy = snap_get( snap, node );
+            prev = copy ? snap_prev( node, copy ) : fn_prev( node );
+            if ( prev == NULL )
+                break;
+            node = prev;
+        }
+        snap->first = node;
+    }
+
+    it->node = snap->first;
+
+    snap_unlock( snap->dom );
+}
+
+
+fr_size_t fr_snap_read( fr_snap_iter_t it )
+{
+    fr_snap_t snap = it->snap;
+    fn_t      node;
+    fn_t      copy;
+    fr_size_t used = 0;
+
+    snap_lock( snap->dom );
+
+    /* Skip empty Nodes, i.e. the only Node of empty Framer. */
+    while ( used == 0 && it->node ) {
+
+        node = it->node;
+        copy = snap_get( snap, node );
+        if ( copy == NULL )
+            copy = node;
+
+        used = copy->used;
+        if ( used > it->cap ) {
+            it->cap = used;
+            it->items = fr_realloc( it->items, it->cap * FR_ITEM_SIZE );
+        }
+        seg_copy( it->items, copy, 0, used );
+
+        it->node = snap_next( node, copy );
+    }
+
+    snap_unlock( snap->dom );
+
+    return used;
+}
+
+
+void fr_snap_iter_done( fr_snap_iter_t it )
+{
+    fr_free( it->items );
+    it->items = NULL;
+    it->cap = 0;
+    it->node = NULL;
+}
+
+#endif
+
+
+
+#ifdef FRAMER_USE_DIRTY
+
+/* ------------------------------------------------------------
+ * Dirty tracking:
+ * ------------------------------------------------------------ */
+
+fr_size_t fr_dirty( fr_t pos, fr_dirty_t dirty, fr_size_t max )
+{
+    fr_size_t cnt = 0;
+    fr_size_t ord = 0;
+    fr_size_t first = 0;
+
+    for ( fn_t node = fn_first( pos->seg ); node; node = fn_next( node ) ) {
+        /* Changed, or moved by Nodes added or removed before it. */
+        if ( node->dirty != ord ) {
+            if ( dirty && cnt < max ) {
+#ifdef FRAMER_USE_GAPS
+                /* Listed segments are written as is. */
+                if ( node->gap ) {
+                    snap_touch( pos, node );
+                    gap_close( node );
+                }
+#endif
+                dirty[ cnt ].node = node;
+                dirty[ cnt ].ord = ord;
+                dirty[ cnt ].first = first;
+            }
+            cnt++;
+        }
+        ord++;
+        first += node->used;
+    }
+
+    return cnt;
+}
+
+
+void fr_dirty_clear( fr_dirty_t dirty, fr_size_t cnt )
+{
+    for ( fr_size_t i = 0; i < cnt; i++ )
+        dirty[ i ].node->dirty = dirty[ i ].ord;
+}
+
+
+void fr_checkpoint( fr_t pos )
+{
+    fr_size_t ord = 0;
+
+    for ( fn_t node = fn_first( pos->seg ); node; node = fn_next( node ) )
+        node->dirty = ord++;
+}
+
+#endif
+
+
+
+#ifdef FRAMER_USE_GAPS
+
+/* ------------------------------------------------------------
+ * Segment gaps:
+ * ------------------------------------------------------------ */
+
+void fr_flatten( fr_t pos )
+{
+    for ( fn_t node = fn_first( pos->seg ); node; node = fn_next( node ) ) {
+        if ( node->gap ) {
+            /* Item layout is content for the snapshots. */
+            snap_touch( pos, node );
+            gap_close( node );
+        }
+    }
+}
+
+#endif
+
+
+
+/* ------------------------------------------------------------
+ * Shared Framer:
+ * ------------------------------------------------------------ */
+
+fr_sync_t fr_sync_new( fr_t pos )
+{
+    fr_sync_t            sync;
+    pthread_rwlockattr_t attr;
+
+    sync = fr_malloc_aligned( node_align(), align_up( sizeof( fr_sync_s ), node_align() ) );
+    sync->pos = pos;
+    sync->gen = 0;
+
+    /* Writers are preferred, hence readers can't starve the writer. */
+    pthread_rwlockattr_init( &attr );
+#ifdef __GLIBC__
+    pthread_rwlockattr_setkind_np( &attr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP );
+#endif
+    pthread_rwlock_init( &( sync->lock ), &attr );
+    pthread_rwlockattr_destroy( &attr );
+
+    return sync;
+}
+
+
+fr_sync_t fr_sync_destroy( fr_sync_t sync )
+{
+    pthread_rwlock_destroy( &( sync->lock ) );
+    fr_destroy( sync->pos );
+    fr_free( sync );
+    return NULL;
+}
+
+
+fr_s fr_sync_read_begin( fr_sync_t sync )
+{
+    pthread_rwlock_rdlock( &( sync->lock ) );
+    return *( sync->pos );
+}
+
+
+void fr_sync_read_end( fr_sync_t sync )
+{
+    pthread_rwlock_unlock( &( sync->lock ) );
+}
+
+
+fr_t fr_sync_write_begin( fr_sync_t sync )
+{
+    pthread_rwlock_wrlock( &( sync->lock ) );
+    return sync->pos;
+}
+
+
+void fr_sync_write_end( fr_sync_t sync )
+{
+    __atomic_store_n( &( sync->gen ), sync->gen + 1, __ATOMIC_RELEASE );
+    pthread_rwlock_unlock( &( sync->lock ) );
+}
+
+
+fr_size_t fr_sync_gen( fr_sync_t sync )
+{
+    return __atomic_load_n( &( sync->gen ), __ATOMIC_ACQUIRE );
+}
+
+
+
+/* ------------------------------------------------------------
+ * Framer Position:
+ * ------------------------------------------------------------ */
+
+fr_t fr_pos_new( fr_size_t size )
+{
+    fr_t pos;
+
+    pos = fr_malloc_aligned( node_align(), align_up( sizeof( fr_s ), node_align() ) );
+    if ( pos == NULL )
+        return NULL;
+    return fr_pos_init( pos, size );
+}
+
+
+fr_t fr_pos_new_with_mem( fr_t pos, fr_size_t size, fr_mem_f alloc, fr_mem_f free, void* env )
+{
+    fr_mem_t mem;
+
+    mem = fr_malloc( sizeof( fr_mem_s ) );
+    mem->alloc = alloc;
+    mem->free = free;
+    mem->close = NULL;
+    mem->env = env;
+
+    if ( pos ) {
+        fr_pos_init( pos, size );
+    } else {
+        pos = fr_pos_new( size );
+    }
+    pos->mem = mem;
+
+    return pos;
+}
+
+
+fr_t fr_pos_init( fr_t pos, fr_size_t size )
+{
+    pos->seg = NULL;
+    pos->idx = 0;
+    pos->size = size;
+    pos->max = 0;
+    pos->icnt = 0;
+    pos->ncnt = 0;
+    pos->bcnt = 0;
+    pos->mem = NULL;
+#ifdef FRAMER_USE_SNAPSHOTS
+    pos->snap = NULL;
+#endif
+#ifdef FRAMER_USE_NODE_LOCKS
+    pos->dead = NULL;
+#endif
+
+    return pos;
+}
+
+
+fr_t fr_pos_del( fr_t pos )
+{
+    if ( pos->mem )
+        fr_free( pos->mem );
+    fr_free( pos );
+    return NULL;
+}
+
+
+fr_t fr_pos_dup( fr_t pos )
+{
+    fr_t dup;
+
+    dup = fr_malloc_aligned( node_align(), align_up( sizeof( fr_s ), node_align() ) );
+    *dup = *pos;
+
+    return dup;
+}
+
+
+void fr_pos_cpy( fr_t pos_a, fr_t pos_b )
+{
+    *pos_b = *pos_a;
+}
+
+
+fr_size_t fr_next_n( fr_t pos, fr_size_t n )
+{
+    fr_size_t steps;
+    fn_t      seg = pos->seg;
+    fr_size_t idx = pos->idx;
+
+    if ( n > pos->size && fn_next( seg ) ) {
+
+        /* Fast forwards with segment stepping. */
+
+        steps = n - ( seg->used - idx );
+        seg = fn_next( seg );
+        idx = 0;
+
+        while ( fn_next( seg ) && steps >= seg->used ) {
+            steps -= seg->used;
+            seg = fn_next( seg );
+        }
+
+        if ( steps <= seg->used - 1 ) {
+            pos->idx = steps;
+            pos->seg = seg;
+            return n;
+        } else {
+            return 0;
+        }
+
+    } else {
+
+        /* Small distance, go one by one. */
+
+        steps = 0;
+
+        while ( steps < n ) {
+            if ( idx < seg->used - 1 ) {
+                idx++;
+                steps++;
+            } else {
+                if ( fn_next( seg ) == NULL ) {
+                    return 0;
+                } else {
+                    seg = fn_next( seg );
+                    idx = 0;
+                    steps++;
+                }
+            }
+        }
+
+        pos->idx = idx;
+        pos->seg = seg;
+        return n;
+    }
+}
+
+
+fr_size_t fr_next( fr_t pos )
+{
+    if ( pos->idx < pos->seg->used - 1 ) {
+
+        pos->idx++;
+        return 1;
+
+    } else {
+
+        if ( fn_next( pos->seg ) == NULL ) {
+            return 0;
+        } else {
+            /* Step to next segment. */
+            pos->seg = fn_next( pos->seg );
+            pos->idx = 0;
+            return 1;
+        }
+    }
+}
+
+
+fr_size_t fr_prev_n( fr_t pos, fr_size_t n )
+{
+    fr_size_t steps;
+    fn_t      seg = pos->seg;
+    fr_size_t idx = pos->idx;
+
+    if ( n > pos->size ) {
+
+        /* Fast backwards with segment stepping. */
+
+        steps = n - idx;
+        idx = 0;
+
+        while ( fn_prev( seg ) && steps >= fn_prev( seg )->used ) {
+            seg = fn_prev( seg );
+            steps -= seg->used;
+        }
+
+        if ( steps == 0 ) {
+
+            pos->seg = seg;
+            pos->idx = 0;
+            return n;
+
+        } else if ( fn_prev( seg ) ) {
+
+            seg = fn_prev( seg );
+            pos->idx = ( seg->used - steps );
+            pos->seg = seg;
+            return n;
+
+        } else {
+            return 0;
+        }
+
+    } else {
+
+        /* Small distance, go one by one. */
+
+        steps = 0;
+
+        while ( steps < n ) {
+            if ( idx > 0 ) {
+                idx--;
+                steps++;
+            } else {
+                if ( fn_prev( seg ) == NULL ) {
+                    return 0;
+                } else {
+                    seg = fn_prev( seg );
+                    idx = seg->used - 1;
+                    steps++;
+                }
+            }
+        }
+
+        pos->idx = idx;
+        pos->seg = seg;
+        return n;
+    }
+}
+
+
+fr_size_t fr_prev( fr_t pos )
+{
+    if ( pos->idx > 0 ) {
+
+        pos->idx--;
+        return 1;
+
+    } else {
+
+        if ( fn_prev( pos->seg ) == NULL )
+            return 0;
+
+        pos->seg = fn_prev( pos->seg );
+        pos->idx = pos->seg->used - 1;
+        return 1;
+    }
+}
+
+
+void* fr_next_item( fr_t pos )
+{
+    if ( fr_next( pos ) == 0 ) {
+        pos->seg = NULL;
+        return NULL;
+    } else {
+        return node_item( pos->seg, pos->idx );
+    }
+}
+
+
+fr_s fr_first( fr_t pos )
+{
+    fr_s tmp = *pos;
+
+    while ( fn_prev( tmp.seg ) )
+        tmp.seg = fn_prev( tmp.seg );
+    tmp.idx = 0;
+
+    return tmp;
+}
+
+
+fr_s fr_last( fr_t pos )
+{
+    fr_s tmp = *pos;
+
+    while ( fn_next( tmp.seg ) )
+        tmp.seg = fn_next( tmp.seg );
+    tmp.idx = tmp.seg->used - 1;
+
+    return tmp;
+}
+
+
+void fr_to_first( fr_t pos )
+{
+    *pos = fr_first( pos );
+}
+
+
+void fr_to_last( fr_t pos )
+{
+    *pos = fr_last( pos );
+}
+
+
+int fr_at_first( fr_t pos )
+{
+    if ( pos->seg && fn_prev( pos->seg ) == NULL && pos->idx == 0 )
+        return fr_true;
+    else
+        return fr_false;
+}
+
+
+int fr_at_last( fr_t pos )
+{
+    if ( pos->seg && fn_next( pos->seg ) == NULL && pos->idx == pos->seg->used - 1 )
+        return fr_true;
+    else
+        return fr_false;
+}
+
+
+void* fr_item( fr_t pos )
+{
+    return node_item( pos->seg, pos->idx );
+}
+
+
+void* fr_item_at( fr_t pos, fr_size_t idx )
+{
+    if ( idx < pos->seg->used )
+        return node_item( pos->seg, idx );
+    else
+        return NULL;
+}
+
+
+int fr_is_valid( fr_t pos )
+{
+    return ( pos->seg != NULL );
+}
+
+
+
+/* ------------------------------------------------------------
+ * Framer node:
+ * ------------------------------------------------------------ */
+
+fn_t fn_new_sized( fr_size_t size )
+{
+    fn_t node;
+
+    assert( size >= FR_SEG_MIN );
+
+    node = node_malloc( node_alloc_bytes( size ) );
+    if ( node == NULL )
+        return NULL;
+    fn_set_prev( node, NULL );
+    fn_set_next( node, NULL );
+    node->used = 0;
+    node->size = size;
+#ifdef FRAMER_USE_NODE_LOCKS
+    node->lock = 0;
+#endif
+#ifdef FRAMER_USE_SNAPSHOTS
+    node->gen = 0;
+#endif
+#ifdef FRAMER_USE_DIRTY
+    node->dirty = FR_DIRTY;
+#endif
+#ifdef FRAMER_USE_GAPS
+    node->gap = 0;
+#endif
+#ifdef FRAMER_USE_CURSORS
+    node->curs = NULL;
+#endif
+    node->data[ 0 ] = NULL;
+
+    return node;
+}
+
+
+#ifdef FRAMER_COMPACT_LINKS
+
+fn_link_t fn_link( fn_t node, fn_t peer )
+{
+    intptr_t diff;
+
+    if ( peer == NULL )
+        return 0;
+
+    diff = (char*)peer - (char*)node;
+
+    assert( diff % FR_LINK_UNIT == 0 );
+    assert( diff / FR_LINK_UNIT <= INT32_MAX && diff / FR_LINK_UNIT >= INT32_MIN );
+
+    return (fn_link_t)( diff / FR_LINK_UNIT );
+}
+
+#endif
+
+
+fn_t fn_first( fn_t node )
+{
+    while ( fn_prev( node ) != NULL )
+        node = fn_prev( node );
+
+    return node;
+}
+
+
+fn_t fn_last( fn_t node )
+{
+    while ( fn_next( node ) != NULL )
+        node = fn_next( node );
+
+    return node;
+}
+
+
+fn_t fn_append( fn_t anchor, fn_t node )
+{
+    /* Node is published with release, for epoch readers. */
+    if ( fn_next( anchor ) == NULL ) {
+        fn_set_prev( node, anchor );
+        fn_set_next_release( anchor, node );
+    } else {
+        fn_set_prev( fn_next( anchor ), node );
+        fn_set_next( node, fn_next( anchor ) );
+        fn_set_prev( node, anchor );
+        fn_set_next_release( anchor, node );
+    }
+
+    return node;
+}
+
+
+fn_t fn_update( fn_t node )
+{
+    fn_t ret;
+
+    if ( fn_prev( node ) && fn_next( node ) ) {
+        fn_set_next_release( fn_prev( node ), fn_next( node ) );
+        fn_set_prev( fn_next( node ), fn_prev( node ) );
+        ret = fn_next( node );
+    } else if ( fn_prev( node ) ) {
+        fn_set_next_release( fn_prev( node ), NULL );
+        ret = fn_prev( node );
+    } else if ( fn_next( node ) ) {
+        fn_set_prev( fn_next( node ), NULL );
+        ret = fn_next( node );
+    } else {
+        ret = NULL;
+    }
+
+    return ret;
+}
+
+
+fn_t fn_delete( fn_t node )
+{
+    fn_t ret;
+
+    ret = fn_update( node );
+    node_free( node, node_alloc_bytes( node->size ) );
+
+    return ret;
+}
+
+
+/* ------------------------------------------------------------
+ * Internal functions:
+ * ------------------------------------------------------------ */
+
+static fr_size_t node_align( void )
+{
+    /* Node type alignment is the minimum. */
+    if ( fr_cache_line_size() > FR_CACHE_LINE_SIZE )
+        return fr_cache_line_size();
+    else
+        return FR_CACHE_LINE_SIZE;
+}
+
+
+static fn_t alloc_node( fr_t pos )
+{
+    fn_t node;
+
+    if ( pos->max && pos->size < pos->max && pos->ncnt >= pos->size ) {
+
+        /* Adaptive mode: grow segment size together with Node
+         * count. This keeps Node count and segment size in
+         * balance. */
+
+        pos->size *= 2;
+        if ( pos->size > pos->max )
+            pos->size = pos->max;
+    }
+
+    if ( pos->mem )
+        node = memapi_alloc( pos );
+    else
+        node = fn_new_sized( pos->size );
+
+    if ( node == NULL )
+        return NULL;
+
+    /* Pooled Nodes are reused as is. */
+#ifdef FRAMER_USE_NODE_LOCKS
+    node->lock = 0;
+#endif
+#ifdef FRAMER_USE_SNAPSHOTS
+    /* New content is not seen by existing snapshots. */
+    node->gen = snap_gen( pos );
+#endif
+#ifdef FRAMER_USE_DIRTY
+    node->dirty = FR_DIRTY;
+#endif
+#ifdef FRAMER_USE_GAPS
+    node->gap = 0;
+#endif
+#ifdef FRAMER_USE_CURSORS
+    node->curs = NULL;
+#endif
+
+    pos->bcnt += node_bytes( node );
+
+    return node;
+}
+
+
+static fn_t alloc_node_min( fr_t pos, fr_size_t min )
+{
+    fn_t node;
+
+    node = alloc_node( pos );
+
+    if ( node && node->size < min ) {
+
+        /* Position (or Memory API) has smaller segment size than the
+         * Node to be split. Small Node is returned to its allocator,
+         * and oversize Node is taken from heap. */
+
+        release_node( pos, node );
+        node = fn_new_sized( min );
+        if ( node == NULL )
+            return NULL;
+#ifdef FRAMER_USE_SNAPSHOTS
+        node->gen = snap_gen( pos );
+#endif
+        pos->bcnt += node_bytes( node );
+    }
+
+    return node;
+}
+
+
+static fn_t release_node( fr_t pos, fn_t node )
+{
+#ifdef FRAMER_USE_CURSORS
+    assert( node->curs == NULL );
+#endif
+
+    pos->bcnt -= node_bytes( node );
+
+    if ( pos->mem ) {
+        fr_s tmp = *pos;
+        tmp.seg = node;
+        memapi_free( &tmp );
+        return tmp.seg;
+    } else {
+        return fn_delete( node );
+    }
+}
+
+
+/**
+ * Move Position out of Node, whose last item is deleted.
+ *
+ * Position index is set for the peer Node that release returns.
+ *
+ * @param pos  Position.
+ * @param node Node with peers.
+ */
+static void leave_node( fr_t pos, fn_t node )
+{
+    if ( fn_next( node ) == NULL ) {
+        pos->idx = fn_prev( node )->used - 1;
+        cursor_rehome( node, fn_prev( node ), pos->idx );
+    } else {
+        pos->idx = 0;
+        cursor_rehome( node, fn_next( node ), 0 );
+    }
+
+    pos->ncnt--;
+}
+
+
+#if defined( FRAMER_USE_SNAPSHOTS ) || defined( FRAMER_USE_DIRTY ) || defined( FRAMER_USE_GAPS )
+
+/**
+ * Prepare Nodes from node upto stop (inclusive) for modification.
+ *
+ * @param pos  Position.
+ * @param node First Node.
+ * @param stop Last Node (or NULL for end).
+ */
+static void node_touch_all( fr_t pos, fn_t node, fn_t stop )
+{
+    (void)pos;
+
+    for ( ; node; node = fn_next( node ) ) {
+        node_touch( pos, node );
+        if ( node == stop )
+            break;
+    }
+}
+
+#endif
+
+
+/**
+ * Open slot for item at idx in Node segment, for insert.
+ *
+ * Segment must have a free slot. Caller stores the item to data[ idx ]
+ * and increments the used count.
+ *
+ * @param pos  Position.
+ * @param node Node.
+ * @param idx  Item index.
+ */
+static void seg_open( fr_t pos, fn_t node, fr_size_t idx )
+{
+#ifdef FRAMER_USE_GAPS
+    /* Epoch readers don't see gaps. */
+    if ( !epoch_on( pos ) ) {
+        snap_touch( pos, node );
+        dirty_mark( node );
+        gap_move( node, idx );
+        cursor_move( node, idx, node->used - idx, node, idx + 1 );
+        return;
+    }
+#endif
+    node_touch( pos, node );
+    if ( idx < node->used )
+        items_move( pos, &( node->data[ idx + 1 ] ), &( node->data[ idx ] ), node->used - idx );
+    cursor_move( node, idx, node->used - idx, node, idx + 1 );
+}
+
+
+/**
+ * Remove item at idx from Node segment, for delete.
+ *
+ * Item must not be the last item. Caller decrements the used count.
+ *
+ * @param pos  Position.
+ * @param node Node.
+ * @param idx  Item index.
+ */
+static void seg_shut( fr_t pos, fn_t node, fr_size_t idx )
+{
+#ifdef FRAMER_USE_GAPS
+    if ( !epoch_on( pos ) ) {
+        snap_touch( pos, node );
+        dirty_mark( node );
+        gap_move( node, idx );
+        node->gap--;
+        cursor_move( node, idx + 1, node->used - ( idx + 1 ), node, idx );
+        return;
+    }
+#endif
+    node_touch( pos, node );
+    items_move( pos, &( node->data[ idx ] ), &( node->data[ idx + 1 ] ), node->used - ( idx + 1 ) );
+    cursor_move( node, idx + 1, node->used - ( idx + 1 ), node, idx );
+}
+
+
+/**
+ * Move n items within or between Node segments (as memmove).
+ *
+ * Items are copied one by one with atomic stores, when the Framer is
+ * scanned by epoch readers.
+ *
+ * @param pos Position.
+ * @param dst Destination.
+ * @param src Source.
+ * @param n   Item count.
+ */
+static void items_move( fr_t pos, void** dst, void** src, fr_size_t n )
+{
+    if ( !epoch_on( pos ) ) {
+        memmove( dst, src, n * FR_ITEM_SIZE );
+    } else if ( dst < src ) {
+        for ( fr_size_t i = 0; i < n; i++ )
+            __atomic_store_n( &( dst[ i ] ), src[ i ], __ATOMIC_RELAXED );
+    } else {
+        for ( fr_size_t i = n - 1; i >= 0; i-- )
+            __atomic_store_n( &( dst[ i ] ), src[ i ], __ATOMIC_RELAXED );
+    }
+}
+
+
+#ifdef FRAMER_USE_GAPS
+
+/**
+ * Move segment gap to item index idx.
+ *
+ * Only the items between the old and new gap position are moved.
+ *
+ * @param node Node.
+ * @param idx  Item index, i.e. item count before the gap.
+ */
+static void gap_move( fn_t node, fr_size_t idx )
+{
+    fr_size_t head = gap_head( node );
+    fr_size_t free = free_seg( node );
+
+    if ( free > 0 && idx < head )
+        memmove( &( node->data[ idx + free ] ),
+                 &( node->data[ idx ] ),
+                 ( head - idx ) * FR_ITEM_SIZE );
+    else if ( free > 0 && idx > head )
+        memmove( &( node->data[ head ] ),
+                 &( node->data[ head + free ] ),
+                 ( idx - head ) * FR_ITEM_SIZE );
+
+    node->gap = node->used - idx;
+}
+
+
+/**
+ * Copy n items of Node segment from idx, around the gap.
+ *
+ * @param dst  Destination.
+ * @param node Node.
+ * @param idx  Item index.
+ * @param n    Item count.
+ */
+static void seg_copy( void** dst, fn_t node, fr_size_t idx, fr_size_t n )
+{
+    fr_size_t cnt = gap_head( node ) - idx;
+
+    if ( cnt > n )
+        cnt = n;
+
+    if ( cnt > 0 ) {
+        memcpy( dst, &( node->data[ idx ] ), cnt * FR_ITEM_SIZE );
+        dst += cnt;
+        idx += cnt;
+        n -= cnt;
+    }
+
+    if ( n > 0 )
+        memcpy( dst, &( node->data[ idx + free_seg( node ) ] ), n * FR_ITEM_SIZE );
+}
+
+#endif
+
+
+static fr_arena_t arena_new( fr_size_t cnt, fr_size_t size )
+{
+    fr_arena_t arena;
+
+    arena = fr_malloc( sizeof( fr_arena_s ) );
+    arena->slot = node_alloc_bytes( size );
+    arena->size = size;
+    arena->cnt = cnt;
+    arena->top = 0;
+    arena->free = NULL;
+    arena->base = node_malloc( cnt * arena->slot );
+    if ( arena->base == NULL ) {
+        fr_free( arena );
+        return NULL;
+    }
+
+    return arena;
+}
+
+
+static void arena_del( fr_arena_t arena )
+{
+    node_free( arena->base, arena->cnt * arena->slot );
+    fr_free( arena );
+}
+
+
+/**
+ * Take all arena slots into use, linked in order and empty.
+ *
+ * @param arena Arena.
+ * @param gen   Snapshot generation for slots.
+ */
+static void arena_chain( fr_arena_t arena, fr_size_t gen )
+{
+    fn_t slot;
+
+    (void)gen;
+
+    arena->top = arena->cnt;
+
+    for ( fr_size_t ord = 0; ord < arena->cnt; ord++ ) {
+        slot = arena_slot( arena, ord );
+        fn_set_prev( slot, ord > 0 ? arena_slot( arena, ord - 1 ) : NULL );
+        fn_set_next( slot, ord < arena->cnt - 1 ? arena_slot( arena, ord + 1 ) : NULL );
+        slot->used = 0;
+        slot->size = arena->size;
+#ifdef FRAMER_USE_NODE_LOCKS
+        slot->lock = 0;
+#endif
+#ifdef FRAMER_USE_SNAPSHOTS
+        slot->gen = gen;
+#endif
+#ifdef FRAMER_USE_DIRTY
+        slot->dirty = FR_DIRTY;
+#endif
+#ifdef FRAMER_USE_GAPS
+        slot->gap = 0;
+#endif
+#ifdef FRAMER_USE_CURSORS
+        slot->curs = NULL;
+#endif
+    }
+}
+
+
+static fn_t arena_alloc( fr_t pos, void* env )
+{
+    fr_arena_t arena = env;
+    fn_t       node;
+
+    /* Slots are used only if segment fits, i.e. adaptive segment size
+     * has not grown past the slot. */
+    if ( pos->size <= arena->size && arena->free ) {
+        node = arena->free;
+        arena->free = fn_next( node );
+    } else if ( pos->size <= arena->size && arena->top < arena->cnt ) {
+        node = arena_slot( arena, arena->top );
+        arena->top++;
+    } else if ( arena->parent.alloc ) {
+        return arena->parent.alloc( pos, arena->parent.env );
+    } else {
+        return fn_new_sized( pos->size );
+    }
+
+    fn_set_prev( node, NULL );
+    fn_set_next( node, NULL );
+    node->used = 0;
+    node->size = arena->size;
+#ifdef FRAMER_USE_NODE_LOCKS
+    node->lock = 0;
+#endif
+#ifdef FRAMER_USE_SNAPSHOTS
+    node->gen = 0;
+#endif
+#ifdef FRAMER_USE_DIRTY
+    node->dirty = FR_DIRTY;
+#endif
+#ifdef FRAMER_USE_GAPS
+    node->gap = 0;
+#endif
+#ifdef FRAMER_USE_CURSORS
+    node->curs = NULL;
+#endif
+    node->data[ 0 ] = NULL;
+
+    return node;
+}
+
+
+static fn_t arena_free( fr_t pos, void* env )
+{
+    fr_arena_t arena = env;
+    fn_t       node = pos->seg;
+
+    if ( arena_has( arena, node ) ) {
+        pos->seg = fn_update( node );
+        fn_set_next( node, arena->free );
+        arena->free = node;
+    } else if ( arena->parent.alloc ) {
+        arena->parent.free( pos, arena->parent.env );
+    } else {
+        pos->seg = fn_delete( node );
+    }
+
+    return NULL;
+}
+
+
+static fn_t arena_close( fr_t pos, void* env )
+{
+    fr_arena_t arena = env;
+
+    if ( arena->parent.close )
+        arena->parent.close( pos, arena->parent.env );
+
+    arena_del( arena );
+
+    return NULL;
+}
+
+
+
+/**
+ * Write all data of iovecs.
+ *
+ * iovecs are modified on partial write.
+ *
+ * @param fd  File descriptor.
+ * @param iov iovecs.
+ * @param cnt iovec count.
+ *
+ * @return 0 on success, -1 on error.
+ */
+static int io_writev( int fd, struct iovec* iov, int cnt )
+{
+    ssize_t n;
+
+    while ( cnt > 0 ) {
+
+        n = writev( fd, iov, cnt );
+        if ( n < 0 ) {
+            if ( errno == EINTR )
+                continue;
+            return -1;
+        }
+
+        /* Skip written iovecs. */
+        while ( cnt > 0 && (size_t)n >= iov->iov_len ) {
+            n -= iov->iov_len;
+            iov++;
+            cnt--;
+        }
+
+        if ( cnt > 0 ) {
+            iov->iov_base = (char*)iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+
+    return 0;
+}
+
+
+/**
+ * Write all data.
+ *
+ * @param fd    File descriptor.
+ * @param buf   Data.
+ * @param bytes Byte count.
+ *
+ * @return 0 on success, -1 on error.
+ */
+static int io_write( int fd, void* buf, fr_size_t bytes )
+{
+    struct iovec iov;
+
+    iov.iov_base = buf;
+    iov.iov_len = bytes;
+
+    return io_writev( fd, &iov, 1 );
+}
+
+
+/**
+ * Read exact byte count.
+ *
+ * @param fd    File descriptor.
+ * @param buf   Data.
+ * @param bytes Byte count.
+ *
+ * @return 0 on success, -1 on error or end of file.
+ */
+static int io_read( int fd, void* buf, fr_size_t bytes )
+{
+    ssize_t n;
+
+    while ( bytes > 0 ) {
+        n = read( fd, buf, bytes );
+        if ( n < 0 && errno == EINTR )
+            continue;
+        if ( n <= 0 )
+            return -1;
+        buf = (char*)buf + n;
+        bytes -= n;
+    }
+
+    return 0;
+}
+
+
+/**
+ * Check for end of file.
+ *
+ * @param fd File descriptor.
+ *
+ * @return 1 if no more data, else 0.
+ */
+static int io_end( int fd )
+{
+    char    c;
+    ssize_t n;
+
+    while ( ( n = read( fd, &c, 1 ) ) < 0 && errno == EINTR )
+        ;
+
+    return n == 0;
+}
+
+
+/**
+ * Fill read buffer to have at least "need" bytes from offset.
+ *
+ * Unread data is moved to buffer start, and buffer is grown if
+ * needed.
+ *
+ * @param fd   File descriptor.
+ * @param buf  Buffer reference.
+ * @param cap  Buffer capacity reference.
+ * @param len  Buffer data length reference.
+ * @param off  Read offset reference.
+ * @param need Bytes needed.
+ *
+ * @return 0 on success, -1 on error or end of file.
+ */
+static int io_fill(
+    int fd, char** buf, fr_size_t* cap, fr_size_t* len, fr_size_t* off, fr_size_t need )
+{
+    ssize_t n;
+
+    memmove( *buf, *buf + *off, *len - *off );
+    *len -= *off;
+    *off = 0;
+
+    if ( need > *cap ) {
+        char* grow = fr_realloc( *buf, need );
+        if ( grow == NULL )
+            return -1;
+        *buf = grow;
+        *cap = need;
+    }
+
+    while ( *len < need ) {
+        n = read( fd, *buf + *len, *cap - *len );
+        if ( n < 0 && errno == EINTR )
+            continue;
+        if ( n <= 0 )
+            return -1;
+        *len += n;
+    }
+
+    return 0;
+}
+
+
+/**
+ * Append Node for fr_read().
+ *
+ * Framer is destroyed, if out of memory.
+ *
+ * @param pos  Position.
+ * @param node Last Node.
+ *
+ * @return Appended Node (or NULL).
+ */
+static fn_t read_node( fr_t pos, fn_t node )
+{
+    fn_t next;
+
+    if ( ( next = alloc_node( pos ) ) == NULL ) {
+        fr_destroy( pos );
+        return NULL;
+    }
+
+    pos->ncnt++;
+
+    return fn_append( node, next );
+}
+
+
+/**
+ * Take Node for merge output, from consumed Nodes if possible.
+ *
+ * @param m   Merge state.
+ * @param pos Position for allocation.
+ *
+ * @return Empty Node.
+ */
+static fn_t merge_node( merge_t m, fr_t pos )
+{
+    fn_t node;
+
+    if ( m->pool ) {
+        node = m->pool;
+        m->pool = fn_next( node );
+        fn_set_next( node, NULL );
+        node->used = 0;
+#ifdef FRAMER_USE_SNAPSHOTS
+        node->gen = snap_gen( pos );
+#endif
+    } else {
+        node = alloc_node( pos );
+    }
+
+    return node;
+}
+
+
+/**
+ * Link Node to merge output.
+ *
+ * @param m    Merge state.
+ * @param node Node (unlinked).
+ */
+static void merge_grow( merge_t m, fn_t node )
+{
+    fn_set_prev( node, NULL );
+    fn_set_next( node, NULL );
+    node->used = 0;
+#ifdef FRAMER_USE_SNAPSHOTS
+    node->gen = snap_gen( m->dst );
+#endif
+
+    if ( m->out )
+        fn_append( m->out, node );
+    else
+        m->head = node;
+
+    m->out = node;
+    m->ncnt++;
+}
+
+
+/**
+ * Output item from input Node.
+ *
+ * @param m      Merge state.
+ * @param node   Input Node.
+ * @param idx    Item index.
+ * @param comp   Compare function.
+ * @param unique Drop items equal to the previous item if 1.
+ */
+static void merge_emit( merge_t m, fn_t node, fr_size_t idx, fr_cmp_f comp, int unique )
+{
+    void* item = node->data[ idx ];
+
+    if ( unique && m->last && comp( m->last->data[ m->lidx ], item ) == 0 ) {
+        cursor_move( node, idx, 1, m->last, m->lidx );
+        return;
+    }
+
+    if ( m->out == NULL || m->out->used == m->out->size )
+        merge_grow( m, merge_node( m, m->dst ) );
+
+    m->out->data[ m->out->used ] = item;
+    cursor_move( node, idx, 1, m->out, m->out->used );
+    m->last = m->out;
+    m->lidx = m->out->used;
+    m->out->used++;
+    m->icnt++;
+}
+
+
+/**
+ * Recycle consumed input Node.
+ *
+ * Node is either reused for output, or released to its owner.
+ *
+ * @param m     Merge state.
+ * @param node  Consumed Node.
+ * @param owner Position of Node owner.
+ */
+static void merge_recycle( merge_t m, fn_t node, fr_t owner )
+{
+#ifdef FRAMER_USE_CURSORS
+    /* Cursors at the end of Node. */
+    if ( m->out )
+        cursor_rehome( node, m->out, m->out->used );
+#endif
+
+    fn_set_prev( node, NULL );
+
+    if ( owner == m->src && !m->share ) {
+        fn_set_next( node, NULL );
+        release_node( owner, node );
+    } else {
+        fn_set_next( node, m->pool );
+        m->pool = node;
+    }
+}
+
+
+/**
+ * Even out last two output Nodes, so that both are half full.
+ *
+ * @param m Merge state.
+ */
+static void merge_even( merge_t m )
+{
+    fn_t      prev;
+    fn_t      out = m->out;
+    fr_size_t total;
+    fr_size_t n;
+
+    if ( out == NULL || out == m->head || out->used * 2 >= out->size )
+        return;
+
+    prev = fn_prev( out );
+    total = prev->used + out->used;
+
+    if ( total <= prev->size ) {
+
+        /* Combine to previous. */
+
+        memcpy( &( prev->data[ prev->used ] ), out->data, out->used * FR_ITEM_SIZE );
+        cursor_move( out, 0, out->used, prev, prev->used );
+        prev->used = total;
+
+        fn_set_next( prev, NULL );
+        m->out = prev;
+        m->ncnt--;
+        merge_recycle( m, out, m->dst );
+
+    } else {
+
+        /* Move tail of previous. Nodes come from both inputs, hence
+         * move is capped to the free space of out. */
+
+        n = total / 2 - out->used;
+        if ( n > out->size - out->used )
+            n = out->size - out->used;
+        if ( n <= 0 )
+            return;
+        memmove( &( out->data[ n ] ), out->data, out->used * FR_ITEM_SIZE );
+        cursor_move( out, 0, out->used, out, n );
+        memcpy( out->data, &( prev->data[ prev->used - n ] ), n * FR_ITEM_SIZE );
+        cursor_move( prev, prev->used - n, n, out, 0 );
+        prev->used -= n;
+        out->used += n;
+    }
+}
+
+
+/**
+ * Compact Framer to the items accepted by filter.
+ *
+ * Kept items are written to full segments from the first Node. Writer
+ * is never ahead of reader, hence items are moved in place. Nodes
+ * after the last written are released at the end.
+ *
+ * @param pos  Position (at first item after).
+ * @param keep Item filter.
+ * @param ctx  Filter context.
+ *
+ * @return Count of removed items.
+ */
+static fr_size_t filter_pass( fr_t pos, filter_f keep, void* ctx )
+{
+    fn_t      r;
+    fn_t      w;
+    fn_t      next;
+    fn_t      last = NULL;
+    fr_size_t wi = 0;
+    fr_size_t lidx = 0;
+    fr_size_t icnt = 0;
+    fr_size_t ret;
+
+#if defined( FRAMER_USE_SNAPSHOTS ) || defined( FRAMER_USE_DIRTY ) || defined( FRAMER_USE_GAPS )
+    node_touch_all( pos, fn_first( pos->seg ), NULL );
+#endif
+
+    w = fn_first( pos->seg );
+
+    for ( r = w; r; r = fn_next( r ) ) {
+        for ( fr_size_t ri = 0; ri < r->used; ri++ ) {
+
+            void* item = r->data[ ri ];
+
+            if ( !keep( ctx, item ) ) {
+                cursor_move( r, ri, 1, last, lidx );
+                continue;
+            }
+
+            if ( wi == w->size ) {
+                w->used = wi;
+                w = fn_next( w );
+                wi = 0;
+            }
+
+            w->data[ wi ] = item;
+            cursor_move( r, ri, 1, w, wi );
+            last = w;
+            lidx = wi;
+            wi++;
+            icnt++;
+        }
+    }
+
+    /* Last kept item is used by cursors only. */
+    (void)last;
+    (void)lidx;
+
+    w->used = wi;
+
+
+    /* Release emptied Nodes at once. */
+
+    next = fn_next( w );
+    fn_set_next( w, NULL );
+
+    while ( next ) {
+        r = next;
+        next = fn_next( r );
+        fn_set_prev( r, NULL );
+        fn_set_next( r, NULL );
+        cursor_rehome( r, w, wi );
+        release_node( pos, r );
+        pos->ncnt--;
+    }
+
+    ret = pos->icnt - icnt;
+
+    pos->seg = fn_first( w );
+    pos->idx = 0;
+    pos->icnt = icnt;
+
+    return ret;
+}
+
+
+/**
+ * Keep item unless it equals the last kept item.
+ *
+ * @param ctx  Unique filter.
+ * @param item Item.
+ *
+ * @return 1 if kept.
+ */
+static int unique_keep( void* ctx, void* item )
+{
+    unique_s* u = ctx;
+
+    if ( u->some && u->comp( u->last, item ) == 0 )
+        return 0;
+
+    u->last = item;
+    u->some = 1;
+
+    return 1;
+}
+
+
+/**
+ * Keep item unless it has been seen.
+ *
+ * @param ctx  Hashed unique filter.
+ * @param item Item.
+ *
+ * @return 1 if kept.
+ */
+static int unique_hashed_keep( void* ctx, void* item )
+{
+    unique_hashed_s* u = ctx;
+    fr_size_t        h = u->hash( item ) & u->mask;
+
+    while ( u->occ[ h / 8 ] & ( 1 << ( h % 8 ) ) ) {
+        if ( u->eq( u->slots[ h ], item ) == 0 )
+            return 0;
+        h = ( h + 1 ) & u->mask;
+    }
+
+    u->slots[ h ] = item;
+    u->occ[ h / 8 ] |= 1 << ( h % 8 );
+
+    return 1;
+}
+
+
+/**
+ * Run set operation over sorted Framers.
+ *
+ * @param a    Position of first Framer.
+ * @param b    Position of second Framer.
+ * @param comp Compare function.
+ * @param op   Set operation.
+ * @param emit Output function.
+ * @param ctx  Output context.
+ *
+ * @return Count of output items.
+ */
+static fr_size_t set_run( fr_t a, fr_t b, fr_cmp_f comp, int op, fr_emit_f emit, void* ctx )
+{
+    fr_s      x = *a;
+    fr_s      y = *b;
+    fr_s      t;
+    fr_size_t cnt = 0;
+    int       c;
+
+    x.seg = fn_first( x.seg );
+    x.idx = 0;
+    set_skip( &x );
+    y.seg = fn_first( y.seg );
+    y.idx = 0;
+    set_skip( &y );
+
+    while ( x.seg && y.seg ) {
+
+        c = comp( node_item( x.seg, x.idx ), node_item( y.seg, y.idx ) );
+
+        if ( c < 0 ) {
+
+            /* Run of a without match. */
+            t = x;
+            set_gallop( &t, node_item( y.seg, y.idx ), comp );
+            if ( op != SET_INTERSECT )
+                cnt += set_span( &x, &t, emit, ctx );
+            x = t;
+
+        } else if ( c > 0 ) {
+
+            /* Run of b without match. */
+            t = y;
+            set_gallop( &t, node_item( x.seg, x.idx ), comp );
+            if ( op == SET_UNION )
+                cnt += set_span( &y, &t, emit, ctx );
+            y = t;
+
+        } else {
+
+            if ( op != SET_DIFFERENCE ) {
+                emit( ctx, node_item( x.seg, x.idx ) );
+                cnt++;
+            }
+            x.idx++;
+            set_skip( &x );
+            y.idx++;
+            set_skip( &y );
+        }
+    }
+
+    if ( op != SET_INTERSECT ) {
+        t.seg = NULL;
+        cnt += set_span( &x, &t, emit, ctx );
+        if ( op == SET_UNION )
+            cnt += set_span( &y, &t, emit, ctx );
+    }
+
+    return cnt;
+}
+
+
+/**
+ * Advance to first item that is not smaller than key.
+ *
+ * Nodes that end before key are skipped, and then key is searched
+ * from the Node with exponential and binary search.
+ *
+ * @param it   Position (at item).
+ * @param key  Key item.
+ * @param comp Compare function.
+ */
+static void set_gallop( fr_t it, void* key, fr_cmp_f comp )
+{
+    fn_t      node = it->seg;
+    fr_size_t lo;
+    fr_size_t hi;
+    fr_size_t step = 1;
+
+    while ( node->used == 0 || comp( node_item( node, node->used - 1 ), key ) < 0 ) {
+        node = fn_next( node );
+        if ( node == NULL ) {
+            it->seg = NULL;
+            return;
+        }
+        it->seg = node;
+        it->idx = 0;
+    }
+
+    /* Last item of Node is not smaller than key. */
+
+    lo = it->idx;
+    hi = it->idx;
+    while ( comp( node_item( node, hi ), key ) < 0 ) {
+        lo = hi + 1;
+        hi += step;
+        step *= 2;
+        if ( hi >= node->used - 1 ) {
+            hi = node->used - 1;
+            break;
+        }
+    }
+
+    while ( lo < hi ) {
+        fr_size_t mid = lo + ( hi - lo ) / 2;
+        if ( comp( node_item( node, mid ), key ) < 0 )
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    it->idx = lo;
+}
+
+
+/**
+ * Output items from Position upto stop Position.
+ *
+ * @param it   Position (at item).
+ * @param stop Stop Position (NULL segment for end).
+ * @param emit Output function.
+ * @param ctx  Output context.
+ *
+ * @return Count of output items.
+ */
+static fr_size_t set_span( fr_t it, fr_t stop, fr_emit_f emit, void* ctx )
+{
+    fn_t      node = it->seg;
+    fr_size_t idx = it->idx;
+    fr_size_t end;
+    fr_size_t cnt = 0;
+
+    while ( node ) {
+        end = ( node == stop->seg ) ? stop->idx : node->used;
+        for ( ; idx < end; idx++ ) {
+            emit( ctx, node_item( node, idx ) );
+            cnt++;
+        }
+        if ( node == stop->seg )
+            break;
+        node = fn_next( node );
+        idx = 0;
+    }
+
+    return cnt;
+}
+
+
+/**
+ * Skip to valid item, over consumed and empty Nodes.
+ *
+ * @param it Position.
+ */
+static void set_skip( fr_t it )
+{
+    while ( it->seg && it->idx >= it->seg->used ) {
+        it->seg = fn_next( it->seg );
+        it->idx = 0;
+    }
+}
+
+
+/**
+ * Push item to result Framer.
+ *
+ * @param ctx  Result Framer.
+ * @param item Item.
+ */
+static void set_push( void* ctx, void* item )
+{
+    fr_push( (fr_t)ctx, item );
+}
+
+
+/**
+ * Run set operation to new Framer.
+ *
+ * @param a    Position of first Framer.
+ * @param b    Position of second Framer.
+ * @param comp Compare function.
+ * @param op   Set operation.
+ *
+ * @return Result Framer.
+ */
+static fr_t set_new( fr_t a, fr_t b, fr_cmp_f comp, int op )
+{
+    fr_t pos;
+
+    pos = fr_create_sized( a->size );
+    set_run( a, b, comp, op, set_push, pos );
+    fr_to_first( pos );
+
+    return pos;
+}
+
+
+/**
+ * Reverse item array.
+ *
+ * Loop is simple for the compiler to vectorize.
+ *
+ * @param data Items.
+ * @param n    Item count.
+ */
+static void reverse_items( void** data, fr_size_t n )
+{
+    void** a = data;
+    void** b = data + n - 1;
+    void*  t;
+
+    if ( n < 2 )
+        return;
+
+    for ( fr_size_t i = 0; i < n / 2; i++ ) {
+        t = a[ i ];
+        a[ i ] = b[ -(ptrdiff_t)i ];
+        b[ -(ptrdiff_t)i ] = t;
+    }
+}
+
+
+/**
+ * Fill Node segment from source.
+ *
+ * @param node   Node.
+ * @param fill   Segment fill count (or 0 for full segment).
+ * @param source Item source.
+ * @param ctx    Source context.
+ * @param end    End of source flag (output).
+ */
+static void load_fill( fn_t node, fr_size_t fill, fr_source_f source, void* ctx, int* end )
+{
+    fr_size_t n;
+
+    if ( fill == 0 || fill > node->size )
+        fill = node->size;
+
+    while ( node->used < fill ) {
+        n = source( ctx, &( node->data[ node->used ] ), fill - node->used );
+        if ( n == 0 ) {
+            *end = 1;
+            break;
+        }
+        node->used += n;
+    }
+}
+
+
+/**
+ * Link loaded Node after last Node.
+ *
+ * Empty Node is released, and empty last Node is replaced.
+ *
+ * @param pos  Position.
+ * @param last Last Node (updated).
+ * @param node Loaded Node.
+ */
+static void load_link( fr_t pos, fn_t* last, fn_t node )
+{
+    if ( node->used == 0 ) {
+        release_node( pos, node );
+        return;
+    }
+
+    if ( pos->icnt == 0 ) {
+
+        /* Empty Framer has one empty Node. */
+
+        fn_t prev = *last;
+
+        node_touch( pos, prev );
+        fn_append( prev, node );
+        pos->seg = node;
+        pos->idx = 0;
+        release_node( pos, prev );
+
+    } else {
+
+        node_touch( pos, *last );
+        fn_append( *last, node );
+        pos->ncnt++;
+    }
+
+    pos->icnt += node->used;
+    *last = node;
+}
+
+
+/**
+ * Fill Node buffers from source, until the end of source.
+ *
+ * @param arg Load job.
+ *
+ * @return NULL
+ */
+static void* load_run( void* arg )
+{
+    load_job_t job = arg;
+    fn_t       node;
+    int        end = 0;
+    int        b = 0;
+
+    while ( !end ) {
+
+        pthread_mutex_lock( &( job->lock ) );
+        while ( job->state[ b ] != 1 )
+            pthread_cond_wait( &( job->cond ), &( job->lock ) );
+        node = job->buf[ b ];
+        pthread_mutex_unlock( &( job->lock ) );
+
+        load_fill( node, job->fill, job->source, job->ctx, &end );
+
+        pthread_mutex_lock( &( job->lock ) );
+        job->state[ b ] = end ? 3 : 2;
+        pthread_cond_broadcast( &( job->cond ) );
+        pthread_mutex_unlock( &( job->lock ) );
+
+        b = 1 - b;
+    }
+
+    return NULL;
+}
+
+
+#ifdef FRAMER_COMPACT_LINKS
+
+/**
+ * Initialize Mapped Framer header.
+ *
+ * @param head Header.
+ * @param size Segment size.
+ * @param max  Maximum Node count.
+ */
+static void map_head( fr_map_head_s* head, fr_size_t size, fr_size_t max )
+{
+    assert( size >= FR_SEG_MIN && max >= 1 );
+
+    memset( head, 0, sizeof( fr_map_head_s ) );
+    memcpy( head->magic, "FRMP", 4 );
+    head->version = FR_FILE_VERSION;
+    head->order = 0x01020304;
+    head->unit = FR_LINK_UNIT;
+    head->node = FR_NODE_SIZE;
+    head->item = FR_ITEM_SIZE;
+    head->size = size;
+    head->slot = node_alloc_bytes( size );
+    head->cnt = max < FR_MAP_GROW ? max : FR_MAP_GROW;
+    head->max = max;
+}
+
+
+/**
+ * Create Mapped Framer to file.
+ *
+ * File is sized and header is written. Address space is reserved for
+ * the maximum Node count, hence the file can grow without moving the
+ * mapping. Framer has one empty Node.
+ *
+ * @param fd   File descriptor.
+ * @param head File header.
+ * @param shm  Shared memory if 1.
+ *
+ * @return Mapped Framer (or NULL on error).
+ */
+static fr_map_t map_new( int fd, fr_map_head_s* head, int shm )
+{
+    fr_map_t map;
+
+    if ( head->max > ( SIZE_MAX - FR_MAP_HEAD ) / head->slot ||
+         ftruncate( fd, FR_MAP_HEAD + head->cnt * head->slot ) < 0 ||
+         io_write( fd, head, sizeof( fr_map_head_s ) ) < 0 ) {
+        close( fd );
+        return NULL;
+    }
+
+    map = map_mmap( fd, head, shm );
+    if ( map == NULL )
+        return NULL;
+
+    if ( shm ) {
+
+        /* Reader/writer lock for processes, preferring writers. */
+
+        pthread_rwlockattr_t attr;
+
+        pthread_rwlockattr_init( &attr );
+        pthread_rwlockattr_setpshared( &attr, PTHREAD_PROCESS_SHARED );
+#ifdef __GLIBC__
+        pthread_rwlockattr_setkind_np( &attr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP );
+#endif
+        pthread_rwlock_init( &( map->head->lock ), &attr );
+        pthread_rwlockattr_destroy( &attr );
+    }
+
+    /* File has room for the first Node. */
+    map->pos->seg = alloc_node( map->pos );
+    map->pos->ncnt = 1;
+    map_store( map );
+
+    return map;
+}
+
+
+/**
+ * Attach to existing Mapped Framer.
+ *
+ * Header is checked, also slot counts and indexes against the file
+ * size, and Nodes are not visited.
+ *
+ * @param fd  File descriptor.
+ * @param shm Shared memory if 1.
+ *
+ * @return Mapped Framer (or NULL on error).
+ */
+static fr_map_t map_attach( int fd, int shm )
+{
+    fr_map_t      map;
+    fr_map_head_s head;
+    struct stat   st;
+
+    if ( pread( fd, &head, sizeof( head ), 0 ) != sizeof( head ) ||
+         memcmp( head.magic, "FRMP", 4 ) != 0 || head.version != FR_FILE_VERSION ||
+         head.order != 0x01020304 || head.unit != FR_LINK_UNIT || head.node != FR_NODE_SIZE ||
+         head.item != FR_ITEM_SIZE || head.size < FR_SEG_MIN || head.size > INT32_MAX ||
+         head.slot != (uint64_t)node_alloc_bytes( head.size ) || head.max < 1 ||
+         head.max > ( SIZE_MAX - FR_MAP_HEAD ) / head.slot || head.cnt > head.max ||
+         head.top > head.cnt || head.first >= head.top || head.free > head.top ||
+         head.ncnt > head.top || fstat( fd, &st ) < 0 ||
+         (uint64_t)st.st_size < FR_MAP_HEAD + head.cnt * head.slot ) {
+        close( fd );
+        return NULL;
+    }
+
+    map = map_mmap( fd, &head, shm );
+    if ( map == NULL )
+        return NULL;
+
+    map_load( map );
+
+#ifdef FRAMER_USE_SNAPSHOTS
+    /* Nodes have generations from earlier snapshots. */
+    if ( !shm && map->head->gen > 0 ) {
+        map->pos->snap = fr_malloc( sizeof( fr_snap_dom_s ) );
+        memset( map->pos->snap, 0, sizeof( fr_snap_dom_s ) );
+        map->pos->snap->live = 1;
+        map->pos->snap->gen = map->head->gen;
+    }
+#endif
+
+    return map;
+}
+
+
+/**
+ * Map Framer file.
+ *
+ * @param fd   File descriptor.
+ * @param head File header.
+ * @param shm  Shared memory if 1.
+ *
+ * @return Mapped Framer (or NULL on error).
+ */
+static fr_map_t map_mmap( int fd, fr_map_head_s* head, int shm )
+{
+    fr_map_t map;
+    void*    base;
+    size_t   bytes;
+
+    bytes = FR_MAP_HEAD + head->max * head->slot;
+    base = mmap( NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_NORESERVE, fd, 0 );
+    if ( base == MAP_FAILED ) {
+        close( fd );
+        return NULL;
+    }
+
+    map = fr_malloc( sizeof( fr_map_s ) );
+    map->fd = fd;
+    map->shm = shm;
+    map->base = base;
+    map->bytes = bytes;
+    map->head = base;
+    map->pos = fr_pos_new_with_mem( NULL, head->size, map_alloc, map_free, map );
+
+    return map;
+}
+
+
+/**
+ * Load home Position from header.
+ *
+ * @param map Mapped Framer.
+ */
+static void map_load( fr_map_t map )
+{
+    fr_t pos = map->pos;
+
+    /* Nodes are used in place, i.e. they are paged in when visited. */
+    pos->seg = map_slot( map, map->head->first );
+    pos->idx = 0;
+    pos->icnt = map->head->icnt;
+    pos->ncnt = map->head->ncnt;
+    pos->bcnt = map->head->ncnt * node_bytes( pos->seg );
+}
+
+
+/**
+ * Store home Position to header.
+ *
+ * @param map Mapped Framer.
+ */
+static void map_store( fr_map_t map )
+{
+    fr_t pos = map->pos;
+
+    map->head->first = ( (char*)fn_first( pos->seg ) - map->base - FR_MAP_HEAD ) / map->head->slot;
+    map->head->icnt = pos->icnt;
+    map->head->ncnt = pos->ncnt;
+#ifdef FRAMER_USE_SNAPSHOTS
+    if ( pos->snap && !map->shm )
+        map->head->gen = pos->snap->gen;
+#endif
+}
+
+
+/**
+ * Grow Mapped Framer file.
+ *
+ * Slot count is doubled (upto maximum), or grown to need if more.
+ *
+ * @param map  Mapped Framer.
+ * @param need Required slot count.
+ *
+ * @return 0 on success, -1 if need exceeds maximum, or file can't grow.
+ */
+static int map_grow( fr_map_t map, fr_size_t need )
+{
+    fr_map_head_s* head = map->head;
+    fr_size_t      cnt = 2 * head->cnt;
+
+    if ( need > (fr_size_t)head->max )
+        return -1;
+
+    if ( cnt < need )
+        cnt = need;
+    if ( cnt > (fr_size_t)head->max )
+        cnt = head->max;
+
+    if ( ftruncate( map->fd, FR_MAP_HEAD + cnt * head->slot ) < 0 )
+        return -1;
+
+    head->cnt = cnt;
+
+    return 0;
+}
+
+
+/**
+ * Mapped Framer reserve function.
+ *
+ * Released slots are reused first. File is grown, when all slots are
+ * in use.
+ *
+ * @param pos Position.
+ * @param env Mapped Framer.
+ *
+ * @return Node (or NULL if maximum is reached, or file can't grow).
+ */
+static fn_t map_alloc( fr_t pos, void* env )
+{
+    fr_map_t       map = env;
+    fr_map_head_s* head = map->head;
+    fn_t           node;
+
+    (void)pos;
+
+    if ( head->free ) {
+
+        node = map_slot( map, head->free - 1 );
+        head->free = (uintptr_t)node->data[ 0 ];
+
+    } else {
+
+        if ( head->top >= head->cnt && map_grow( map, head->top + 1 ) < 0 )
+            return NULL;
+
+        node = map_slot( map, head->top );
+        head->top++;
+    }
+
+    fn_set_prev( node, NULL );
+    fn_set_next( node, NULL );
+    node->used = 0;
+    node->size = head->size;
+    node->data[ 0 ] = NULL;
+
+    return node;
+}
+
+
+/**
+ * Mapped Framer release function.
+ *
+ * Slot is linked to free list by slot index, stored to the first item.
+ *
+ * @param pos Position with Node to release.
+ * @param env Mapped Framer.
+ *
+ * @return NULL
+ */
+static fn_t map_free( fr_t pos, void* env )
+{
+    fr_map_t map = env;
+    fn_t     node = pos->seg;
+
+    pos->seg = fn_update( node );
+
+    node->data[ 0 ] = (void*)(uintptr_t)map->head->free;
+    map->head->free = ( (char*)node - map->base - FR_MAP_HEAD ) / map->head->slot + 1;
+
+    return NULL;
+}
+
+#endif
+
+
+/**
+ * Copy chunk of source Nodes to clone arena.
+ *
+ * @param arg Clone job.
+ *
+ * @return NULL
+ */
+static void* clone_run( void* arg )
+{
+    clone_job_t job = arg;
+    fr_size_t   size = job->arena->size;
+    fn_t        node;
+    fn_t        slot;
+
+    for ( fr_size_t i = job->a; i < job->b; i++ ) {
+
+        node = job->src[ i ];
+
+        if ( job->pack ) {
+
+            /* Slot used counts are set, only data is copied. */
+
+            fr_size_t off = job->base[ i ];
+            fr_size_t idx = 0;
+            fr_size_t n;
+
+            while ( idx < node->used ) {
+                slot = arena_slot( job->arena, off / size );
+                n = node->used - idx;
+                if ( n > size - off % size )
+                    n = size - off % size;
+                seg_copy( &( slot->data[ off % size ] ), node, idx, n );
+                idx += n;
+                off += n;
+            }
+
         } else {
-            return 0;
+
+            slot = arena_slot( job->arena, i );
+            seg_copy( slot->data, node, 0, node->used );
+            slot->used = node->used;
+        }
+    }
+
+    return NULL;
+}
+
+
+#ifdef FRAMER_USE_CURSORS
+
+/**
+ * Move cursors of n items from src at index a, to dst at index b.
+ *
+ * Item move is mirrored, hence cursors are updated after each
+ * memcpy/memmove of items.
+ *
+ * @param src Source Node.
+ * @param a   Source index.
+ * @param n   Item count.
+ * @param dst Destination Node (may be src).
+ * @param b   Destination index.
+ */
+static void cursor_move( fn_t src, fr_size_t a, fr_size_t n, fn_t dst, fr_size_t b )
+{
+    fr_cursor_t* ref = &( src->curs );
+    fr_cursor_t  cur;
+
+    while ( ( cur = *ref ) ) {
+
+        if ( cur->pos.idx >= a && cur->pos.idx < a + n ) {
+
+            cur->pos.idx += b - a;
+
+            if ( dst != src ) {
+                *ref = cur->next;
+                cur->pos.seg = dst;
+                cur->next = dst->curs;
+                dst->curs = cur;
+                continue;
+            }
         }
 
+        ref = &( cur->next );
+    }
+}
+
+
+/**
+ * Move all cursors of Node to dst at index.
+ *
+ * @param node Node.
+ * @param dst  Destination Node.
+ * @param idx  Destination index.
+ */
+static void cursor_rehome( fn_t node, fn_t dst, fr_size_t idx )
+{
+    fr_cursor_t cur;
+
+    while ( ( cur = node->curs ) ) {
+        node->curs = cur->next;
+        cur->pos.seg = dst;
+        cur->pos.idx = idx;
+        cur->next = dst->curs;
+        dst->curs = cur;
+    }
+}
+
+
+/**
+ * Register cursor to its Node.
+ *
+ * @param cur Cursor.
+ */
+static void cursor_link( fr_cursor_t cur )
+{
+    cur->next = cur->pos.seg->curs;
+    cur->pos.seg->curs = cur;
+}
+
+
+/**
+ * Unregister cursor from its Node.
+ *
+ * @param cur Cursor.
+ */
+static void cursor_unlink( fr_cursor_t cur )
+{
+    fr_cursor_t* ref = &( cur->pos.seg->curs );
+
+    while ( *ref != cur )
+        ref = &( ( *ref )->next );
+    *ref = cur->next;
+}
+
+#endif
+
+
+/**
+ * Return Node for queue tail (producer).
+ *
+ * Nodes before consumer head are consumed, and they are reused.
+ *
+ * @param queue Queue.
+ *
+ * @return Empty Node.
+ */
+static fn_t queue_node( fr_queue_t queue )
+{
+    fn_t node;
+
+    if ( queue->first == queue->seen )
+        queue->seen = __atomic_load_n( &( queue->head ), __ATOMIC_ACQUIRE );
+
+    if ( queue->first != queue->seen ) {
+        node = queue->first;
+        queue->first = fn_next( node );
+        fn_set_next( node, NULL );
+        node->used = 0;
     } else {
+        node = fn_new_sized( queue->size );
+    }
+
+    return node;
+}
+
+
+/**
+ * Return empty log Node with NULL slots.
+ *
+ * @param log Log.
+ *
+ * @return Node.
+ */
+static fn_t log_node( fr_log_t log )
+{
+    fn_t node;
+
+    node = fn_new_sized( log->size );
+    memset( node->data, 0, log->size * FR_ITEM_SIZE );
+
+    return node;
+}
+
+
+/**
+ * Set next Node, if Node is last, with compare-and-swap.
+ *
+ * @param node Node.
+ * @param peer Next Node.
+ *
+ * @return 1 if next was set, else 0.
+ */
+static int node_cas_next( fn_t node, fn_t peer )
+{
+    fn_link_t none = 0;
+    fn_link_t link;
+
+#ifdef FRAMER_COMPACT_LINKS
+    link = fn_link( node, peer );
+#else
+    link = peer;
+#endif
+
+    return __atomic_compare_exchange_n(
+        &( node->next ), &none, link, 0, __ATOMIC_RELEASE, __ATOMIC_RELAXED );
+}
+
+
+#ifdef FRAMER_USE_NODE_LOCKS
+
+/**
+ * Lock Node.
+ *
+ * @param node Node.
+ *
+ * @return 1 if locked, or 0 if Node is retired.
+ */
+static int node_lock( fn_t node )
+{
+    fr_size_t lock;
+
+    for ( ;; ) {
+        lock = 0;
+        if ( __atomic_compare_exchange_n(
+                 &( node->lock ), &lock, 1, 0, __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE ) )
+            return 1;
+        if ( lock == FR_LOCK_DEAD )
+            return 0;
+        while ( __atomic_load_n( &( node->lock ), __ATOMIC_RELAXED ) == 1 )
+            sched_yield();
+    }
+}
+
+
+/**
+ * Try to lock Node.
+ *
+ * @param node Node.
+ *
+ * @return 1 if locked, else 0.
+ */
+static int node_trylock( fn_t node )
+{
+    fr_size_t lock = 0;
+
+    return __atomic_compare_exchange_n(
+        &( node->lock ), &lock, 1, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED );
+}
+
+
+/**
+ * Unlock Node.
+ *
+ * @param node Node.
+ */
+static void node_unlock( fn_t node )
+{
+    __atomic_store_n( &( node->lock ), 0, __ATOMIC_RELEASE );
+}
+
+
+/**
+ * Lock Position Node.
+ *
+ * Position in Node retired by another thread is moved to the Node
+ * that followed it (or preceded it, if it was last). Links of retired
+ * Nodes are left intact for this, and they are not freed until
+ * fr_locked_reclaim().
+ *
+ * @param pos Position.
+ */
+static void lock_home( fr_t pos )
+{
+    fn_t node;
+
+    while ( !node_lock( pos->seg ) ) {
+        node = pos->seg;
+        if ( fn_next( node ) ) {
+            pos->seg = fn_next( node );
+            pos->idx = 0;
+        } else {
+            /* Clamped to the end. */
+            pos->seg = fn_prev( node );
+            pos->idx = INT64_MAX;
+        }
+    }
+}
+
+
+/**
+ * Lock Position Node and its peers.
+ *
+ * Current Node is locked first, which keeps its links stable. Previous
+ * Node is against the lock order, hence it is only tried. Next Node is
+ * in order. Peers of locked Node are never retired. Position index is
+ * clamped to the Node.
+ *
+ * @param pos Position.
+ */
+static void lock_peers( fr_t pos )
+{
+    fn_t node;
+    fn_t prev;
+
+    for ( ;; ) {
+        lock_home( pos );
+        node = pos->seg;
+        prev = fn_prev( node );
+        if ( prev == NULL || node_trylock( prev ) )
+            break;
+        node_unlock( node );
+        sched_yield();
+    }
+
+    if ( fn_next( node ) )
+        node_lock( fn_next( node ) );
+
+    if ( pos->idx > node->used )
+        pos->idx = node->used;
+}
+
+
+/**
+ * Unlock Nodes.
+ *
+ * @param prev Previous Node (or NULL).
+ * @param node Node (or NULL).
+ * @param next Next Node (or NULL).
+ */
+static void unlock_peers( fn_t prev, fn_t node, fn_t next )
+{
+    if ( next )
+        node_unlock( next );
+    if ( node )
+        node_unlock( node );
+    if ( prev )
+        node_unlock( prev );
+}
+
+
+/**
+ * Retire locked Node, whose last item is deleted.
+ *
+ * Node is unlinked and added to the retired Nodes of Position. Lock
+ * is left dead, hence threads waiting for it move on.
+ *
+ * @param pos  Position.
+ * @param node Node.
+ *
+ * @return Next Node (or previous, if Node was last).
+ */
+static fn_t retire_node( fr_t pos, fn_t node )
+{
+    fn_t ret;
+
+#ifdef FRAMER_USE_CURSORS
+    assert( node->curs == NULL );
+#endif
+
+    /* Epoch readers start from the next Node. */
+    if ( fn_prev( node ) == NULL && pos->mem && pos->mem->free == epoch_free ) {
+        fr_epoch_t epoch = pos->mem->env;
+        __atomic_store_n( &( epoch->first ), fn_next( node ), __ATOMIC_RELEASE );
+    }
+
+    pos->bcnt -= node_bytes( node );
+    ret = fn_update( node );
+
+    node->used = 0;
+    node->data[ 0 ] = pos->dead;
+    pos->dead = node;
+
+    __atomic_store_n( &( node->lock ), FR_LOCK_DEAD, __ATOMIC_RELEASE );
+
+    return ret;
+}
+
+#endif
+
+
+/**
+ * Epoch domain reserve function.
+ *
+ * @param pos Position.
+ * @param env Epoch domain.
+ *
+ * @return Node.
+ */
+static fn_t epoch_alloc( fr_t pos, void* env )
+{
+    fr_epoch_t epoch = env;
+
+    if ( epoch->parent.alloc )
+        return epoch->parent.alloc( pos, epoch->parent.env );
+    else
+        return fn_new_sized( pos->size );
+}
+
+
+/**
+ * Epoch domain release function.
+ *
+ * Node is unlinked and retired to the current epoch. Links of the
+ * Node are left intact for readers.
+ *
+ * @param pos Position with Node to release.
+ * @param env Epoch domain.
+ *
+ * @return NULL
+ */
+static fn_t epoch_free( fr_t pos, void* env )
+{
+    fr_epoch_t epoch = env;
+    fn_t       node = pos->seg;
+    int        list;
+
+    /* Retired Nodes of Node locks are already unlinked. */
+    if ( __atomic_load_n( &( epoch->first ), __ATOMIC_RELAXED ) == node )
+        __atomic_store_n( &( epoch->first ), fn_next( node ), __ATOMIC_RELEASE );
+
+    pos->seg = fn_update( node );
+
+    epoch_lock( epoch );
+
+    list = __atomic_load_n( &( epoch->epoch ), __ATOMIC_RELAXED ) % 3;
+    if ( epoch->rcnt[ list ] >= epoch->rcap[ list ] ) {
+        epoch->rcap[ list ] = epoch->rcap[ list ] ? 2 * epoch->rcap[ list ] : 16;
+        epoch->retired[ list ] =
+            fr_realloc( epoch->retired[ list ], epoch->rcap[ list ] * sizeof( fn_t ) );
+    }
+    epoch->retired[ list ][ epoch->rcnt[ list ]++ ] = node;
+
+    epoch_advance( epoch, pos );
+
+    epoch_unlock( epoch );
+
+    return NULL;
+}
+
+
+/**
+ * Epoch domain close function.
+ *
+ * All retired Nodes are freed, i.e. there must be no readers.
+ *
+ * @param pos Position.
+ * @param env Epoch domain.
+ *
+ * @return NULL
+ */
+static fn_t epoch_close( fr_t pos, void* env )
+{
+    fr_epoch_t     epoch = env;
+    fr_epoch_rec_t rec;
+    fr_epoch_rec_t next;
+
+    for ( int i = 0; i < 3; i++ ) {
+        epoch_flush( epoch, pos, i );
+        fr_free( epoch->retired[ i ] );
+    }
+
+    for ( rec = epoch->recs; rec; rec = next ) {
+        next = rec->next;
+        fr_free( rec );
+    }
+
+    if ( epoch->parent.close )
+        epoch->parent.close( pos, epoch->parent.env );
+
+    fr_free( epoch );
+
+    return NULL;
+}
+
+
+/**
+ * Lock epoch domain (writer side).
+ *
+ * @param epoch Epoch domain.
+ */
+static void epoch_lock( fr_epoch_t epoch )
+{
+    while ( __atomic_test_and_set( &( epoch->lock ), __ATOMIC_ACQUIRE ) )
+        sched_yield();
+}
+
+
+/**
+ * Unlock epoch domain (writer side).
+ *
+ * @param epoch Epoch domain.
+ */
+static void epoch_unlock( fr_epoch_t epoch )
+{
+    __atomic_clear( &( epoch->lock ), __ATOMIC_RELEASE );
+}
 
-        /* Small distance, go one by one. */
 
-        steps = 0;
+/**
+ * Advance global epoch, if all active readers have observed it.
+ *
+ * Nodes retired two epochs ago are freed, since readers can't refer
+ * to them anymore.
+ *
+ * @param epoch Epoch domain.
+ * @param pos   Position for parent Memory API.
+ */
+static void epoch_advance( fr_epoch_t epoch, fr_t pos )
+{
+    fr_epoch_rec_t rec;
+    fr_size_t      cur;
+    fr_size_t      state;
 
-        while ( steps < n ) {
-            if ( idx < seg->used - 1 ) {
-                idx++;
-                steps++;
-            } else {
-                if ( seg->next == NULL ) {
-                    return 0;
-                } else {
-                    seg = seg->next;
-                    idx = 0;
-                    steps++;
-                }
-            }
-        }
+    cur = __atomic_load_n( &( epoch->epoch ), __ATOMIC_RELAXED );
 
-        pos->idx = idx;
-        pos->seg = seg;
-        return n;
+    for ( rec = __atomic_load_n( &( epoch->recs ), __ATOMIC_ACQUIRE ); rec; rec = rec->next ) {
+        state = __atomic_load_n( &( rec->state ), __ATOMIC_SEQ_CST );
+        if ( ( state & 1 ) && ( state >> 1 ) != cur )
+            return;
     }
+
+    __atomic_store_n( &( epoch->epoch ), cur + 1, __ATOMIC_SEQ_CST );
+
+    /* List of the new epoch has Nodes from epoch cur - 2. */
+    epoch_flush( epoch, pos, ( cur + 1 ) % 3 );
 }
 
 
-fr_size_t fr_next( fr_t pos )
+/**
+ * Free retired Nodes of list.
+ *
+ * @param epoch Epoch domain.
+ * @param pos   Position for parent Memory API.
+ * @param list  List index.
+ */
+static void epoch_flush( fr_epoch_t epoch, fr_t pos, int list )
 {
-    if ( pos->idx < pos->seg->used - 1 ) {
+    fn_t node;
 
-        pos->idx++;
-        return 1;
+    for ( fr_size_t i = 0; i < epoch->rcnt[ list ]; i++ ) {
 
-    } else {
+        node = epoch->retired[ list ][ i ];
 
-        if ( pos->seg->next == NULL ) {
-            return 0;
+        /* Node is already unlinked. */
+        fn_set_prev( node, NULL );
+        fn_set_next( node, NULL );
+
+        if ( epoch->parent.alloc ) {
+            fr_s tmp = *pos;
+            tmp.seg = node;
+            epoch->parent.free( &tmp, epoch->parent.env );
         } else {
-            /* Step to next segment. */
-            pos->seg = pos->seg->next;
-            pos->idx = 0;
-            return 1;
+            node_free( node, node_alloc_bytes( node->size ) );
         }
     }
+
+    epoch->rcnt[ list ] = 0;
 }
 
 
-fr_size_t fr_prev_n( fr_t pos, fr_size_t n )
-{
-    fr_size_t steps;
-    fn_t      seg = pos->seg;
-    fr_size_t idx = pos->idx;
+#ifdef FRAMER_USE_SNAPSHOTS
 
-    if ( n > pos->size ) {
+/**
+ * Save Node content to the snapshots that see it.
+ *
+ * Node content is copied once, and the copy is shared by all
+ * snapshots taken after the previous save of the Node. Node
+ * generation is updated, hence Node is saved only on its first
+ * modification after a snapshot.
+ *
+ * @param dom  Snapshot domain.
+ * @param node Node to be modified.
+ */
+static void snap_save( fr_snap_dom_t dom, fn_t node )
+{
+    fr_snap_t  snap;
+    fn_t       copy = NULL;
+    fr_size_t* ref = NULL;
+    fr_size_t  bytes;
+
+    snap_lock( dom );
+
+    for ( snap = dom->snaps; snap && snap->gen > node->gen; snap = snap->next ) {
+
+        if ( copy == NULL ) {
+            bytes = FR_NODE_SIZE + node->used * FR_ITEM_SIZE;
+            ref = fr_malloc_aligned( node_align(), node_align() + align_up( bytes, node_align() ) );
+            *ref = 0;
+            copy = (fn_t)( (char*)ref + node_align() );
+            memcpy( copy, node, FR_NODE_SIZE );
+            seg_copy( copy->data, node, 0, node->used );
+#ifdef FRAMER_USE_GAPS
+            /* Copy is contiguous. */
+            copy->gap = 0;
+#endif
+        }
 
-        /* Fast backwards with segment stepping. */
+        ( *ref )++;
+        snap_put( snap, node, copy );
+    }
 
-        steps = n - idx;
-        idx = 0;
+    node->gen = dom->gen;
 
-        while ( seg->prev && steps >= seg->prev->used ) {
-            seg = seg->prev;
-            steps -= seg->used;
-        }
+    snap_unlock( dom );
+}
 
-        if ( steps == 0 ) {
 
-            pos->seg = seg;
-            pos->idx = 0;
-            return n;
+/**
+ * Lock snapshot domain.
+ *
+ * @param dom Snapshot domain.
+ */
+static void snap_lock( fr_snap_dom_t dom )
+{
+    while ( __atomic_test_and_set( &( dom->lock ), __ATOMIC_ACQUIRE ) )
+        sched_yield();
+}
 
-        } else if ( seg->prev ) {
 
-            seg = seg->prev;
-            pos->idx = ( seg->used - steps );
-            pos->seg = seg;
-            return n;
+/**
+ * Unlock snapshot domain.
+ *
+ * @param dom Snapshot domain.
+ */
+static void snap_unlock( fr_snap_dom_t dom )
+{
+    __atomic_clear( &( dom->lock ), __ATOMIC_RELEASE );
+}
 
-        } else {
-            return 0;
-        }
 
-    } else {
+/**
+ * Detach snapshot domain from Framer to be destroyed.
+ *
+ * All Nodes are saved, hence snapshots remain valid without Framer.
+ *
+ * @param pos Position.
+ */
+static void snap_detach( fr_t pos )
+{
+    fr_snap_dom_t dom = pos->snap;
+    int           orphan;
 
-        /* Small distance, go one by one. */
+    for ( fn_t node = fn_first( pos->seg ); node; node = fn_next( node ) )
+        snap_touch( pos, node );
 
-        steps = 0;
+    snap_lock( dom );
+    dom->live = 0;
+    orphan = dom->snaps == NULL;
+    snap_unlock( dom );
 
-        while ( steps < n ) {
-            if ( idx > 0 ) {
-                idx--;
-                steps++;
-            } else {
-                if ( seg->prev == NULL ) {
-                    return 0;
-                } else {
-                    seg = seg->prev;
-                    idx = seg->used - 1;
-                    steps++;
-                }
-            }
-        }
+    if ( orphan )
+        fr_free( dom );
 
-        pos->idx = idx;
-        pos->seg = seg;
-        return n;
-    }
+    pos->snap = NULL;
 }
 
 
-fr_size_t fr_prev( fr_t pos )
+/**
+ * Add Node copy to snapshot.
+ *
+ * @param snap Snapshot.
+ * @param node Original Node.
+ * @param copy Node copy.
+ */
+static void snap_put( fr_snap_t snap, fn_t node, fn_t copy )
 {
-    if ( pos->idx > 0 ) {
+    fr_size_t i;
 
-        pos->idx--;
-        return 1;
+    if ( 2 * ( snap->cnt + 1 ) > snap->cap ) {
 
-    } else {
+        /* Grow table and rehash. */
 
-        if ( pos->seg->prev == NULL )
-            return 0;
+        fn_p      keys = snap->keys;
+        fn_p      vals = snap->vals;
+        fr_size_t cap = snap->cap;
 
-        pos->seg = pos->seg->prev;
-        pos->idx = pos->seg->used - 1;
-        return 1;
+        snap->cap = cap ? 2 * cap : 16;
+        snap->keys = fr_malloc( snap->cap * sizeof( fn_t ) );
+        snap->vals = fr_malloc( snap->cap * sizeof( fn_t ) );
+        memset( snap->keys, 0, snap->cap * sizeof( fn_t ) );
+
+        for ( fr_size_t k = 0; k < cap; k++ ) {
+            if ( keys[ k ] ) {
+                i = snap_hash( keys[ k ], snap->cap );
+                while ( snap->keys[ i ] )
+                    i = ( i + 1 ) & ( snap->cap - 1 );
+                snap->keys[ i ] = keys[ k ];
+                snap->vals[ i ] = vals[ k ];
+            }
+        }
+
+        fr_free( keys );
+        fr_free( vals );
     }
+
+    i = snap_hash( node, snap->cap );
+    while ( snap->keys[ i ] )
+        i = ( i + 1 ) & ( snap->cap - 1 );
+
+    snap->keys[ i ] = node;
+    snap->vals[ i ] = copy;
+    snap->cnt++;
 }
 
 
-void* fr_next_item( fr_t pos )
+/**
+ * Return Node copy of snapshot.
+ *
+ * @param snap Snapshot.
+ * @param node Original Node.
+ *
+ * @return Node copy (or NULL if Node is shared).
+ */
+static fn_t snap_get( fr_snap_t snap, fn_t node )
 {
-    if ( fr_next( pos ) == 0 ) {
-        pos->seg = NULL;
+    fr_size_t i;
+
+    if ( snap->cnt == 0 )
         return NULL;
-    } else {
-        return pos->seg->data[ pos->idx ];
+
+    i = snap_hash( node, snap->cap );
+    while ( snap->keys[ i ] ) {
+        if ( snap->keys[ i ] == node )
+            return snap->vals[ i ];
+        i = ( i + 1 ) & ( snap->cap - 1 );
     }
+
+    return NULL;
 }
 
 
-fr_s fr_first( fr_t pos )
+/**
+ * Hash Node address to table index.
+ *
+ * @param node Node.
+ * @param cap  Table capacity (power of 2).
+ *
+ * @return Index.
+ */
+static fr_size_t snap_hash( fn_t node, fr_size_t cap )
 {
-    fr_s tmp = *pos;
+    uint64_t h = (uintptr_t)node / FR_CACHE_LINE_SIZE;
 
-    while ( tmp.seg->prev )
-        tmp.seg = tmp.seg->prev;
-    tmp.idx = 0;
+    h *= 0x9e3779b97f4a7c15ULL;
 
-    return tmp;
+    return (fr_size_t)( h >> 32 ) & ( cap - 1 );
 }
 
+#endif
 
-fr_s fr_last( fr_t pos )
+
+/**
+ * Move Small Framer from inline segment to normal Framer.
+ *
+ * @param sm Small Framer.
+ */
+static void small_grow( fr_small_t sm )
 {
-    fr_s tmp = *pos;
+    fr_t pos;
 
-    while ( tmp.seg->next )
-        tmp.seg = tmp.seg->next;
-    tmp.idx = tmp.seg->used - 1;
+    pos = fr_create();
+    for ( fr_size_t i = 0; i < sm->used; i++ )
+        fr_push( pos, sm->data[ i ] );
 
-    return tmp;
+    sm->pos = pos;
+    sm->used = 0;
 }
 
 
-void fr_to_first( fr_t pos )
+/**
+ * Move Small Framer from normal Framer back to inline segment.
+ *
+ * @param sm Small Framer.
+ */
+static void small_shrink( fr_small_t sm )
 {
-    *pos = fr_first( pos );
-}
+    fr_t pos = sm->pos;
+    fn_t seg;
 
+    sm->used = 0;
+    for ( seg = fn_first( pos->seg ); seg; seg = fn_next( seg ) ) {
+        seg_copy( &( sm->data[ sm->used ] ), seg, 0, seg->used );
+        sm->used += seg->used;
+    }
 
-void fr_to_last( fr_t pos )
-{
-    *pos = fr_last( pos );
+    sm->pos = NULL;
+    fr_destroy( pos );
 }
 
 
-int fr_at_first( fr_t pos )
+/**
+ * Set Position to Framer item index.
+ *
+ * Index equal to Framer length refers to the end of last Node.
+ *
+ * @param pos Position.
+ * @param idx Item index.
+ */
+static void small_seek( fr_t pos, fr_size_t idx )
 {
-    if ( pos->seg && pos->seg->prev == NULL && pos->idx == 0 )
-        return fr_true;
-    else
-        return fr_false;
-}
+    fn_t seg = fn_first( pos->seg );
 
+    while ( idx >= seg->used && fn_next( seg ) ) {
+        idx -= seg->used;
+        seg = fn_next( seg );
+    }
 
-int fr_at_last( fr_t pos )
-{
-    if ( pos->seg && pos->seg->next == NULL && pos->idx == pos->seg->used - 1 )
-        return fr_true;
-    else
-        return fr_false;
+    pos->seg = seg;
+    pos->idx = idx;
 }
 
 
-void* fr_item( fr_t pos )
-{
-    return pos->seg->data[ pos->idx ];
-}
 
+#ifdef FRAMER_COMPACT_LINKS
 
-void* fr_item_at( fr_t pos, fr_size_t idx )
-{
-    if ( idx < pos->seg->used )
-        return pos->seg->data[ idx ];
-    else
-        return NULL;
-}
+/* ------------------------------------------------------------
+ * Node space:
+ * ------------------------------------------------------------ */
 
+/*
+ * With compact links all Nodes are reserved from one process wide
+ * virtual memory reservation, Node space, so that links between any
+ * Nodes are in range. Memory is committed lazily by the OS, as pages
+ * are touched.
+ *
+ * Small blocks are recycled through exact size free lists. Large
+ * blocks are recycled through address ordered free list with
+ * coalescing. Whole pages of large free runs are returned to the OS,
+ * and committed again when reused.
+ */
 
-int fr_is_valid( fr_t pos )
+/** Count of exact size classes (in units). */
+#define SPACE_CLASSES 64
+
+/** Free run size, from which pages are returned to the OS. */
+#define SPACE_RELEASE ( (fr_size_t)1 << 20 )
+
+/** Free block in large free list. */
+typedef struct space_extent_s
 {
-    return ( pos->seg != NULL );
+    struct space_extent_s* next;  /**< Next free block. */
+    fr_size_t              units; /**< Block size in units. */
+} space_extent_s;
+
+/** Node space. */
+static struct
+{
+    char*           base;                        /**< Reservation. */
+    fr_size_t       unit;                        /**< Allocation unit. */
+    fr_size_t       page;                        /**< OS page size. */
+    fr_size_t       size;                        /**< Reserved bytes. */
+    fr_size_t       top;                         /**< Bump offset. */
+    void*           free[ SPACE_CLASSES + 1 ];   /**< Free lists by unit count. */
+    space_extent_s* large;                       /**< Free large blocks. */
+    char            lock;                        /**< Spinlock. */
+} space;
+
+
+static void space_lock( void )
+{
+    while ( __atomic_test_and_set( &space.lock, __ATOMIC_ACQUIRE ) )
+        ;
 }
 
 
+static void space_unlock( void )
+{
+    __atomic_clear( &space.lock, __ATOMIC_RELEASE );
+}
 
-/* ------------------------------------------------------------
- * Framer node:
- * ------------------------------------------------------------ */
 
-fn_t fn_new_sized( fr_size_t size )
+static int space_init( void )
 {
-    fn_t node;
+    fr_size_t size = FR_LINK_SPACE;
+    void*     base = MAP_FAILED;
+
+    /* Use smaller reservation, if OS does not allow the full. */
+    while ( size >= ( (fr_size_t)1 << 24 ) ) {
+        base = mmap( NULL,
+                     size,
+                     PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE,
+                     -1,
+                     0 );
+        if ( base != MAP_FAILED )
+            break;
+        size /= 2;
+    }
 
-    assert( size >= FR_SEG_MIN );
+    if ( base == MAP_FAILED )
+        return -1;
 
-    node = fr_malloc( FR_NODE_SIZE + size * FR_ITEM_SIZE );
-    node->prev = NULL;
-    node->next = NULL;
-    node->used = 0;
-    node->data[ 0 ] = NULL;
+    space.unit = node_align();
+    space.page = sysconf( _SC_PAGESIZE );
+    space.size = size;
+    space.top = 0;
+    space.large = NULL;
+    space.base = base;
 
-    return node;
+    return 0;
 }
 
 
-fn_t fn_first( fn_t node )
+/** Return whole pages of free run to the OS, keeping run header. */
+static void space_release( space_extent_s* blk )
 {
-    while ( node->prev != NULL )
-        node = node->prev;
+    uintptr_t a = (uintptr_t)( blk + 1 );
+    uintptr_t b = (uintptr_t)blk + blk->units * space.unit;
 
-    return node;
+    if ( blk->units * space.unit < SPACE_RELEASE )
+        return;
+
+    a = align_up( a, (uintptr_t)space.page );
+    b = b / space.page * space.page;
+    if ( a < b )
+        madvise( (void*)a, b - a, MADV_DONTNEED );
 }
 
 
-fn_t fn_append( fn_t anchor, fn_t node )
+static void* space_alloc( fr_size_t bytes )
 {
-    if ( anchor->next == NULL ) {
-        node->prev = anchor;
-        anchor->next = node;
-    } else {
-        anchor->next->prev = node;
-        node->next = anchor->next;
-        anchor->next = node;
-        node->prev = anchor;
+    fr_size_t        units;
+    void*            ret = NULL;
+    space_extent_s** ext;
+
+    space_lock();
+
+    if ( space.base == NULL && space_init() ) {
+        space_unlock();
+        return NULL;
     }
 
-    return node;
-}
+    units = bytes / space.unit;
 
+    if ( units <= SPACE_CLASSES && space.free[ units ] ) {
 
-fn_t fn_update( fn_t node )
-{
-    fn_t ret;
+        ret = space.free[ units ];
+        space.free[ units ] = *(void**)ret;
 
-    if ( node->prev && node->next ) {
-        node->prev->next = node->next;
-        node->next->prev = node->prev;
-        ret = node->next;
-    } else if ( node->prev ) {
-        node->prev->next = NULL;
-        ret = node->prev;
-    } else if ( node->next ) {
-        node->next->prev = NULL;
-        ret = node->next;
-    } else {
-        ret = NULL;
+    } else if ( units > SPACE_CLASSES ) {
+
+        /* First fit, and split the rest. */
+        for ( ext = &space.large; *ext; ext = &( ( *ext )->next ) ) {
+            if ( ( *ext )->units >= units ) {
+                ret = *ext;
+                if ( ( *ext )->units > units ) {
+                    space_extent_s* rest = (space_extent_s*)( (char*)ret + bytes );
+                    rest->next = ( *ext )->next;
+                    rest->units = ( *ext )->units - units;
+                    *ext = rest;
+                } else {
+                    *ext = ( *ext )->next;
+                }
+                break;
+            }
+        }
     }
 
+    if ( ret == NULL && bytes <= space.size - space.top ) {
+        ret = space.base + space.top;
+        space.top += bytes;
+    }
+
+    space_unlock();
+
     return ret;
 }
 
 
-fn_t fn_delete( fn_t node )
+static void space_free( void* ptr, fr_size_t bytes )
 {
-    fn_t ret;
+    fr_size_t        units;
+    space_extent_s*  blk = ptr;
+    space_extent_s** ext;
 
-    ret = fn_update( node );
-    fr_free( node );
+    space_lock();
 
-    return ret;
-}
+    units = bytes / space.unit;
 
+    if ( units <= SPACE_CLASSES ) {
 
-/* ------------------------------------------------------------
- * Internal functions:
- * ------------------------------------------------------------ */
+        *(void**)ptr = space.free[ units ];
+        space.free[ units ] = ptr;
 
-static fn_t alloc_node( fr_t pos )
-{
-    if ( pos->mem )
-        return memapi_alloc( pos );
-    else
-        return fn_new_sized( pos->size );
+    } else {
+
+        /* Address order insert, and join with peers. */
+        for ( ext = &space.large; *ext && *ext < blk; ext = &( ( *ext )->next ) )
+            ;
+
+        blk->units = units;
+        blk->next = *ext;
+        *ext = blk;
+
+        if ( blk->next && (char*)blk + blk->units * space.unit == (char*)blk->next ) {
+            blk->units += blk->next->units;
+            blk->next = blk->next->next;
+        }
+
+        if ( ext != &space.large ) {
+            space_extent_s* prev;
+            prev = (space_extent_s*)( (char*)ext - offsetof( space_extent_s, next ) );
+            if ( (char*)prev + prev->units * space.unit == (char*)blk ) {
+                prev->units += blk->units;
+                prev->next = blk->next;
+                blk = prev;
+            }
+        }
+
+        space_release( blk );
+    }
+
+    space_unlock();
 }
+
+#endif
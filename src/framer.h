@@ -21,25 +21,85 @@ extern const char* framer_version;
  * ------------------------------------------------------------ */
 
 #ifndef FR_CACHE_LINE_SIZE
-/** Default to 64 byte cache line size. */
+/** Default to 64 byte cache line size (when not detected at runtime). */
 #define FR_CACHE_LINE_SIZE 64
 #endif
 
 /** Alignment directive. */
 #define FR_CACHE_LINE_ALIGN __attribute__( ( aligned( FR_CACHE_LINE_SIZE ) ) )
 
+#ifdef FRAMER_USE_CURSORS
+/** Size of Node cursor list. */
+#define FR_NODE_CURS_SIZE sizeof( void* )
+#else
+#define FR_NODE_CURS_SIZE 0
+#endif
+
+#ifdef FRAMER_USE_NODE_LOCKS
+/** Size of Node lock. */
+#define FR_NODE_LOCK_SIZE sizeof( fr_size_t )
+#else
+#define FR_NODE_LOCK_SIZE 0
+#endif
+
+#ifdef FRAMER_USE_SNAPSHOTS
+/** Size of Node snapshot generation. */
+#define FR_NODE_SNAP_SIZE sizeof( fr_size_t )
+#else
+#define FR_NODE_SNAP_SIZE 0
+#endif
+
+#ifdef FRAMER_USE_DIRTY
+/** Size of Node dirty flag. */
+#define FR_NODE_DIRTY_SIZE sizeof( fr_size_t )
+#else
+#define FR_NODE_DIRTY_SIZE 0
+#endif
+
+#ifdef FRAMER_USE_GAPS
+/** Size of Node gap position. */
+#define FR_NODE_GAP_SIZE sizeof( fr_size_t )
+#else
+#define FR_NODE_GAP_SIZE 0
+#endif
+
 /** Size of Framer node without data segment. */
-#define FR_NODE_SIZE ( 2 * sizeof( void* ) + sizeof( fr_size_t ) )
+#define FR_NODE_SIZE                                                                   \
+    ( 2 * sizeof( fn_link_t ) + 2 * sizeof( fn_size_t ) + FR_NODE_CURS_SIZE + \
+      FR_NODE_LOCK_SIZE + FR_NODE_SNAP_SIZE + FR_NODE_DIRTY_SIZE + FR_NODE_GAP_SIZE )
+
+#ifdef FRAMER_COMPACT_LINKS
+
+/** Node link offset unit, i.e. Node alignment. */
+#define FR_LINK_UNIT FR_CACHE_LINE_SIZE
+
+#ifndef FR_LINK_SPACE
+/** Node space reservation, within link range (64 GiB). */
+#define FR_LINK_SPACE ( (fr_size_t)1 << 36 )
+#endif
+
+#endif
 
 /** Size of item. */
 #define FR_ITEM_SIZE ( sizeof( void* ) )
 
+/** Framer file format version. */
+#define FR_FILE_VERSION 1
+
 /** Mininum size of data segment. */
 #define FR_SEG_MIN 4
 
 /** Default size for segment, i.e. fit complete node to cache line. */
 #define FR_SEG_DEFAULT ( ( FR_CACHE_LINE_SIZE - FR_NODE_SIZE ) / FR_ITEM_SIZE )
 
+/** Number of fill level bins in statistics (excluding full). */
+#define FR_STATS_BINS 8
+
+#ifndef FR_SMALL_SIZE
+/** Inline segment size for Small Framer, i.e. fit Small Framer to cache line. */
+#define FR_SMALL_SIZE ( ( FR_CACHE_LINE_SIZE - 2 * sizeof( void* ) ) / FR_ITEM_SIZE )
+#endif
+
 
 
 /* ------------------------------------------------------------
@@ -49,16 +109,62 @@ extern const char* framer_version;
 /** Unsigned size type. */
 typedef int64_t fr_size_t;
 
+/** Node segment count type. */
+typedef int32_t fn_size_t;
+
+
+#ifdef FRAMER_COMPACT_LINKS
+
+/*
+ * FRAMER_COMPACT_LINKS selects compact Node layout, where Node links
+ * are 32-bit offsets, in FR_LINK_UNIT units, relative to the Node
+ * itself. Zero offset is NULL. Node header is then 16 bytes, instead
+ * of 24 bytes.
+ *
+ * Linked Nodes must be within 2^31 link units from each other, which
+ * is true for Nodes in the same arena. Framer with all Nodes in one
+ * arena is relocatable, since links don't depend on the arena
+ * address.
+ */
+
+/** Node link type. */
+typedef int32_t fn_link_t;
+
+#else
+
+/** Node link type. */
+typedef struct fn_struct_s* fn_link_t;
+
+#endif
+
+
+struct fr_cursor_struct_s;
 
 /**
  * Framer node.
  */
 struct fn_struct_s
 {
-    struct fn_struct_s* prev;      /**< Previous node. */
-    struct fn_struct_s* next;      /**< Next node. */
-    fr_size_t           used;      /**< Used count for data. */
-    void*               data[ 0 ]; /**< Pointer array. */
+    fn_link_t prev; /**< Previous node. */
+    fn_link_t next; /**< Next node. */
+    fn_size_t used; /**< Used count for data. */
+    fn_size_t size; /**< Segment size (capacity). */
+#ifdef FRAMER_USE_NODE_LOCKS
+    fr_size_t lock; /**< Node spinlock. */
+#endif
+#ifdef FRAMER_USE_SNAPSHOTS
+    fr_size_t gen; /**< Snapshot generation of Node content. */
+#endif
+#ifdef FRAMER_USE_DIRTY
+    fr_size_t dirty; /**< Node index at checkpoint (-1 if changed). */
+#endif
+#ifdef FRAMER_USE_GAPS
+    fr_size_t gap; /**< Item count after segment gap (0 if closed). */
+#endif
+#ifdef FRAMER_USE_CURSORS
+    struct fr_cursor_struct_s* curs; /**< Cursors registered to Node. */
+#endif
+    void* data[ 0 ]; /**< Pointer array. */
 } FR_CACHE_LINE_ALIGN;
 typedef struct fn_struct_s fn_s; /**< Node struct. */
 typedef fn_s*              fn_t; /**< Node. */
@@ -66,6 +172,7 @@ typedef fn_t*              fn_p; /**< Node reference. */
 
 
 struct fr_mem_struct_s;
+struct fr_snap_dom_struct_s;
 
 /**
  * Framer position.
@@ -74,16 +181,202 @@ struct fr_struct_s
 {
     fn_t                    seg;  /**< Segment. */
     fr_size_t               idx;  /**< Segment index. */
-    fr_size_t               size; /**< Segment size. */
+    fr_size_t               size; /**< Segment size (for new Nodes). */
+    fr_size_t               max;  /**< Adaptive segment size limit (0 if fixed). */
     fr_size_t               icnt; /**< Framer item count. */
     fr_size_t               ncnt; /**< Framer node count. */
+    fr_size_t               bcnt; /**< Framer Node byte count. */
     struct fr_mem_struct_s* mem;  /**< Memory API. */
+#ifdef FRAMER_USE_SNAPSHOTS
+    struct fr_snap_dom_struct_s* snap; /**< Snapshot domain (or NULL). */
+#endif
+#ifdef FRAMER_USE_NODE_LOCKS
+    fn_t dead; /**< Nodes retired by locked delete. */
+#endif
 } FR_CACHE_LINE_ALIGN;
 typedef struct fr_struct_s fr_s; /**< Position struct. */
 typedef fr_s*              fr_t; /**< Position. */
 typedef fr_t*              fr_p; /**< Position reference. */
 
 
+/**
+ * Framer statistics.
+ *
+ * Fill histogram bin for Node is: used * FR_STATS_BINS / size. Last
+ * bin counts full Nodes.
+ */
+struct fr_stats_struct_s
+{
+    fr_size_t nodes;                     /**< Node count. */
+    fr_size_t items;                     /**< Item count. */
+    fr_size_t slots;                     /**< Segment capacity, in items. */
+    fr_size_t bytes;                     /**< Node bytes, including headers and padding. */
+    fr_size_t header;                    /**< Node header bytes. */
+    fr_size_t under;                     /**< Count of Nodes under half full. */
+    double    under_ratio;               /**< Fraction of Nodes under half full. */
+    fr_size_t fill[ FR_STATS_BINS + 1 ]; /**< Node fill level histogram. */
+};
+typedef struct fr_stats_struct_s fr_stats_s; /**< Statistics struct. */
+typedef fr_stats_s*              fr_stats_t; /**< Statistics. */
+
+
+/**
+ * Small Framer.
+ *
+ * Small Framer is embedded to the owning struct. Items are stored to
+ * the inline segment, and no Nodes exist, until the inline segment
+ * overflows. Small Framer is then moved to a normal Framer. Zeroed
+ * Small Framer is empty and allocates nothing.
+ */
+struct fr_small_struct_s
+{
+    fr_t      pos;                   /**< Framer (or NULL when inline). */
+    fr_size_t used;                  /**< Inline item count. */
+    void*     data[ FR_SMALL_SIZE ]; /**< Inline segment. */
+};
+typedef struct fr_small_struct_s fr_small_s; /**< Small Framer struct. */
+typedef fr_small_s*              fr_small_t; /**< Small Framer. */
+
+
+#ifdef FRAMER_USE_CURSORS
+
+/*
+ * FRAMER_USE_CURSORS enables registered cursors. Each Node has a list
+ * of cursors referring to its items, and the cursors are fixed up
+ * when items are moved between Nodes, or Nodes are released. Node
+ * header is one pointer larger.
+ */
+
+/**
+ * Framer cursor.
+ *
+ * Cursor is a Position that remains referring to the same item,
+ * although items are moved by Framer operations.
+ */
+struct fr_cursor_struct_s
+{
+    fr_s                       pos;  /**< Position. */
+    struct fr_cursor_struct_s* next; /**< Next cursor in Node. */
+};
+typedef struct fr_cursor_struct_s fr_cursor_s; /**< Cursor struct. */
+typedef fr_cursor_s*              fr_cursor_t; /**< Cursor. */
+
+#endif
+
+
+/**
+ * Framer queue.
+ *
+ * Single-producer/single-consumer queue of Node segments. Producer
+ * and consumer fields are on separate cache lines.
+ */
+struct fr_queue_struct_s
+{
+    fn_t      head;                     /**< Consumer Node. */
+    fr_size_t idx;                      /**< Consumer index in Node. */
+    fn_t      tail FR_CACHE_LINE_ALIGN; /**< Producer Node. */
+    fn_t      first;                    /**< Oldest Node, reused when consumed. */
+    fn_t      seen;                     /**< Consumer Node, as last seen by producer. */
+    fr_size_t size;                     /**< Segment size. */
+};
+typedef struct fr_queue_struct_s fr_queue_s; /**< Queue struct. */
+typedef fr_queue_s*              fr_queue_t; /**< Queue. */
+
+
+/**
+ * Framer log.
+ *
+ * Framer with concurrent append from multiple producers.
+ */
+struct fr_log_struct_s
+{
+    fn_t      first; /**< First Node. */
+    fn_t      tail;  /**< Tail Node. */
+    fr_size_t size;  /**< Segment size. */
+};
+typedef struct fr_log_struct_s fr_log_s; /**< Log struct. */
+typedef fr_log_s*              fr_log_t; /**< Log. */
+
+
+struct fr_sync_struct_s;
+typedef struct fr_sync_struct_s fr_sync_s; /**< Shared Framer struct. */
+typedef fr_sync_s*              fr_sync_t; /**< Shared Framer (opaque). */
+
+
+#ifdef FRAMER_COMPACT_LINKS
+struct fr_map_struct_s;
+typedef struct fr_map_struct_s fr_map_s; /**< Mapped Framer struct. */
+typedef fr_map_s*              fr_map_t; /**< Mapped Framer (opaque). */
+#endif
+
+
+#ifdef FRAMER_USE_SNAPSHOTS
+
+/*
+ * FRAMER_USE_SNAPSHOTS enables copy-on-write snapshots. Each Node
+ * records the snapshot generation of its content, and Position refers
+ * to the snapshot domain of the Framer. Node header is one size word
+ * larger.
+ */
+
+struct fr_snap_struct_s;
+typedef struct fr_snap_struct_s fr_snap_s; /**< Snapshot struct. */
+typedef fr_snap_s*              fr_snap_t; /**< Snapshot (opaque). */
+
+/**
+ * Snapshot reader.
+ *
+ * Reader copies snapshot content one Node segment at a time.
+ */
+struct fr_snap_iter_struct_s
+{
+    fr_snap_t snap;  /**< Snapshot. */
+    fn_t      node;  /**< Next Node to read (or NULL at end). */
+    void**    items; /**< Items of the last read segment. */
+    fr_size_t cap;   /**< Item buffer capacity. */
+};
+typedef struct fr_snap_iter_struct_s fr_snap_iter_s; /**< Snapshot reader struct. */
+typedef fr_snap_iter_s*              fr_snap_iter_t; /**< Snapshot reader. */
+
+#endif
+
+
+#ifdef FRAMER_USE_DIRTY
+
+/*
+ * FRAMER_USE_DIRTY enables dirty Node tracking for incremental
+ * checkpoints. Each Node records its index at the last checkpoint,
+ * or that its items or links have changed. Node header is one size
+ * word larger.
+ */
+
+/**
+ * Dirty Node entry.
+ */
+struct fr_dirty_struct_s
+{
+    fn_t      node;  /**< Dirty Node. */
+    fr_size_t ord;   /**< Node index in Framer. */
+    fr_size_t first; /**< Item index of first Node item. */
+};
+typedef struct fr_dirty_struct_s fr_dirty_s; /**< Dirty Node entry struct. */
+typedef fr_dirty_s*              fr_dirty_t; /**< Dirty Node entry. */
+
+#endif
+
+
+#ifdef FRAMER_USE_GAPS
+
+/*
+ * FRAMER_USE_GAPS enables segment gaps. Free slots of a Node segment
+ * form a gap, which is moved to the insert or delete index, hence
+ * clustered inserts and deletes move only the items between edits.
+ * Node header is one size word larger.
+ */
+
+#endif
+
+
 /**
  * Framer data compare.
  *
@@ -94,6 +387,48 @@ typedef fr_t*              fr_p; /**< Position reference. */
 typedef int ( *fr_cmp_f )( void* a, void* b );
 
 
+/**
+ * Framer data hash.
+ *
+ * Equal items must have equal hash.
+ */
+typedef fr_size_t ( *fr_hash_f )( void* item );
+
+
+/**
+ * Framer item output.
+ */
+typedef void ( *fr_emit_f )( void* ctx, void* item );
+
+
+/**
+ * Framer item encode.
+ *
+ * Item is encoded to buffer of given size. Encoded size is
+ * returned. If encoded size is larger than buffer, encode is called
+ * again with a larger buffer.
+ */
+typedef fr_size_t ( *fr_encode_f )( void* item, void* buf, fr_size_t size );
+
+
+/**
+ * Framer item decode.
+ *
+ * Item is decoded from buffer of given size, and returned.
+ */
+typedef void* ( *fr_decode_f )( void* buf, fr_size_t size );
+
+
+/**
+ * Framer item source.
+ *
+ * Source fills at most cnt items to the given buffer, and returns
+ * the count of items filled. Zero is returned at the end of the
+ * source.
+ */
+typedef fr_size_t ( *fr_source_f )( void* ctx, void** items, fr_size_t cnt );
+
+
 
 /* ------------------------------------------------------------
  * Memory API:
@@ -104,6 +439,12 @@ typedef int ( *fr_cmp_f )( void* a, void* b );
  *
  * * pos : Framer position.
  * * env : Memory pooler environment (data).
+ *
+ * Reserve function must return a Node with segment size set, for
+ * example by using fn_new_sized(), or NULL if no Node can be reserved.
+ * Framer functions that check allocations (e.g. fr_read()) fail then,
+ * and others require that reservation succeeds, i.e. that the memory
+ * is ensured beforehand (see fr_map_reserve()).
  */
 typedef fn_t ( *fr_mem_f )( fr_t pos, void* env );
 
@@ -115,316 +456,1944 @@ struct fr_mem_struct_s
 {
     fr_mem_f alloc; /**< Reserve function. */
     fr_mem_f free;  /**< Release function. */
+    fr_mem_f close; /**< Close function, called by fr_destroy() (or NULL). */
     void*    env;   /**< Environment. */
 };
 typedef struct fr_mem_struct_s fr_mem_s; /**< Pooler struct. */
 typedef fr_mem_s*              fr_mem_t; /**< Pooler pointer. */
 
 
+/**
+ * Framer Node arena.
+ *
+ * Arena is a contiguous block of Node slots, and it is used through
+ * the Memory API. Released slots are reused. Nodes are reserved from
+ * parent Memory API (or heap) when arena is full.
+ */
+struct fr_arena_struct_s
+{
+    char*     base;   /**< Slot block. */
+    fr_size_t slot;   /**< Slot byte size. */
+    fr_size_t size;   /**< Slot segment size. */
+    fr_size_t cnt;    /**< Slot count. */
+    fr_size_t top;    /**< Count of slots taken into use. */
+    fn_t      free;   /**< Released slots. */
+    fr_mem_s  parent; /**< Parent Memory API (alloc is NULL for heap). */
+};
+typedef struct fr_arena_struct_s fr_arena_s; /**< Arena struct. */
+typedef fr_arena_s*              fr_arena_t; /**< Arena pointer. */
+
+
+struct fr_epoch_struct_s;
+
+/**
+ * Epoch reader record.
+ *
+ * Each reader thread has a record, where it announces the epoch
+ * observed when entering the read section.
+ */
+struct fr_epoch_rec_struct_s
+{
+    fr_size_t                     state; /**< Observed epoch << 1 | active. */
+    struct fr_epoch_struct_s*     owner; /**< Epoch domain. */
+    struct fr_epoch_rec_struct_s* next;  /**< Next record. */
+} FR_CACHE_LINE_ALIGN;
+typedef struct fr_epoch_rec_struct_s fr_epoch_rec_s; /**< Reader record struct. */
+typedef fr_epoch_rec_s*              fr_epoch_rec_t; /**< Reader record. */
+
+
+/**
+ * Epoch domain.
+ *
+ * Released Nodes are retired to the list of current epoch, and they
+ * are freed when global epoch has advanced twice, i.e. when no reader
+ * can refer to them anymore.
+ */
+struct fr_epoch_struct_s
+{
+    fr_size_t      epoch;        /**< Global epoch. */
+    fn_t           first;        /**< First Node, for readers. */
+    fr_epoch_rec_t recs;         /**< Reader records. */
+    fn_p           retired[ 3 ]; /**< Retired Nodes per epoch. */
+    fr_size_t      rcnt[ 3 ];    /**< Retired Node count per epoch. */
+    fr_size_t      rcap[ 3 ];    /**< Retired list capacity per epoch. */
+    char           lock;         /**< Writer side spinlock. */
+    fr_mem_s       parent;       /**< Parent Memory API (alloc is NULL for heap). */
+};
+typedef struct fr_epoch_struct_s fr_epoch_s; /**< Epoch domain struct. */
+typedef fr_epoch_s*              fr_epoch_t; /**< Epoch domain. */
+
+
 
 #ifdef FRAMER_USE_MEM_API
 
 /*
  * FRAMER_USE_MEM_API allows to use custom memory allocation functions,
- * instead of the default: fr_malloc, fr_free, fr_realloc.
+ * instead of the default: fr_malloc, fr_free, fr_realloc,
+ * fr_malloc_aligned.
  *
  * If FRAMER_USE_MEM_API is used, the user must provide implementation for the
- * below functions and they must be compatible with malloc etc.
+ * below functions and they must be compatible with malloc etc. Memory
+ * from fr_malloc_aligned is released with fr_free.
  */
 
 extern void* fr_malloc( size_t size );
 extern void  fr_free( void* ptr );
 extern void* fr_realloc( void* ptr, size_t size );
+extern void* fr_malloc_aligned( size_t align, size_t size );
+
+#else
+
+/* Default to common memory management functions. */
+
+/** Reserve memory. */
+#define fr_malloc malloc
+
+/** Release memory. */
+#define fr_free free
+
+/** Re-reserve memory. */
+#define fr_realloc realloc
+
+/** Reserve aligned memory (size is multiple of alignment). */
+#define fr_malloc_aligned aligned_alloc
+
+#endif
+
+
+
+/* ------------------------------------------------------------
+ * Node link macros:
+ * ------------------------------------------------------------ */
+
+#ifdef FRAMER_COMPACT_LINKS
+
+/** Linked Node from link offset. */
+#define fn_link_node( node, link )                                                   \
+    ( (fn_t)( ( link ) ? (uintptr_t)( node ) + (intptr_t)( link ) * FR_LINK_UNIT \
+                       : (uintptr_t)0 ) )
+
+/** Previous Node. */
+#define fn_prev( node ) fn_link_node( ( node ), ( node )->prev )
+
+/** Next Node. */
+#define fn_next( node ) fn_link_node( ( node ), ( node )->next )
+
+/** Set previous Node. */
+#define fn_set_prev( node, peer ) ( ( node )->prev = fn_link( ( node ), ( peer ) ) )
+
+/** Set next Node. */
+#define fn_set_next( node, peer ) ( ( node )->next = fn_link( ( node ), ( peer ) ) )
+
+#else
+
+/** Previous Node. */
+#define fn_prev( node ) ( ( node )->prev )
+
+/** Next Node. */
+#define fn_next( node ) ( ( node )->next )
+
+/** Set previous Node. */
+#define fn_set_prev( node, peer ) ( ( node )->prev = ( peer ) )
+
+/** Set next Node. */
+#define fn_set_next( node, peer ) ( ( node )->next = ( peer ) )
+
+#endif
+
+
+
+/* ------------------------------------------------------------
+ * Framer access macros:
+ * ------------------------------------------------------------ */
+
+#ifdef FRAMER_USE_GAPS
+/** Item at Position with cast from void* to target type (past segment gap). */
+#define fr_cur( pos, cast ) ( ( cast )fr_item( pos ) )
+#else
+/** Item at Position with cast from void* to target type. */
+#define fr_cur( pos, cast ) ( ( cast )( ( pos )->seg->data[ ( pos )->idx ] ) )
+#endif
+
+
+/**
+ * Framer item iterator:
+ *
+ * * iter  : Framer iterator
+ * * item  : Item variable
+ * * cast  : Item variable type
+ *
+ */
+#define fr_each( iter, item, cast ) \
+    for ( item = (cast)fr_item( iter ); ( iter )->seg; item = (cast)fr_next_item( iter ) )
+
+
+/* ------------------------------------------------------------
+ * Framer access:
+ * ------------------------------------------------------------ */
+
+/**
+ * Create Framer with default segment size.
+ *
+ * Initial Framer Node is created and associated to Framer
+ * Position. Position will refer to start of Framer chain.
+ *
+ * Default segment size fits the Node to one cache line, i.e. it is
+ * fr_seg_lines( 1 ).
+ *
+ * @return Position.
+ */
+fr_t fr_create( void );
+
+
+/**
+ * Create Framer with given segment size.
+ *
+ * See: fr_create().
+ *
+ * @param size Framer segment size.
+ *
+ * @return Position (or NULL if out of memory).
+ */
+fr_t fr_create_sized( fr_size_t size );
+
+
+/**
+ * Create Framer with adaptive segment size.
+ *
+ * Segment size of new Nodes starts from "size" and is doubled, upto
+ * "max", whenever Node count reaches the current segment size. Each
+ * Node records its own capacity, hence small and large Nodes can
+ * coexist in the same Framer.
+ *
+ * @param size Initial segment size.
+ * @param max  Maximum segment size.
+ *
+ * @return Position (or NULL if out of memory).
+ */
+fr_t fr_create_adaptive( fr_size_t size, fr_size_t max );
+
+
+/**
+ * Return cache line size.
+ *
+ * Cache line size is detected at runtime (sysconf or sysfs) on first
+ * call. FR_CACHE_LINE_SIZE is returned if detection fails.
+ *
+ * @return Cache line size in bytes.
+ */
+fr_size_t fr_cache_line_size( void );
+
+
+/**
+ * Return segment size for Node of given number of cache lines.
+ *
+ * Segment size is the number of items that fit the Node, after Node
+ * header. Line count is increased if segment would be smaller than
+ * FR_SEG_MIN.
+ *
+ * @param lines Cache line count.
+ *
+ * @return Segment size.
+ */
+fr_size_t fr_seg_lines( fr_size_t lines );
+
+
+/**
+ * Create Framer based on Position.
+ *
+ * @param pos Position.
+ *
+ * @return Position.
+ */
+fr_t fr_create_using( fr_t pos );
+
+
+/**
+ * Destroy Framer.
+ *
+ * Everything regarding Framer and Position is destroyed.
+ *
+ * @param pos Position.
+ *
+ * @return NULL
+ */
+fr_t fr_destroy( fr_t pos );
+
+
+/**
+ * Insert item to current Position.
+ *
+ * Segment data is shifted right, if necessary. If segment is full, a
+ * new segment is created including the tail from current Position.
+ * With FRAMER_USE_GAPS, segment gap is moved to the Position instead.
+ *
+ * @param pos  Position.
+ * @param item Item.
+ */
+void fr_insert( fr_t pos, void* item );
+
+
+/**
+ * Append item after current Position.
+ *
+ * Position is first moved right, and data is then inserted. Position
+ * is not moved if the item is first in Framer.
+ *
+ * @param pos  Position.
+ * @param item Item.
+ */
+void fr_append( fr_t pos, void* item );
+
+
+/**
+ * Delete item from Framer.
+ *
+ * @param pos Position.
+ *
+ * @return Removed item.
+ */
+void* fr_delete( fr_t pos );
+
+
+/**
+ * Delete item from Framer and even items in peer Node segments.
+ *
+ * @param pos Position.
+ *
+ * @return Remove item.
+ */
+void* fr_delete_even( fr_t pos );
+
+
+/**
+ * Push item to back of Framer.
+ *
+ * NOTE: User must ensure that Position is at Framer end.
+ *
+ * @param pos  Position.
+ * @param item Item.
+ */
+void fr_push( fr_t pos, void* item );
+
+
+/**
+ * Pop item from back of Framer.
+ *
+ * NOTE: User must ensure that Position is at Framer end.
+ *
+ * @param pos Position.
+ *
+ * @return Last item.
+ */
+void* fr_pop( fr_t pos );
+
+
+/**
+ * Even items in peer Node segments.
+ *
+ * fr_even() evens the items in peer segments, so that segments never
+ * have less than half filled. It will combine two Node segments if
+ * they fit in one. Otherwise it will fill from next segment (or from
+ * previous) upto half for current segment.
+ *
+ * Return 2 if Node was delete, return 1 if evening occurred, and 0 if
+ * nothing was done.
+ *
+ * @param pos Position.
+ *
+ * @return 2, 1, or 0.
+ */
+int fr_even( fr_t pos );
+
+
+/**
+ * Pack Node segments together.
+ *
+ * Pack starting from current Position upto given end or to end of
+ * Framer. Limit defines the amount of items each segment should have
+ * after packing. Packing does not occur if limit is too low, or no
+ * Node has room. Node with items not yet packed is filled beyond limit,
+ * so that items are never moved past them.
+ *
+ * @param pos   Position.
+ * @param end   End of packing (or NULL).
+ * @param limit Segment fill count.
+ *
+ * @return 1 if packed, else 0.
+ */
+int fr_pack_range( fr_t pos, fr_t end, fr_size_t limit );
+
+
+/**
+ * Compact Node segments incrementally.
+ *
+ * Compaction cursor is a separate Position, which is only moved, and
+ * its counts are not maintained. Items are moved from the Node after
+ * cursor to the end of cursor Node until cursor Node is full. Empty
+ * Nodes are released and full Nodes are stepped over. Compaction
+ * resumes from the cursor on the next call.
+ *
+ * Framer Position is updated in place: it follows its item, and its
+ * Node and byte counts are maintained. Other Positions in the Node
+ * after cursor are invalidated (as with fr_even()).
+ *
+ * Cursor is not updated by other operations, and a stale cursor is
+ * not detected. Calls may be interleaved with fr_push(), but after
+ * any other edit the caller must reset the cursor to fr_first()
+ * before the next call.
+ *
+ * Work is bounded by budget, where each moved item and each stepped
+ * Node is one unit of work.
+ *
+ * Return 0 when cursor has reached the end of Framer, i.e. there is
+ * nothing more to compact.
+ *
+ * @param pos    Framer Position.
+ * @param cur    Compaction cursor.
+ * @param budget Maximum work for the call.
+ *
+ * @return Work done.
+ */
+fr_size_t fr_compact_step( fr_t pos, fr_t cur, fr_size_t budget );
+
+
+/**
+ * Defragment Framer.
+ *
+ * Nodes are relocated to a freshly allocated Node arena in Framer
+ * order, so that consecutive Nodes are also consecutive in
+ * memory. Optionally segments are packed full at the same time.
+ *
+ * Framer Memory API is replaced with the arena, and the previous
+ * Memory API (if any) is used for Nodes that don't fit the arena,
+ * either by count or by segment size of adaptive Framer.
+ *
+ * Given Position and the live Positions are updated to refer to the
+ * same items as before. All other Positions are invalidated. If the
+ * arena can't be reserved, Framer is left as is.
+ *
+ * @param pos  Position.
+ * @param live Live Positions (or NULL).
+ * @param cnt  Live Position count.
+ * @param pack Pack segments if 1.
+ */
+void fr_defrag( fr_t pos, fr_p live, fr_size_t cnt, int pack );
+
+
+/**
+ * Clone Framer.
+ *
+ * All Nodes of the clone are reserved at once, as one Node arena, and
+ * segments are copied as blocks. Optionally segments are packed full
+ * at the same time.
+ *
+ * Clone has the arena as Memory API, with heap as parent. Memory API
+ * of the source is not shared. Clone of adaptive Framer takes grown
+ * segments from heap.
+ *
+ * @param pos  Position.
+ * @param pack Pack segments if 1.
+ *
+ * @return Position at start of clone (or NULL if out of memory).
+ */
+fr_t fr_clone( fr_t pos, int pack );
+
+
+/**
+ * Clone Framer with multiple threads.
+ *
+ * Source Nodes are split to chunks, and chunks are copied in
+ * parallel. Calling thread copies one chunk. See: fr_clone().
+ *
+ * @param pos     Position.
+ * @param pack    Pack segments if 1.
+ * @param threads Thread count.
+ *
+ * @return Position at start of clone (or NULL if out of memory).
+ */
+fr_t fr_clone_parallel( fr_t pos, int pack, int threads );
+
+
+/**
+ * Return item count of Framer.
+ *
+ * @param pos Position.
+ *
+ * @return Length.
+ */
+fr_size_t fr_length( fr_t pos );
+
+
+/**
+ * Return item count of Framer tail.
+ *
+ * @param pos Current Position.
+ *
+ * @return Tail length.
+ */
+fr_size_t fr_tail_length( fr_t pos );
+
+
+/**
+ * Return Node count of Framer.
+ *
+ * @param pos Position.
+ *
+ * @return Node count.
+ */
+fr_size_t fr_node_count( fr_t pos );
+
+
+/**
+ * Return byte count of Framer Nodes.
+ *
+ * Count includes Node headers, segments and the padding to whole
+ * cache lines, and it is maintained incrementally, hence it is cheap
+ * to query.
+ *
+ * @param pos Position.
+ *
+ * @return Byte count.
+ */
+fr_size_t fr_memory_bytes( fr_t pos );
+
+
+/**
+ * Collect Framer statistics.
+ *
+ * All Nodes are visited. See: fr_stats_s.
+ *
+ * @param pos   Position.
+ * @param stats Statistics to fill.
+ */
+void fr_stats( fr_t pos, fr_stats_t stats );
+
+
+/**
+ * Return segment size.
+ *
+ * Segment size is used for new Nodes. In adaptive mode, it grows with
+ * the Framer.
+ * 
+ * @param pos Position.
+ * 
+ * @return Size.
+ */
+fr_size_t fr_size( fr_t pos );
+
+
+/**
+ * Return segment size (capacity) of current Node.
+ *
+ * @param pos Position.
+ *
+ * @return Capacity.
+ */
+fr_size_t fr_capacity( fr_t pos );
+
+
+/**
+ * Return current segment index.
+ * 
+ * @param pos Position.
+ * 
+ * @return Index.
+ */
+fr_size_t fr_index( fr_t pos );
+
+
+/**
+ * Return number of items in current segment.
+ * 
+ * @param pos Position.
+ * 
+ * @return Used count.
+ */
+fr_size_t fr_used( fr_t pos );
+
+
+/**
+ * Find item from Framer.
+ *
+ * Search from the current Position forward. Return Position where
+ * item was found or invalid Position.
+ *
+ * @param pos  Search Position.
+ * @param item Item to find.
+ *
+ * @return Position (or invalid Position).
+ */
+fr_s fr_find( fr_t pos, void* item );
+
+
+/**
+ * Find item from Framer using compare function.
+ *
+ * See: fr_find().
+ *
+ * @param pos  Search Position.
+ * @param item Item to find.
+ * @param comp Compare function.
+ *
+ * @return Position (or invalid Position).
+ */
+fr_s fr_find_with( fr_t pos, void* item, fr_cmp_f comp );
+
+
+/**
+ * Find item from Framer using compare function.
+ *
+ * NOTE: Assuming sorted set of data. This enables search to skip Node
+ * segment content, if useful.
+ *
+ * @param pos  Search Position.
+ * @param item Item to find.
+ * @param comp Compare function.
+ *
+ * @return Position (or invalid Position).
+ */
+fr_s fr_find_sorted_with( fr_t pos, void* item, fr_cmp_f comp );
+
+
+/**
+ * Merge sorted Framer src to sorted Framer dst.
+ *
+ * Both Framers are streamed once, and items are merged to the Nodes
+ * of the inputs, as the Nodes are consumed. Merge is stable, i.e. dst
+ * items come first among equal items. Output Nodes are full, except
+ * the last two, which are at least half full. Remaining tail of one
+ * input is relinked as is, where possible.
+ *
+ * Source Nodes are reused only if both Framers have the same Memory
+ * API. Other Positions of both Framers are invalidated, but cursors
+ * follow their items.
+ *
+ * @param dst    Destination Position (at first item after merge).
+ * @param src    Source Position (empty after merge).
+ * @param comp   Compare function.
+ * @param unique Drop items equal to the previous item if 1.
+ */
+void fr_merge( fr_t dst, fr_t src, fr_cmp_f comp, int unique );
+
+
+/**
+ * Remove adjacent duplicates from sorted Framer.
+ *
+ * Framer is compacted in one pass, i.e. kept items are packed to
+ * full segments from the first Node, and the emptied Nodes are
+ * released at the end. First of the equal items is kept.
+ *
+ * Other Positions are invalidated, but cursors follow their items
+ * (or the kept equal item).
+ *
+ * @param pos  Position (at first item after).
+ * @param comp Compare function.
+ *
+ * @return Count of removed items.
+ */
+fr_size_t fr_unique( fr_t pos, fr_cmp_f comp );
+
+
+/**
+ * Remove all duplicates from Framer.
+ *
+ * Seen items are recorded to a transient open addressing table,
+ * which is sized from the item count. Framer is compacted as with
+ * fr_unique(), and the first of the equal items is kept.
+ *
+ * @param pos  Position (at first item after).
+ * @param hash Hash function.
+ * @param eq   Compare function (0 on match).
+ *
+ * @return Count of removed items.
+ */
+fr_size_t fr_unique_hashed( fr_t pos, fr_hash_f hash, fr_cmp_f eq );
+
+
+/**
+ * Intersect sorted Framers.
+ *
+ * Framers are streamed from the first item. Runs of items without a
+ * match are skipped with galloping search, i.e. Nodes that end before
+ * the searched item are skipped, and the item is searched from the
+ * Node with exponential and binary search. Hence cost is
+ * O(small * log seg + nodes of large): a search per item of the
+ * smaller Framer, and a step per Node of the larger one.
+ *
+ * Equal items are matched pairwise, i.e. an item that occurs n times
+ * in a and m times in b is output min(n, m) times.
+ *
+ * @param a    Position of first Framer.
+ * @param b    Position of second Framer.
+ * @param comp Compare function.
+ *
+ * @return Result Framer (with segment size of a).
+ */
+fr_t fr_intersect( fr_t a, fr_t b, fr_cmp_f comp );
+
+
+/**
+ * Union of sorted Framers.
+ *
+ * See: fr_intersect(). Matched items are output once, i.e. item is
+ * output max(n, m) times. Items of a come first among equal items.
+ *
+ * @param a    Position of first Framer.
+ * @param b    Position of second Framer.
+ * @param comp Compare function.
+ *
+ * @return Result Framer (with segment size of a).
+ */
+fr_t fr_union( fr_t a, fr_t b, fr_cmp_f comp );
+
+
+/**
+ * Difference of sorted Framers, i.e. items of a without match in b.
+ *
+ * See: fr_intersect(). Item is output max(n - m, 0) times.
+ *
+ * @param a    Position of first Framer.
+ * @param b    Position of second Framer.
+ * @param comp Compare function.
+ *
+ * @return Result Framer (with segment size of a).
+ */
+fr_t fr_difference( fr_t a, fr_t b, fr_cmp_f comp );
+
+
+/**
+ * Intersect sorted Framers to output function.
+ *
+ * See: fr_intersect().
+ *
+ * @param a    Position of first Framer.
+ * @param b    Position of second Framer.
+ * @param comp Compare function.
+ * @param emit Output function.
+ * @param ctx  Output context.
+ *
+ * @return Count of output items.
+ */
+fr_size_t fr_intersect_emit( fr_t a, fr_t b, fr_cmp_f comp, fr_emit_f emit, void* ctx );
+
+
+/**
+ * Union of sorted Framers to output function.
+ *
+ * See: fr_union().
+ *
+ * @param a    Position of first Framer.
+ * @param b    Position of second Framer.
+ * @param comp Compare function.
+ * @param emit Output function.
+ * @param ctx  Output context.
+ *
+ * @return Count of output items.
+ */
+fr_size_t fr_union_emit( fr_t a, fr_t b, fr_cmp_f comp, fr_emit_f emit, void* ctx );
+
+
+/**
+ * Difference of sorted Framers to output function.
+ *
+ * See: fr_difference().
+ *
+ * @param a    Position of first Framer.
+ * @param b    Position of second Framer.
+ * @param comp Compare function.
+ * @param emit Output function.
+ * @param ctx  Output context.
+ *
+ * @return Count of output items.
+ */
+fr_size_t fr_difference_emit( fr_t a, fr_t b, fr_cmp_f comp, fr_emit_f emit, void* ctx );
+
+
+/**
+ * Reverse Framer in place.
+ *
+ * Node links are swapped, and each segment is reversed in place. No
+ * Nodes are allocated. Position refers to the same item as before,
+ * other Positions are invalidated, but cursors follow their items.
+ *
+ * @param pos Position.
+ */
+void fr_reverse( fr_t pos );
+
+
+/**
+ * Rotate Framer so that Position item becomes the first item.
+ *
+ * Chain ends are relinked, and only the Position Node is split. Items
+ * before Position in the Node are moved to the last Node if they fit,
+ * else to a new Node. Single Node is rotated in place.
+ *
+ * Position is at first item after rotate, other Positions are
+ * invalidated, but cursors follow their items.
+ *
+ * @param pos Position.
+ */
+void fr_rotate( fr_t pos );
+
+
+
+
+/* ------------------------------------------------------------
+ * Framer serialization:
+ * ------------------------------------------------------------ */
+
+/*
+ * Framer file has a header and the items. Header identifies the
+ * format version, byte order, item size, item count, and segment
+ * size. Items are either raw item values (pointer sized), or encoded
+ * records of length and data.
+ *
+ * Raw items are meaningful for inline items (e.g. integers stored as
+ * items), or pointers to static data. Raw format is native, i.e. it
+ * is read by hosts with the same byte order and item size.
+ */
+
+
+/**
+ * Write Framer to file.
+ *
+ * Without encode, raw items are written directly from segments with
+ * vectored writes. With encode, items are encoded as records to a
+ * staging buffer.
+ *
+ * @param pos    Position.
+ * @param fd     File descriptor.
+ * @param encode Item encode (or NULL for raw items).
+ *
+ * @return 0 on success, -1 on error (see errno).
+ */
+int fr_write( fr_t pos, int fd, fr_encode_f encode );
+
+
+/**
+ * Read Framer from file.
+ *
+ * Items are read to full segments. Decode must be given if and only
+ * if Framer was written with encode. File is rejected if header is
+ * invalid, segment size exceeds INT32_MAX, item count does not match
+ * the items in the file, or memory runs out.
+ *
+ * @param fd     File descriptor.
+ * @param decode Item decode (or NULL for raw items).
+ *
+ * @return Position at Framer start (or NULL on error).
+ */
+fr_t fr_read( int fd, fr_decode_f decode );
+
+
+/**
+ * Load items from source to Framer end.
+ *
+ * Source fills fresh Node segments directly, and each segment is
+ * filled upto given fill count before it is linked. Position is not
+ * changed, unless Framer was empty, when Position is at first item.
+ *
+ * @param pos    Position.
+ * @param source Item source.
+ * @param ctx    Source context.
+ * @param fill   Segment fill count (or 0 for full segments).
+ *
+ * @return Count of loaded items.
+ */
+fr_size_t fr_load_stream( fr_t pos, fr_source_f source, void* ctx, fr_size_t fill );
+
+
+/**
+ * Load items from source to Framer end, with helper thread.
+ *
+ * Source is called from a helper thread, and it fills the next
+ * segment while the previous is linked. Hence source I/O overlaps
+ * with Framer construction. Source is called from one thread at a
+ * time. If the helper thread can't be started, items are loaded as
+ * with fr_load_stream().
+ *
+ * @param pos    Position.
+ * @param source Item source.
+ * @param ctx    Source context.
+ * @param fill   Segment fill count (or 0 for full segments).
+ *
+ * @return Count of loaded items.
+ */
+fr_size_t fr_load_stream_parallel( fr_t pos, fr_source_f source, void* ctx, fr_size_t fill );
+
+
+/**
+ * Raw item source from file descriptor.
+ *
+ * Source context is a pointer to the file descriptor. Items are
+ * pointer sized values in native byte order. Source ends at end of
+ * file or on error.
+ *
+ * @param ctx   File descriptor pointer.
+ * @param items Item buffer.
+ * @param cnt   Item buffer size.
+ *
+ * @return Count of read items.
+ */
+fr_size_t fr_source_fd( void* ctx, void** items, fr_size_t cnt );
+
+
+
+#ifdef FRAMER_COMPACT_LINKS
+
+/* ------------------------------------------------------------
+ * Mapped Framer:
+ * ------------------------------------------------------------ */
+
+/*
+ * Mapped Framer has its Nodes in a memory mapped file. Nodes are
+ * linked with relative links (FRAMER_COMPACT_LINKS), hence they are
+ * used in place, at any mapping address. Opening the file doesn't
+ * visit the Nodes, and pages are read in lazily as the Framer is
+ * traversed.
+ *
+ * Contract:
+ *
+ * * Framer is edited with the home Position (fr_map_pos()), or with
+ *   copies that are copied back to home Position. Item and Node
+ *   counts are stored from home Position.
+ *
+ * * Nodes are reserved from the file, which is grown as needed upto
+ *   the maximum Node count. Address space is reserved for the
+ *   maximum at open. Edits that may add Nodes must be preceded by
+ *   fr_map_reserve(), which checks the maximum and grows the file.
+ *   Insert and append add at most one Node.
+ *
+ * * File is readable only by builds with the same Node layout.
+ */
+
+
+/**
+ * Create Mapped Framer file.
+ *
+ * Existing file is truncated. Framer is empty.
+ *
+ * @param path File path.
+ * @param size Segment size (FR_SEG_MIN upto INT32_MAX).
+ * @param max  Maximum Node count (at least 1).
+ *
+ * @return Mapped Framer (or NULL on error).
+ */
+fr_map_t fr_map_create( const char* path, fr_size_t size, fr_size_t max );
+
+
+/**
+ * Open Mapped Framer file.
+ *
+ * File is rejected if its header doesn't match the build, or slot
+ * counts don't match the file size.
+ *
+ * @param path File path.
+ *
+ * @return Mapped Framer (or NULL on error).
+ */
+fr_map_t fr_map_open( const char* path );
+
+
+/**
+ * Return home Position of Mapped Framer.
+ *
+ * Position must not be destroyed, use fr_map_close().
+ *
+ * @param map Mapped Framer.
+ *
+ * @return Home Position.
+ */
+fr_t fr_map_pos( fr_map_t map );
+
+
+/**
+ * Ensure room for Nodes in Mapped Framer.
+ *
+ * After success, cnt Nodes can be added without reservation failure.
+ *
+ * @param map Mapped Framer.
+ * @param cnt Node count.
+ *
+ * @return 0 on success, -1 if maximum Node count would be exceeded, or
+ *         file can't be grown.
+ */
+int fr_map_reserve( fr_map_t map, fr_size_t cnt );
+
+
+/**
+ * Flush Mapped Framer to file (with msync).
+ *
+ * @param map Mapped Framer.
+ *
+ * @return 0 on success, -1 on error (see errno).
+ */
+int fr_map_sync( fr_map_t map );
+
+
+/**
+ * Flush and close Mapped Framer.
+ *
+ * @param map Mapped Framer.
+ *
+ * @return NULL
+ */
+fr_map_t fr_map_close( fr_map_t map );
+
+
+
+/* ------------------------------------------------------------
+ * Shared memory Framer:
+ * ------------------------------------------------------------ */
+
+/*
+ * Shared memory Framer is a Mapped Framer in a POSIX shared memory
+ * object. Processes attach to the same object, and items are exchanged
+ * without copying. Items are pointer sized values, hence they must not
+ * be pointers to process private memory.
+ *
+ * Contract:
+ *
+ * * One writer and many readers. Writer edits Framer between
+ *   fr_shm_write_begin() and fr_shm_write_end(), using the returned
+ *   home Position only.
+ *
+ * * Readers traverse Framer between fr_shm_read_begin() and
+ *   fr_shm_read_end(), using the returned Position only for reading.
+ *
+ * * Sections are serialized with a process shared reader/writer
+ *   lock in the header, which prefers writers when available.
+ */
+
+
+/**
+ * Create Shared memory Framer.
+ *
+ * Existing object is truncated. Framer is empty.
+ *
+ * @param name Shared memory object name (e.g. "/name").
+ * @param size Segment size (FR_SEG_MIN upto INT32_MAX).
+ * @param max  Maximum Node count (at least 1).
+ *
+ * @return Shared memory Framer (or NULL on error).
+ */
+fr_map_t fr_shm_create( const char* name, fr_size_t size, fr_size_t max );
+
+
+/**
+ * Attach to Shared memory Framer.
+ *
+ * Framer is detached with fr_map_close().
+ *
+ * @param name Shared memory object name.
+ *
+ * @return Shared memory Framer (or NULL on error).
+ */
+fr_map_t fr_shm_attach( const char* name );
+
+
+/**
+ * Remove Shared memory Framer name.
+ *
+ * Attached processes keep their mappings.
+ *
+ * @param name Shared memory object name.
+ *
+ * @return 0 on success, -1 on error (see errno).
+ */
+int fr_shm_unlink( const char* name );
+
+
+/**
+ * Begin read section.
+ *
+ * @param map Shared memory Framer.
+ *
+ * @return Position at first item.
+ */
+fr_s fr_shm_read_begin( fr_map_t map );
+
+
+/**
+ * End read section.
+ *
+ * @param map Shared memory Framer.
+ */
+void fr_shm_read_end( fr_map_t map );
+
+
+/**
+ * Begin write section.
+ *
+ * Home Position is reloaded from the header, and it is at first item.
+ *
+ * @param map Shared memory Framer.
+ *
+ * @return Home Position.
+ */
+fr_t fr_shm_write_begin( fr_map_t map );
+
+
+/**
+ * End write section.
+ *
+ * Item and Node counts are published, and generation is incremented.
+ *
+ * @param map Shared memory Framer.
+ */
+void fr_shm_write_end( fr_map_t map );
+
+
+/**
+ * Return Shared memory Framer generation.
+ *
+ * Generation is the count of completed write sections, and readers can
+ * poll it for changes.
+ *
+ * @param map Shared memory Framer.
+ *
+ * @return Generation.
+ */
+fr_size_t fr_shm_gen( fr_map_t map );
+
+#endif
+
+
+
+/* ------------------------------------------------------------
+ * Small Framer:
+ * ------------------------------------------------------------ */
+
+/**
+ * Initialize Small Framer to empty.
+ *
+ * Zeroing the struct is equivalent.
+ *
+ * @param sm Small Framer.
+ */
+void fr_small_init( fr_small_t sm );
+
+
+/**
+ * Release Small Framer content.
+ *
+ * Small Framer is empty afterwards, and it can be reused.
+ *
+ * @param sm Small Framer.
+ */
+void fr_small_clear( fr_small_t sm );
+
+
+/**
+ * Return item count of Small Framer.
+ *
+ * @param sm Small Framer.
+ *
+ * @return Length.
+ */
+fr_size_t fr_small_length( fr_small_t sm );
+
+
+/**
+ * Return item at index.
+ *
+ * @param sm  Small Framer.
+ * @param idx Item index.
+ *
+ * @return Item (or NULL if out of bounds).
+ */
+void* fr_small_item( fr_small_t sm, fr_size_t idx );
+
+
+/**
+ * Insert item to index.
+ *
+ * Index may be equal to length, i.e. item is appended. Small Framer
+ * is moved to a normal Framer, if inline segment overflows.
+ *
+ * @param sm   Small Framer.
+ * @param idx  Item index.
+ * @param item Item.
+ */
+void fr_small_insert( fr_small_t sm, fr_size_t idx, void* item );
+
+
+/**
+ * Push item to back of Small Framer.
+ *
+ * @param sm   Small Framer.
+ * @param item Item.
+ */
+void fr_small_push( fr_small_t sm, void* item );
+
+
+/**
+ * Delete item at index.
+ *
+ * Small Framer is moved back to inline segment, when item count
+ * drops to half of FR_SMALL_SIZE. Empty Small Framer allocates
+ * nothing.
+ *
+ * @param sm  Small Framer.
+ * @param idx Item index.
+ *
+ * @return Removed item (or NULL if out of bounds).
+ */
+void* fr_small_delete( fr_small_t sm, fr_size_t idx );
+
+
+/**
+ * Return Position for Small Framer.
+ *
+ * Small Framer is moved to a normal Framer (if not already), and all
+ * Framer functions can be used through the Position. Position is
+ * owned by Small Framer, hence it must not be destroyed. Position is
+ * invalidated by the next fr_small_delete() or fr_small_clear().
+ *
+ * @param sm Small Framer.
+ *
+ * @return Position.
+ */
+fr_t fr_small_pos( fr_small_t sm );
+
+
+
+#ifdef FRAMER_USE_CURSORS
+
+/* ------------------------------------------------------------
+ * Framer cursor:
+ * ------------------------------------------------------------ */
+
+/*
+ * Cursor refers to an item, and it is registered to the Node of the
+ * item. When Framer operations move items, cursors move with the
+ * items, and fix-up cost depends only on the cursors in the affected
+ * Nodes.
+ *
+ * * Inserts don't move cursors to other items.
+ *
+ * * Cursor of a deleted item moves to the next item, or to the
+ *   previous if the item was last.
+ *
+ * * Framer is modified using normal Positions, not with the cursor
+ *   Position. Cursor is moved with the cursor functions.
+ *
+ * * Item and Node counts of cursor Position are not maintained.
+ *
+ * * Cursors must be deleted before the Framer is destroyed.
+ */
+
+
+/**
+ * Create cursor at Position.
+ *
+ * @param pos Position.
+ *
+ * @return Cursor.
+ */
+fr_cursor_t fr_cursor_new( fr_t pos );
+
+
+/**
+ * Delete cursor.
+ *
+ * @param cur Cursor.
+ *
+ * @return NULL
+ */
+fr_cursor_t fr_cursor_del( fr_cursor_t cur );
+
+
+/**
+ * Move cursor to Position.
+ *
+ * @param cur Cursor.
+ * @param pos Position.
+ */
+void fr_cursor_set( fr_cursor_t cur, fr_t pos );
+
+
+/**
+ * Return copy of cursor Position.
+ *
+ * @param cur Cursor.
+ *
+ * @return Position.
+ */
+fr_s fr_cursor_pos( fr_cursor_t cur );
+
+
+/**
+ * Return cursor item.
+ *
+ * @param cur Cursor.
+ *
+ * @return Item.
+ */
+void* fr_cursor_item( fr_cursor_t cur );
+
+
+/**
+ * Move cursor right.
+ *
+ * @param cur Cursor.
+ *
+ * @return 1 on success, else 0.
+ */
+fr_size_t fr_cursor_next( fr_cursor_t cur );
+
+
+/**
+ * Move cursor left.
+ *
+ * @param cur Cursor.
+ *
+ * @return 1 on success, else 0.
+ */
+fr_size_t fr_cursor_prev( fr_cursor_t cur );
+
+
+#endif
+
+
+
+#ifdef FRAMER_USE_NODE_LOCKS
+
+/* ------------------------------------------------------------
+ * Node locked access:
+ * ------------------------------------------------------------ */
+
+/*
+ * FRAMER_USE_NODE_LOCKS adds a spinlock to each Node. Locked edit
+ * functions lock the current Node and its peers, hence threads
+ * editing different regions of the Framer proceed in parallel.
+ *
+ * Locks are taken in Framer order, from left to right. Only the lock
+ * of previous Node is taken against the order, and it is only tried,
+ * i.e. all locks are released and locking is retried if previous is
+ * taken. Locking is deadlock free.
+ *
+ * Delete may move Position to a peer Node, where Position of another
+ * thread may be. Hence Node emptied by locked delete is not released,
+ * but retired: it is unlinked, its links are left intact, and its
+ * lock is marked dead. Thread waiting for the lock, or with Position
+ * in the Node, moves its Position to the following Node when it next
+ * locks. Retired Nodes are owned by the deleting Position, and freed
+ * by fr_locked_reclaim() or fr_destroy().
+ *
+ * Contract:
+ *
+ * * Each thread uses its own Position, and starts in its own region.
+ *   Threads should keep a margin between their regions.
+ *
+ * * Only the locked functions are used while multiple threads edit
+ *   the Framer.
+ *
+ * * Edit of peer Node by another thread may shift items in the Node
+ *   of Position. Index is clamped to the Node, but it may refer to a
+ *   different item afterwards.
+ *
+ * * Item and Node counts are maintained per Position.
+ *
+ * * Memory API, if any, must be thread safe.
+ */
+
+
+/**
+ * Insert item to current Position, with Node locking.
+ *
+ * See: fr_insert().
+ *
+ * @param pos  Position.
+ * @param item Item.
+ */
+void fr_insert_locked( fr_t pos, void* item );
+
+
+/**
+ * Delete item from Framer, with Node locking.
+ *
+ * See: fr_delete().
+ *
+ * @param pos Position.
+ *
+ * @return Removed item.
+ */
+void* fr_delete_locked( fr_t pos );
+
+
+/**
+ * Return current item, with Node locking.
+ *
+ * @param pos Position.
+ *
+ * @return Item.
+ */
+void* fr_item_locked( fr_t pos );
+
+
+/**
+ * Free Nodes retired by locked deletes of Position.
+ *
+ * No thread may be in a locked function, and Positions in retired
+ * Nodes are invalidated.
+ *
+ * @param pos Position.
+ */
+void fr_locked_reclaim( fr_t pos );
+
+#endif
+
+
+
+/* ------------------------------------------------------------
+ * Framer queue:
+ * ------------------------------------------------------------ */
+
+/*
+ * Framer queue is a lock-free FIFO between one producer thread and
+ * one consumer thread. Producer appends to the tail Node and
+ * publishes items with release stores. Consumer takes items from the
+ * head Node, and consumed Nodes are reused by the producer.
+ *
+ * Queue can't hold NULL items, since NULL denotes empty queue.
+ */
+
+
+/**
+ * Create queue.
+ *
+ * @param size Segment size.
+ *
+ * @return Queue.
+ */
+fr_queue_t fr_queue_new( fr_size_t size );
+
+
+/**
+ * Delete queue.
+ *
+ * Producer and consumer must have stopped.
+ *
+ * @param queue Queue.
+ *
+ * @return NULL
+ */
+fr_queue_t fr_queue_del( fr_queue_t queue );
+
+
+/**
+ * Put item to queue (producer).
+ *
+ * @param queue Queue.
+ * @param item  Item (not NULL).
+ */
+void fr_queue_put( fr_queue_t queue, void* item );
+
+
+/**
+ * Put items to queue (producer).
+ *
+ * Items are copied in segment sized blocks, and published once per
+ * Node.
+ *
+ * @param queue Queue.
+ * @param items Items.
+ * @param cnt   Item count.
+ */
+void fr_queue_put_n( fr_queue_t queue, void** items, fr_size_t cnt );
+
+
+/**
+ * Get item from queue (consumer).
+ *
+ * @param queue Queue.
+ *
+ * @return Item (or NULL if empty).
+ */
+void* fr_queue_get( fr_queue_t queue );
+
+
+/**
+ * Get items from queue (consumer).
+ *
+ * @param queue Queue.
+ * @param items Item storage.
+ * @param cnt   Maximum item count.
+ *
+ * @return Item count.
+ */
+fr_size_t fr_queue_get_n( fr_queue_t queue, void** items, fr_size_t cnt );
+
+
+
+/* ------------------------------------------------------------
+ * Framer log:
+ * ------------------------------------------------------------ */
+
+/*
+ * Framer log is appended concurrently by any number of producer
+ * threads, without locks. Producer reserves a slot from the tail Node
+ * with atomic increment of the used count, and stores the item to the
+ * slot. Producer that overflows the tail Node installs a new tail
+ * Node with compare-and-swap.
+ *
+ * Slots are NULL until the item is stored. Readers iterate the
+ * committed prefix of the log, i.e. upto the first slot without
+ * item. Log can't hold NULL items.
+ *
+ * When producers are done, log is closed to a normal Framer.
+ */
+
+
+/**
+ * Create log.
+ *
+ * @param size Segment size.
+ *
+ * @return Log.
+ */
+fr_log_t fr_log_new( fr_size_t size );
+
+
+/**
+ * Append item to log (thread safe).
+ *
+ * @param log  Log.
+ * @param item Item (not NULL).
+ */
+void fr_log_push( fr_log_t log, void* item );
 
-#else
 
-/* Default to common memory management functions. */
+/**
+ * Return Position to the start of log, for reading.
+ *
+ * @param log Log.
+ *
+ * @return Position.
+ */
+fr_s fr_log_first( fr_log_t log );
 
-/** Reserve memory. */
-#define fr_malloc malloc
 
-/** Release memory. */
-#define fr_free free
+/**
+ * Read item at Position and advance.
+ *
+ * Position is not advanced, if item is not yet committed. Reading can
+ * be retried later.
+ *
+ * @param pos Read Position.
+ *
+ * @return Item (or NULL if at end of committed prefix).
+ */
+void* fr_log_read( fr_t pos );
 
-/** Re-reserve memory. */
-#define fr_realloc realloc
 
-#endif
+/**
+ * Close log to a normal Framer.
+ *
+ * Producers must have stopped. Log is deleted.
+ *
+ * @param log Log.
+ *
+ * @return Position at Framer start.
+ */
+fr_t fr_log_close( fr_log_t log );
 
 
 
 /* ------------------------------------------------------------
- * Framer access macros:
+ * Epoch reclamation:
  * ------------------------------------------------------------ */
 
-/** Item at Position with cast from void* to target type. */
-#define fr_cur( pos, cast ) ( ( cast )( ( pos )->seg->data[ ( pos )->idx ] ) )
+/*
+ * Epoch based reclamation lets readers scan the Framer without locks,
+ * while a writer edits it. Released Nodes are not freed immediately,
+ * but retired, and freed only after every reader has left the read
+ * section where it could have reached the Node.
+ *
+ * Epoch domain is taken into use through the Memory API. Writer edits
+ * concurrently with readers only with fr_insert(), fr_append(),
+ * fr_push(), fr_pop(), fr_delete(), fr_delete_even() and fr_even()
+ * (writers must be serialized, or use Node locks). These publish their
+ * stores atomically. Other modifying functions require that there are
+ * no readers.
+ *
+ * Reader enters read section, scans with its own Position using only
+ * fr_epoch_next() and fr_epoch_item(), and leaves the section. Reader
+ * must not keep Positions across sections. Items edited concurrently
+ * may be missed or seen twice.
+ */
 
 
 /**
- * Framer item iterator:
+ * Take epoch reclamation into use for Framer.
  *
- * * iter  : Framer iterator
- * * item  : Item variable
- * * cast  : Item variable type
+ * Framer Memory API is replaced with the epoch domain, and the
+ * previous Memory API (if any) is used for reserving and freeing
+ * Nodes. Epoch domain is deleted by fr_destroy().
+ *
+ * @param pos Position.
  *
+ * @return Epoch domain.
  */
-#define fr_each( iter, item, cast ) \
-    for ( item = (cast)fr_item( iter ); ( iter )->seg; item = (cast)fr_next_item( iter ) )
-
+fr_epoch_t fr_epoch_use( fr_t pos );
 
-/* ------------------------------------------------------------
- * Framer access:
- * ------------------------------------------------------------ */
 
 /**
- * Create Framer with default segment size.
+ * Create reader record for a reader thread.
  *
- * Initial Framer Node is created and associated to Framer
- * Position. Position will refer to start of Framer chain.
+ * Records are released by fr_destroy().
  *
- * @return Position.
+ * @param epoch Epoch domain.
+ *
+ * @return Reader record.
  */
-fr_t fr_create( void );
+fr_epoch_rec_t fr_epoch_reader( fr_epoch_t epoch );
 
 
 /**
- * Create Framer with given segment size.
+ * Enter read section.
  *
- * See: fr_create().
- *
- * @param size Framer segment size.
+ * @param rec Reader record.
  *
- * @return Position.
+ * @return Position at Framer start.
  */
-fr_t fr_create_sized( fr_size_t size );
+fr_s fr_epoch_enter( fr_epoch_rec_t rec );
 
 
 /**
- * Create Framer based on Position.
+ * Move right in read section.
  *
- * @param pos Position.
+ * @param pos Reader Position.
  *
- * @return Position.
+ * @return 1 on success, else 0.
  */
-fr_t fr_create_using( fr_t pos );
+fr_size_t fr_epoch_next( fr_t pos );
 
 
 /**
- * Destroy Framer.
+ * Item at Position in read section.
  *
- * Everything regarding Framer and Position is destroyed.
+ * @param pos Reader Position.
  *
- * @param pos Position.
+ * @return Item, or NULL if Position is past the segment end.
+ */
+void* fr_epoch_item( fr_t pos );
+
+
+/**
+ * Leave read section.
  *
- * @return NULL
+ * @param rec Reader record.
  */
-fr_t fr_destroy( fr_t pos );
+void fr_epoch_exit( fr_epoch_rec_t rec );
 
 
 /**
- * Insert item to current Position.
+ * Free retired Nodes that are not reachable by readers.
  *
- * Segment data is shifted right, if necessary. If segment is full, a
- * new segment is created including the tail from current Position.
+ * Reclamation is also attempted whenever a Node is retired.
  *
- * @param pos  Position.
- * @param item Item.
+ * @param epoch Epoch domain.
+ *
+ * @return Count of Nodes still retired.
  */
-void fr_insert( fr_t pos, void* item );
+fr_size_t fr_epoch_reclaim( fr_epoch_t epoch );
 
 
-/**
- * Append item after current Position.
+
+#ifdef FRAMER_USE_SNAPSHOTS
+
+/* ------------------------------------------------------------
+ * Framer snapshot:
+ * ------------------------------------------------------------ */
+
+/*
+ * Snapshot is an immutable view of the Framer content at the time of
+ * fr_snapshot(). Snapshot shares the Nodes with the Framer, and
+ * taking a snapshot costs O(1). Node content is copied to the
+ * snapshots only when the Node is modified the first time after
+ * snapshot. Node copies are reference counted, and shared between
+ * all snapshots that see the same content.
  *
- * Position is first moved right, and data is then inserted. Position
- * is not moved if the item is first in Framer.
+ * Contract:
  *
- * @param pos  Position.
- * @param item Item.
+ * * Framer is modified only through Positions that are copied from
+ *   the snapshot Position after the first fr_snapshot(). Other
+ *   Positions don't refer to the snapshot domain.
+ *
+ * * Snapshot may be read by another thread, while the Framer is
+ *   modified. Framer modifications must still be serialized.
+ *
+ * * Snapshot remains valid after fr_destroy() of the Framer, until it
+ *   is deleted.
  */
-void fr_append( fr_t pos, void* item );
 
 
 /**
- * Delete item from Framer.
+ * Take snapshot of Framer.
  *
  * @param pos Position.
  *
- * @return Removed item.
+ * @return Snapshot.
  */
-void* fr_delete( fr_t pos );
+fr_snap_t fr_snapshot( fr_t pos );
 
 
 /**
- * Delete item from Framer and even items in peer Node segments.
+ * Delete snapshot.
  *
- * @param pos Position.
+ * Node copies that are not shared with other snapshots are freed.
  *
- * @return Remove item.
+ * @param snap Snapshot.
+ *
+ * @return NULL
  */
-void* fr_delete_even( fr_t pos );
+fr_snap_t fr_snap_del( fr_snap_t snap );
 
 
 /**
- * Push item to back of Framer.
+ * Return item count of snapshot.
  *
- * NOTE: User must ensure that Position is at Framer end.
+ * @param snap Snapshot.
  *
- * @param pos  Position.
- * @param item Item.
+ * @return Length.
  */
-void fr_push( fr_t pos, void* item );
+fr_size_t fr_snap_length( fr_snap_t snap );
 
 
 /**
- * Pop item from back of Framer.
+ * Return count of Node copies held by snapshot.
  *
- * NOTE: User must ensure that Position is at Framer end.
+ * @param snap Snapshot.
  *
- * @param pos Position.
+ * @return Copy count.
+ */
+fr_size_t fr_snap_copies( fr_snap_t snap );
+
+
+/**
+ * Start reading snapshot from the first item.
  *
- * @return Last item.
+ * @param snap Snapshot.
+ * @param it   Snapshot reader.
  */
-void* fr_pop( fr_t pos );
+void fr_snap_iter( fr_snap_t snap, fr_snap_iter_t it );
 
 
 /**
- * Even items in peer Node segments.
+ * Read next Node segment of snapshot.
  *
- * fr_even() evens the items in peer segments, so that segments never
- * have less than half filled. It will combine two Node segments if
- * they fit in one. Otherwise it will fill from next segment (or from
- * previous) upto half for current segment.
+ * Items are copied to "it->items", and they are valid until the next
+ * call.
  *
- * Return 2 if Node was delete, return 1 if evening occurred, and 0 if
- * nothing was done.
+ * @param it Snapshot reader.
  *
- * @param pos Position.
+ * @return Item count (0 at end).
+ */
+fr_size_t fr_snap_read( fr_snap_iter_t it );
+
+
+/**
+ * Release snapshot reader.
  *
- * @return 2, 1, or 0.
+ * @param it Snapshot reader.
+ */
+void fr_snap_iter_done( fr_snap_iter_t it );
+
+#endif
+
+
+
+#ifdef FRAMER_USE_DIRTY
+
+/* ------------------------------------------------------------
+ * Dirty tracking:
+ * ------------------------------------------------------------ */
+
+/*
+ * Node is dirty when it is created, when its items, item count, or
+ * links are changed, or when its index has changed, because Nodes
+ * were added or removed before it. Hence checkpoint is an array of
+ * Node segments by Node index. Checkpoint writes the dirty Nodes (and
+ * the Node count), and then clears the dirty flags. Replaying the
+ * dirty Nodes over the previous checkpoint gives the current Framer.
  */
-int fr_even( fr_t pos );
 
 
 /**
- * Pack Node segments together.
+ * List dirty Nodes in Framer order.
  *
- * Pack starting from current Position upto given end or to end of
- * Framer. Limit defines the amount of items each segment should have
- * after packing. Packing does not occur if limit is too low.
+ * Count of all dirty Nodes is returned, and at most max entries are
+ * stored.
+ * With FRAMER_USE_GAPS, segment gaps of stored Nodes are closed.
  *
  * @param pos   Position.
- * @param end   End of packing (or NULL).
- * @param limit Segment fill count.
+ * @param dirty Dirty Node entries (or NULL for count only).
+ * @param max   Entry count limit.
  *
- * @return 1 if packed, else 0.
+ * @return Dirty Node count.
  */
-int fr_pack_range( fr_t pos, fr_t end, fr_size_t limit );
+fr_size_t fr_dirty( fr_t pos, fr_dirty_t dirty, fr_size_t max );
 
 
 /**
- * Return item count of Framer.
+ * Clear dirty flags of listed Nodes.
  *
- * @param pos Position.
+ * Nodes are recorded at the listed Node index.
  *
- * @return Length.
+ * @param dirty Dirty Node entries.
+ * @param cnt   Entry count.
  */
-fr_size_t fr_length( fr_t pos );
+void fr_dirty_clear( fr_dirty_t dirty, fr_size_t cnt );
 
 
 /**
- * Return item count of Framer tail.
+ * Mark checkpoint, i.e. clear dirty flags of all Nodes.
  *
- * @param pos Current Position.
+ * Node indexes are recorded, and Nodes are dirty again when moved to
+ * other index.
  *
- * @return Tail length.
+ * @param pos Position.
+ */
+void fr_checkpoint( fr_t pos );
+
+#endif
+
+
+
+#ifdef FRAMER_USE_GAPS
+
+/* ------------------------------------------------------------
+ * Segment gaps:
+ * ------------------------------------------------------------ */
+
+/*
+ * Gap of Node is the run of its free slots. Gap is closed when it is
+ * after the last item, which is the layout of a Node without gaps.
+ * fr_insert() and fr_delete() move the gap lazily to the edit index,
+ * and other modifications close the gap first. Item access and find
+ * functions skip the gap. Node segment is accessed directly only
+ * after its gap is closed, e.g. by fr_flatten().
  */
-fr_size_t fr_tail_length( fr_t pos );
 
 
 /**
- * Return Node count of Framer.
+ * Close segment gaps of all Nodes.
  *
  * @param pos Position.
+ */
+void fr_flatten( fr_t pos );
+
+#endif
+
+
+
+/* ------------------------------------------------------------
+ * Shared Framer:
+ * ------------------------------------------------------------ */
+
+/*
+ * Shared Framer is accessed by multiple threads. Access is done in
+ * read and write sections, protected by a reader/writer lock. Any
+ * number of readers may be in read section concurrently, and writers
+ * are serialized. Waiting writers are preferred over new readers (with
+ * glibc), hence read sections must not nest.
  *
- * @return Node count.
+ * Contract:
+ *
+ * * Write section provides the home Position of the Framer. All
+ *   Framer functions can be used, and all Positions from the write
+ *   section are invalid after the section.
+ *
+ * * Read section provides a private copy of home Position. Only
+ *   non-modifying functions may be used (navigation, item access,
+ *   search).
+ *
+ * * Positions are valid only inside a section. Reader Position is
+ *   still valid in a later section, if Framer generation has not
+ *   changed, i.e. there has been no write section in between.
+ *
+ * Writers should batch updates into one write section, in order to
+ * minimize reader blocking.
  */
-fr_size_t fr_node_count( fr_t pos );
 
 
 /**
- * Return segment size.
- * 
- * @param pos Position.
- * 
- * @return Size.
+ * Create Shared Framer.
+ *
+ * Shared Framer takes ownership of Framer, and Position becomes the
+ * home Position.
+ *
+ * @param pos Framer Position.
+ *
+ * @return Shared Framer.
  */
-fr_size_t fr_size( fr_t pos );
+fr_sync_t fr_sync_new( fr_t pos );
 
 
 /**
- * Return current segment index.
- * 
- * @param pos Position.
- * 
- * @return Index.
+ * Destroy Shared Framer including the Framer.
+ *
+ * No thread may be in read or write section.
+ *
+ * @param sync Shared Framer.
+ *
+ * @return NULL
  */
-fr_size_t fr_index( fr_t pos );
+fr_sync_t fr_sync_destroy( fr_sync_t sync );
 
 
 /**
- * Return number of items in current segment.
- * 
- * @param pos Position.
- * 
- * @return Used count.
+ * Enter read section.
+ *
+ * @param sync Shared Framer.
+ *
+ * @return Copy of home Position.
  */
-fr_size_t fr_used( fr_t pos );
+fr_s fr_sync_read_begin( fr_sync_t sync );
 
 
 /**
- * Find item from Framer.
+ * Leave read section.
  *
- * Search from the current Position forward. Return Position where
- * item was found or invalid Position.
+ * @param sync Shared Framer.
+ */
+void fr_sync_read_end( fr_sync_t sync );
+
+
+/**
+ * Enter write section.
  *
- * @param pos  Search Position.
- * @param item Item to find.
+ * @param sync Shared Framer.
  *
- * @return Position (or invalid Position).
+ * @return Home Position.
  */
-fr_s fr_find( fr_t pos, void* item );
+fr_t fr_sync_write_begin( fr_sync_t sync );
 
 
 /**
- * Find item from Framer using compare function.
- *
- * See: fr_find().
+ * Leave write section.
  *
- * @param pos  Search Position.
- * @param item Item to find.
- * @param comp Compare function.
+ * Framer generation is incremented.
  *
- * @return Position (or invalid Position).
+ * @param sync Shared Framer.
  */
-fr_s fr_find_with( fr_t pos, void* item, fr_cmp_f comp );
+void fr_sync_write_end( fr_sync_t sync );
 
 
 /**
- * Find item from Framer using compare function.
+ * Return Framer generation.
  *
- * NOTE: Assuming sorted set of data. This enables search to skip Node
- * segment content, if useful.
+ * Generation is incremented by each write section, and it can be
+ * queried outside sections.
  *
- * @param pos  Search Position.
- * @param item Item to find.
- * @param comp Compare function.
+ * @param sync Shared Framer.
  *
- * @return Position (or invalid Position).
+ * @return Generation.
  */
-fr_s fr_find_sorted_with( fr_t pos, void* item, fr_cmp_f comp );
-
+fr_size_t fr_sync_gen( fr_sync_t sync );
 
 
 
@@ -437,7 +2406,7 @@ fr_s fr_find_sorted_with( fr_t pos, void* item, fr_cmp_f comp );
  *
  * @param size Framer segment size.
  *
- * @return Position.
+ * @return Position (or NULL if out of memory).
  */
 fr_t fr_pos_new( fr_size_t size );
 
@@ -661,13 +2630,31 @@ int fr_is_valid( fr_t pos );
 /**
  * Create Framer node with given segment size.
  *
+ * Node is aligned to cache line, and its allocation is rounded up to
+ * whole cache lines.
+ *
  * @param size Segment size.
  *
- * @return Node.
+ * @return Node (or NULL if out of memory).
  */
 fn_t fn_new_sized( fr_size_t size );
 
 
+#ifdef FRAMER_COMPACT_LINKS
+
+/**
+ * Return link from Node to peer.
+ *
+ * @param node Node.
+ * @param peer Peer Node (or NULL).
+ *
+ * @return Link offset.
+ */
+fn_link_t fn_link( fn_t node, fn_t peer );
+
+#endif
+
+
 /**
  * Return first Node in chain.
  *
@@ -678,6 +2665,16 @@ fn_t fn_new_sized( fr_size_t size );
 fn_t fn_first( fn_t node );
 
 
+/**
+ * Return last Node in chain.
+ *
+ * @param node Current Node.
+ *
+ * @return Last Node.
+ */
+fn_t fn_last( fn_t node );
+
+
 /**
  * Append Node after anchor.
  *
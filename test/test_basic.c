@@ -7,9 +7,15 @@
  *
  */
 
+#include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <sys/wait.h>
+#include <fcntl.h>
 #include "unity.h"
 #include "framer.h"
 
@@ -54,7 +60,7 @@ void test_create_and_destroy( void )
     TEST_ASSERT_EQUAL( 0, fr_index( pos ) );
     TEST_ASSERT_EQUAL( 0, fr_used( pos ) );
     TEST_ASSERT_EQUAL( NULL, fr_item( pos ) );
-    TEST_ASSERT_EQUAL( FR_SEG_DEFAULT, fr_size( pos ) );
+    TEST_ASSERT_EQUAL( fr_seg_lines( 1 ), fr_size( pos ) );
     fr_destroy( pos );
 
 
@@ -357,8 +363,8 @@ void test_corners( void )
     TEST_ASSERT_EQUAL( NULL, pos->mem );
 
     TEST_ASSERT_EQUAL( 0, pos->seg->used );
-    TEST_ASSERT_EQUAL( NULL, pos->seg->prev );
-    TEST_ASSERT_EQUAL( NULL, pos->seg->next );
+    TEST_ASSERT_EQUAL( NULL, fn_prev( pos->seg ) );
+    TEST_ASSERT_EQUAL( NULL, fn_next( pos->seg ) );
 
     ref = *pos;
 
@@ -371,8 +377,8 @@ void test_corners( void )
     ref.icnt = 1;
     check_pos( &ref, pos );
     TEST_ASSERT_EQUAL( 1, pos->seg->used );
-    TEST_ASSERT_EQUAL( NULL, pos->seg->prev );
-    TEST_ASSERT_EQUAL( NULL, pos->seg->next );
+    TEST_ASSERT_EQUAL( NULL, fn_prev( pos->seg ) );
+    TEST_ASSERT_EQUAL( NULL, fn_next( pos->seg ) );
 
     /* x... -> ....
      * ^       ^
@@ -382,8 +388,8 @@ void test_corners( void )
     ref.icnt = 0;
     check_pos( &ref, pos );
     TEST_ASSERT_EQUAL( 0, pos->seg->used );
-    TEST_ASSERT_EQUAL( NULL, pos->seg->prev );
-    TEST_ASSERT_EQUAL( NULL, pos->seg->next );
+    TEST_ASSERT_EQUAL( NULL, fn_prev( pos->seg ) );
+    TEST_ASSERT_EQUAL( NULL, fn_next( pos->seg ) );
 
     /* .... -> xxx.
      * ^         ^
@@ -395,8 +401,8 @@ void test_corners( void )
     ref.idx = 2;
     check_pos( &ref, pos );
     TEST_ASSERT_EQUAL( 3, pos->seg->used );
-    TEST_ASSERT_EQUAL( NULL, pos->seg->prev );
-    TEST_ASSERT_EQUAL( NULL, pos->seg->next );
+    TEST_ASSERT_EQUAL( NULL, fn_prev( pos->seg ) );
+    TEST_ASSERT_EQUAL( NULL, fn_next( pos->seg ) );
 
     /* xxx. -> xx..
      *   ^      ^
@@ -407,8 +413,8 @@ void test_corners( void )
     ref.idx = 1;
     check_pos( &ref, pos );
     TEST_ASSERT_EQUAL( 2, pos->seg->used );
-    TEST_ASSERT_EQUAL( NULL, pos->seg->prev );
-    TEST_ASSERT_EQUAL( NULL, pos->seg->next );
+    TEST_ASSERT_EQUAL( NULL, fn_prev( pos->seg ) );
+    TEST_ASSERT_EQUAL( NULL, fn_next( pos->seg ) );
 
     /* xx.. -> xxxx
      *  ^         ^
@@ -419,8 +425,8 @@ void test_corners( void )
     ref.idx = 3;
     check_pos( &ref, pos );
     TEST_ASSERT_EQUAL( 4, pos->seg->used );
-    TEST_ASSERT_EQUAL( NULL, pos->seg->prev );
-    TEST_ASSERT_EQUAL( NULL, pos->seg->next );
+    TEST_ASSERT_EQUAL( NULL, fn_prev( pos->seg ) );
+    TEST_ASSERT_EQUAL( NULL, fn_next( pos->seg ) );
 
     /* xxxx-.... -> xxxx-x...
      *    ^              ^
@@ -433,8 +439,8 @@ void test_corners( void )
     ref.seg = pos->seg;
     check_pos( &ref, pos );
     TEST_ASSERT_EQUAL( 1, pos->seg->used );
-    TEST_ASSERT_EQUAL( seg, pos->seg->prev );
-    TEST_ASSERT_EQUAL( NULL, pos->seg->next );
+    TEST_ASSERT_EQUAL( seg, fn_prev( pos->seg ) );
+    TEST_ASSERT_EQUAL( NULL, fn_next( pos->seg ) );
 
     /* xxxx-x... -> xxxx-xx...
      *      ^             ^
@@ -445,8 +451,8 @@ void test_corners( void )
     ref.ncnt = 2;
     check_pos( &ref, pos );
     TEST_ASSERT_EQUAL( 2, pos->seg->used );
-    TEST_ASSERT_EQUAL( seg, pos->seg->prev );
-    TEST_ASSERT_EQUAL( NULL, pos->seg->next );
+    TEST_ASSERT_EQUAL( seg, fn_prev( pos->seg ) );
+    TEST_ASSERT_EQUAL( NULL, fn_next( pos->seg ) );
 
     /* xxxx-xx.. -> xxxx-x...
      *       ^           ^
@@ -458,8 +464,8 @@ void test_corners( void )
     ref.ncnt = 2;
     check_pos( &ref, pos );
     TEST_ASSERT_EQUAL( 1, pos->seg->used );
-    TEST_ASSERT_EQUAL( seg, pos->seg->prev );
-    TEST_ASSERT_EQUAL( NULL, pos->seg->next );
+    TEST_ASSERT_EQUAL( seg, fn_prev( pos->seg ) );
+    TEST_ASSERT_EQUAL( NULL, fn_next( pos->seg ) );
 
     /* xxxx-x... -> xxx5-xx..
      *      ^          ^
@@ -473,8 +479,8 @@ void test_corners( void )
     ref.seg = pos->seg;
     check_pos( &ref, pos );
     TEST_ASSERT_EQUAL( 4, pos->seg->used );
-    TEST_ASSERT_EQUAL( NULL, pos->seg->prev );
-    TEST_ASSERT_EQUAL( seg, pos->seg->next );
+    TEST_ASSERT_EQUAL( NULL, fn_prev( pos->seg ) );
+    TEST_ASSERT_EQUAL( seg, fn_next( pos->seg ) );
 
     /* xxx5-xx.. -> xxx5-xxx.
      *    ^              ^
@@ -625,8 +631,8 @@ void test_find( void )
     ref = fr_find( pos, &( items[ 127 ] ) );
     TEST_ASSERT_FALSE( fr_at_first( &ref ) );
     TEST_ASSERT_TRUE( fr_at_last( &ref ) );
-    TEST_ASSERT_EQUAL( NULL, ref.seg->next );
-    TEST_ASSERT_TRUE( ref.seg->prev );
+    TEST_ASSERT_EQUAL( NULL, fn_next( ref.seg ) );
+    TEST_ASSERT_TRUE( fn_prev( ref.seg ) );
 
     /* Item is not find. */
     ref = fr_find( pos, &( items[ limit ] ) );
@@ -635,8 +641,8 @@ void test_find( void )
     /* Item is found. */
     ref = fr_find_with( pos, &( items[ FR_SEG_MIN - 1 ] ), find_comp );
     TEST_ASSERT_FALSE( fr_at_last( &ref ) );
-    TEST_ASSERT_EQUAL( NULL, ref.seg->prev );
-    TEST_ASSERT_TRUE( ref.seg->next );
+    TEST_ASSERT_EQUAL( NULL, fn_prev( ref.seg ) );
+    TEST_ASSERT_TRUE( fn_next( ref.seg ) );
 
     /* Item is not found. */
     ref = fr_find_with( pos, &( items[ limit ] ), find_comp );
@@ -645,8 +651,8 @@ void test_find( void )
     /* Item is found. */
     ref = fr_find_sorted_with( pos, &( items[ 2 * FR_SEG_MIN - 1 ] ), find_comp );
     TEST_ASSERT_FALSE( fr_at_last( &ref ) );
-    TEST_ASSERT_TRUE( ref.seg->prev );
-    TEST_ASSERT_TRUE( ref.seg->next );
+    TEST_ASSERT_TRUE( fn_prev( ref.seg ) );
+    TEST_ASSERT_TRUE( fn_next( ref.seg ) );
 
     /* Item is not found. */
     *pos = fr_first( pos );
@@ -798,11 +804,11 @@ void test_pack( void )
     ret = fr_pack_range( &tmp, NULL, 3 * FR_SEG_MIN );
     TEST_ASSERT_EQUAL( 0, ret );
 
-    tmp2.seg = tmp.seg->prev;
+    tmp2.seg = fn_prev( tmp.seg );
     ret = fr_pack_range( &tmp2, &tmp, 3 * FR_SEG_MIN / 2 );
     TEST_ASSERT_EQUAL( 0, ret );
 
-    tmp2.seg = tmp.seg->prev;
+    tmp2.seg = fn_prev( tmp.seg );
     ret = fr_pack_range( &tmp2, &tmp, 3 * FR_SEG_MIN / 2 );
     TEST_ASSERT_EQUAL( 0, ret );
 
@@ -867,3 +873,2783 @@ void test_iteration( void )
 
     fr_destroy( pos );
 }
+
+
+void test_adaptive( void )
+{
+    fr_t pos;
+    int  limit = 2000;
+    int  items[ limit ];
+    int  ref[ limit ];
+    int  cnt;
+    int  move;
+
+    pos = fr_create_adaptive( FR_SEG_MIN, 8 * FR_SEG_MIN );
+    TEST_ASSERT_EQUAL( FR_SEG_MIN, fr_size( pos ) );
+    TEST_ASSERT_EQUAL( FR_SEG_MIN, fr_capacity( pos ) );
+
+    for ( int i = 0; i < limit; i++ ) {
+        items[ i ] = i;
+        fr_push( pos, &( items[ i ] ) );
+    }
+
+    /* Segment size has grown upto limit. */
+    TEST_ASSERT_EQUAL( 8 * FR_SEG_MIN, fr_size( pos ) );
+    TEST_ASSERT_EQUAL( 8 * FR_SEG_MIN, fr_capacity( pos ) );
+    TEST_ASSERT_TRUE( fr_node_count( pos ) < limit / FR_SEG_MIN );
+
+    fr_to_first( pos );
+    TEST_ASSERT_EQUAL( FR_SEG_MIN, fr_capacity( pos ) );
+
+    for ( int i = 0; i < limit; i++ ) {
+        TEST_ASSERT_EQUAL( i, *( fr_cur( pos, int* ) ) );
+        TEST_ASSERT_TRUE( fr_used( pos ) <= fr_capacity( pos ) );
+        fr_next( pos );
+    }
+
+    fr_destroy( pos );
+
+
+    /* Random edits over mixed capacity Nodes. */
+
+    srand( 4321 );
+
+    pos = fr_create_adaptive( FR_SEG_MIN, 4 * FR_SEG_MIN );
+    cnt = 0;
+
+    for ( int i = 0; i < limit; i++ ) {
+        items[ i ] = i;
+        fr_to_first( pos );
+        move = rand_within( cnt );
+        fr_next_n( pos, move );
+        if ( rand_within( 4 ) == 0 )
+            move = cnt;
+        if ( move == cnt && cnt > 0 ) {
+            fr_to_last( pos );
+            fr_append( pos, &( items[ i ] ) );
+        } else {
+            fr_insert( pos, &( items[ i ] ) );
+        }
+        memmove( &( ref[ move + 1 ] ), &( ref[ move ] ), ( cnt - move ) * sizeof( int ) );
+        ref[ move ] = i;
+        cnt++;
+    }
+
+    TEST_ASSERT_EQUAL( cnt, fr_length( pos ) );
+
+    for ( int i = 0; i < limit / 2; i++ ) {
+        fr_to_first( pos );
+        move = rand_within( cnt );
+        fr_next_n( pos, move );
+        TEST_ASSERT_EQUAL( ref[ move ], *( (int*)fr_delete_even( pos ) ) );
+        memmove( &( ref[ move ] ), &( ref[ move + 1 ] ), ( cnt - move - 1 ) * sizeof( int ) );
+        cnt--;
+    }
+
+    fr_to_first( pos );
+    for ( int i = 0; i < cnt; i++ ) {
+        TEST_ASSERT_EQUAL( ref[ i ], *( fr_cur( pos, int* ) ) );
+        TEST_ASSERT_TRUE( fr_used( pos ) <= fr_capacity( pos ) );
+        fr_next( pos );
+    }
+
+    fr_to_first( pos );
+    TEST_ASSERT_EQUAL( 1, fr_pack_range( pos, NULL, 3 * FR_SEG_MIN ) );
+
+    fr_to_first( pos );
+    for ( int i = 0; i < cnt; i++ ) {
+        TEST_ASSERT_EQUAL( ref[ i ], *( fr_cur( pos, int* ) ) );
+        TEST_ASSERT_TRUE( fr_used( pos ) <= fr_capacity( pos ) );
+        fr_next( pos );
+    }
+
+    fr_destroy( pos );
+}
+
+
+void test_compact( void )
+{
+    fr_t       pos;
+    fr_s       cur;
+    fr_stats_s st;
+    int        limit = 40 * FR_SEG_MIN;
+    int        items[ limit ];
+    fr_size_t  work;
+    fr_size_t  total;
+    int        i;
+
+    pos = fr_create_sized( FR_SEG_MIN );
+
+    for ( i = 0; i < limit; i++ ) {
+        items[ i ] = i;
+        fr_push( pos, &( items[ i ] ) );
+    }
+
+    /* Delete every other item, leaving Nodes half full. */
+    fr_to_first( pos );
+    for ( i = 0; i < limit / 2; i++ ) {
+        fr_delete( pos );
+        fr_next( pos );
+    }
+
+    TEST_ASSERT_EQUAL( limit / 2, fr_length( pos ) );
+    TEST_ASSERT_EQUAL( 40, fr_node_count( pos ) );
+
+    /* Framer Position is in a Node that is emptied. */
+    fr_to_first( pos );
+    fr_next_n( pos, FR_SEG_MIN - 1 );
+    TEST_ASSERT_EQUAL( 2 * FR_SEG_MIN - 1, *( fr_cur( pos, int* ) ) );
+
+    cur = fr_first( pos );
+    total = 0;
+    while ( ( work = fr_compact_step( pos, &cur, 3 ) ) ) {
+        TEST_ASSERT_TRUE( work <= 3 );
+        total += work;
+        TEST_ASSERT_EQUAL( 2 * FR_SEG_MIN - 1, *( fr_cur( pos, int* ) ) );
+    }
+
+    TEST_ASSERT_TRUE( total >= limit / 4 );
+    TEST_ASSERT_EQUAL( 0, fr_compact_step( pos, &cur, 3 ) );
+
+    /* Counts of Framer Position are maintained. */
+    fr_stats( pos, &st );
+    TEST_ASSERT_EQUAL( 20, st.nodes );
+    TEST_ASSERT_EQUAL( 20, fr_node_count( pos ) );
+    TEST_ASSERT_EQUAL( st.bytes, fr_memory_bytes( pos ) );
+
+    /* Items are in order and Nodes are full. */
+    cur = fr_first( pos );
+    for ( i = 0; i < limit / 2; i++ ) {
+        TEST_ASSERT_EQUAL( 2 * i + 1, *( fr_cur( &cur, int* ) ) );
+        TEST_ASSERT_EQUAL( FR_SEG_MIN, fr_used( &cur ) );
+        fr_next( &cur );
+    }
+
+    /* Interleaved with pushes, and reset after deletes. */
+    fr_to_first( pos );
+    for ( i = 0; i < limit / 4; i++ ) {
+        fr_delete( pos );
+        fr_next( pos );
+    }
+    cur = fr_first( pos );
+    fr_compact_step( pos, &cur, 4 );
+    fr_to_last( pos );
+    for ( i = 0; i < 2 * FR_SEG_MIN; i++ )
+        fr_push( pos, &( items[ i ] ) );
+    fr_compact_step( pos, &cur, 4 );
+    fr_to_first( pos );
+    fr_delete( pos );
+    cur = fr_first( pos );
+    while ( fr_compact_step( pos, &cur, 4 ) )
+        ;
+    TEST_ASSERT_EQUAL( limit / 4 - 1 + 2 * FR_SEG_MIN, fr_length( pos ) );
+    TEST_ASSERT_EQUAL( ( fr_length( pos ) + FR_SEG_MIN - 1 ) / FR_SEG_MIN, fr_node_count( pos ) );
+
+    fr_destroy( pos );
+}
+
+
+void check_order( fr_t pos, int* ref, int cnt )
+{
+    fr_s tmp = fr_first( pos );
+
+    for ( int i = 0; i < cnt; i++ ) {
+        TEST_ASSERT_EQUAL( ref[ i ], *( fr_cur( &tmp, int* ) ) );
+        fr_next( &tmp );
+    }
+}
+
+
+void test_defrag( void )
+{
+    fr_t pos;
+    fr_s a;
+    fr_s b;
+    fr_p live;
+    fn_t seg;
+    int  limit = 50 * FR_SEG_MIN;
+    int  items[ limit ];
+    int  ref[ limit ];
+    int  cnt;
+
+    for ( int rnd = 0; rnd < 3; rnd++ ) {
+
+        if ( rnd < 2 )
+            pos = fr_create_sized( FR_SEG_MIN );
+        else
+            pos = fr_create_using(
+                fr_pos_new_with_mem( NULL, FR_SEG_MIN, my_mem_api_alloc, my_mem_api_free, NULL ) );
+
+        for ( int i = 0; i < limit; i++ ) {
+            items[ i ] = i;
+            fr_push( pos, &( items[ i ] ) );
+        }
+
+        /* Churn. */
+        fr_to_first( pos );
+        cnt = 0;
+        for ( int i = 0; i < limit; i++ ) {
+            if ( i % 3 == 0 ) {
+                fr_delete( pos );
+            } else {
+                ref[ cnt++ ] = i;
+                fr_next( pos );
+            }
+        }
+
+        a = fr_first( pos );
+        fr_next_n( &a, 7 );
+        b = fr_first( pos );
+        fr_next_n( &b, cnt - 2 );
+        fr_s* lp[ 2 ] = { &a, &b };
+        live = lp;
+
+        fr_defrag( pos, live, 2, rnd == 1 );
+
+        TEST_ASSERT_EQUAL( ref[ 7 ], *( fr_cur( &a, int* ) ) );
+        TEST_ASSERT_EQUAL( ref[ cnt - 2 ], *( fr_cur( &b, int* ) ) );
+        TEST_ASSERT_EQUAL( a.mem, pos->mem );
+        check_order( pos, ref, cnt );
+
+        /* Nodes are consecutive in memory. */
+        seg = fr_first( pos ).seg;
+        while ( fn_next( seg ) ) {
+            TEST_ASSERT_TRUE( (char*)fn_next( seg ) > (char*)seg );
+            seg = fn_next( seg );
+        }
+        if ( rnd == 1 )
+            TEST_ASSERT_EQUAL( ( cnt + FR_SEG_MIN - 1 ) / FR_SEG_MIN, fr_node_count( pos ) );
+
+        /* Edits after defrag, with reuse of arena and overflow. */
+        fr_to_first( pos );
+        for ( int i = 0; i < cnt / 2; i++ )
+            fr_delete( pos );
+        fr_to_last( pos );
+        for ( int i = 0; i < limit; i++ )
+            fr_push( pos, &( items[ i ] ) );
+
+        fr_defrag( pos, NULL, 0, 1 );
+        fr_to_first( pos );
+        TEST_ASSERT_EQUAL( ref[ cnt / 2 ], *( fr_cur( pos, int* ) ) );
+        check_order( pos, &( ref[ cnt / 2 ] ), cnt - cnt / 2 );
+
+        fr_destroy( pos );
+    }
+}
+
+
+fr_size_t stats_node_bytes( fr_size_t size )
+{
+    fr_size_t line = fr_cache_line_size();
+
+    if ( line < FR_CACHE_LINE_SIZE )
+        line = FR_CACHE_LINE_SIZE;
+    return ( FR_NODE_SIZE + size * FR_ITEM_SIZE + line - 1 ) / line * line;
+}
+
+
+void test_stats( void )
+{
+    fr_t       pos;
+    fr_s       cur;
+    fr_stats_s st;
+    int        limit = 20 * FR_SEG_MIN;
+    int        items[ limit ];
+    fr_size_t  bin_sum;
+    fr_size_t  raw;
+
+    pos = fr_create_sized( FR_SEG_MIN );
+    TEST_ASSERT_EQUAL( stats_node_bytes( FR_SEG_MIN ), fr_memory_bytes( pos ) );
+
+    for ( int i = 0; i < limit; i++ ) {
+        items[ i ] = i;
+        fr_push( pos, &( items[ i ] ) );
+    }
+
+    fr_stats( pos, &st );
+    TEST_ASSERT_EQUAL( 20, st.nodes );
+    TEST_ASSERT_EQUAL( limit, st.items );
+    TEST_ASSERT_EQUAL( limit, st.slots );
+    TEST_ASSERT_EQUAL( 20 * FR_NODE_SIZE, st.header );
+    TEST_ASSERT_EQUAL( 20 * stats_node_bytes( FR_SEG_MIN ), st.bytes );
+    TEST_ASSERT_EQUAL( st.bytes, fr_memory_bytes( pos ) );
+    TEST_ASSERT_EQUAL( 0, st.under );
+    TEST_ASSERT_EQUAL( 20, st.fill[ FR_STATS_BINS ] );
+
+    /* Leave 1 item to every Node. */
+    fr_to_first( pos );
+    for ( int i = 0; i < 20; i++ ) {
+        for ( int j = 0; j < FR_SEG_MIN - 1; j++ )
+            fr_delete( pos );
+        fr_next( pos );
+    }
+
+    fr_stats( pos, &st );
+    TEST_ASSERT_EQUAL( 20, st.nodes );
+    TEST_ASSERT_EQUAL( 20, st.items );
+    TEST_ASSERT_EQUAL( 20, st.under );
+    TEST_ASSERT_TRUE( st.under_ratio > 0.99 );
+    TEST_ASSERT_EQUAL( 20, st.fill[ FR_STATS_BINS / FR_SEG_MIN ] );
+
+    /* Byte count follows Node releases. */
+    cur = fr_first( pos );
+    while ( fr_compact_step( pos, &cur, 16 ) )
+        ;
+    fr_stats( pos, &st );
+    TEST_ASSERT_EQUAL( 5, st.nodes );
+    TEST_ASSERT_EQUAL( st.bytes, fr_memory_bytes( pos ) );
+
+    bin_sum = 0;
+    for ( int i = 0; i <= FR_STATS_BINS; i++ )
+        bin_sum += st.fill[ i ];
+    TEST_ASSERT_EQUAL( st.nodes, bin_sum );
+
+    fr_destroy( pos );
+
+
+    pos = fr_create_adaptive( FR_SEG_MIN, 4 * FR_SEG_MIN );
+    for ( int i = 0; i < limit; i++ )
+        fr_push( pos, &( items[ i ] ) );
+    fr_stats( pos, &st );
+    TEST_ASSERT_EQUAL( st.bytes, fr_memory_bytes( pos ) );
+    raw = st.nodes * FR_NODE_SIZE + st.slots * FR_ITEM_SIZE;
+    TEST_ASSERT_TRUE( raw <= st.bytes );
+    TEST_ASSERT_EQUAL( 0, st.bytes % fr_cache_line_size() );
+
+    fr_defrag( pos, NULL, 0, 1 );
+    fr_stats( pos, &st );
+    TEST_ASSERT_EQUAL( st.bytes, fr_memory_bytes( pos ) );
+
+    fr_destroy( pos );
+}
+
+
+void test_cache_line( void )
+{
+    fr_t      pos;
+    fr_size_t line;
+    int       limit = 10 * FR_SEG_MIN;
+    int       items[ limit ];
+
+    line = fr_cache_line_size();
+    TEST_ASSERT_TRUE( line >= 16 );
+    TEST_ASSERT_EQUAL( 0, line & ( line - 1 ) );
+
+    /* Whole cache lines. */
+    for ( fr_size_t lines = 1; lines <= 4; lines++ ) {
+        fr_size_t size = fr_seg_lines( lines );
+        TEST_ASSERT_TRUE( size >= FR_SEG_MIN );
+        fr_size_t bytes = FR_NODE_SIZE + size * FR_ITEM_SIZE;
+        if ( lines * line >= (fr_size_t)( FR_NODE_SIZE + FR_SEG_MIN * FR_ITEM_SIZE ) ) {
+            TEST_ASSERT_TRUE( bytes <= lines * line );
+            TEST_ASSERT_TRUE( bytes + (fr_size_t)FR_ITEM_SIZE > lines * line );
+        }
+    }
+
+    pos = fr_create_sized( fr_seg_lines( 2 ) );
+    for ( int i = 0; i < limit; i++ ) {
+        items[ i ] = i;
+        fr_push( pos, &( items[ i ] ) );
+    }
+
+    /* Nodes are cache line aligned. */
+    fr_to_first( pos );
+    do {
+        TEST_ASSERT_EQUAL( 0, ( (uintptr_t)pos->seg ) % line );
+    } while ( fr_next_n( pos, fr_used( pos ) ) );
+
+    fr_defrag( pos, NULL, 0, 0 );
+    fr_to_first( pos );
+    do {
+        TEST_ASSERT_EQUAL( 0, ( (uintptr_t)pos->seg ) % line );
+    } while ( fr_next_n( pos, fr_used( pos ) ) );
+
+    fr_destroy( pos );
+}
+
+
+void test_links( void )
+{
+    fr_t pos;
+    fn_t seg;
+    int  limit = 10 * FR_SEG_MIN;
+    int  items[ limit ];
+
+    TEST_ASSERT_EQUAL( offsetof( fn_s, data ), FR_NODE_SIZE );
+
+#if defined( FRAMER_COMPACT_LINKS ) && !defined( FRAMER_USE_CURSORS ) && \
+    !defined( FRAMER_USE_NODE_LOCKS ) && !defined( FRAMER_USE_SNAPSHOTS ) && \
+    !defined( FRAMER_USE_DIRTY ) && !defined( FRAMER_USE_GAPS )
+    TEST_ASSERT_EQUAL( 16, FR_NODE_SIZE );
+    TEST_ASSERT_TRUE( FR_SEG_DEFAULT >= 6 );
+#endif
+
+    pos = fr_create_sized( FR_SEG_MIN );
+    for ( int i = 0; i < limit; i++ ) {
+        items[ i ] = i;
+        fr_push( pos, &( items[ i ] ) );
+    }
+
+    /* Links are symmetric. */
+    seg = fr_first( pos ).seg;
+    TEST_ASSERT_EQUAL( NULL, fn_prev( seg ) );
+    while ( fn_next( seg ) ) {
+        TEST_ASSERT_EQUAL( seg, fn_prev( fn_next( seg ) ) );
+        seg = fn_next( seg );
+    }
+    TEST_ASSERT_EQUAL( pos->seg, seg );
+
+#ifdef FRAMER_COMPACT_LINKS
+    {
+        /* Arena is relocatable. */
+        fr_arena_t arena;
+        char*      raw;
+        char*      copy;
+        fr_s       tmp;
+
+        fr_defrag( pos, NULL, 0, 0 );
+        arena = pos->mem->env;
+        raw = malloc( arena->cnt * arena->slot + FR_LINK_UNIT );
+        copy = (char*)( ( (uintptr_t)raw + FR_LINK_UNIT ) & ~( (uintptr_t)FR_LINK_UNIT - 1 ) );
+        memcpy( copy, arena->base, arena->cnt * arena->slot );
+
+        tmp = fr_first( pos );
+        tmp.seg = (fn_t)( copy + ( (char*)tmp.seg - arena->base ) );
+        for ( int i = 0; i < limit; i++ ) {
+            TEST_ASSERT_EQUAL( &( items[ i ] ), fr_item( &tmp ) );
+            fr_next( &tmp );
+        }
+        free( raw );
+
+        /* Node space exhaustion is an error. */
+        TEST_ASSERT_EQUAL( NULL, fr_create_sized( FR_LINK_SPACE ) );
+        TEST_ASSERT_EQUAL( NULL, fr_create_adaptive( FR_LINK_SPACE, FR_LINK_SPACE ) );
+
+        /* Large free runs are reused after returning pages to the OS. */
+        for ( int round = 0; round < 2; round++ ) {
+            fr_t big = fr_create_sized( (fr_size_t)1 << 18 );
+            for ( int i = 0; i < limit; i++ )
+                fr_push( big, &( items[ i ] ) );
+            fr_to_first( big );
+            for ( int i = 0; i < limit; i++ ) {
+                TEST_ASSERT_EQUAL( &( items[ i ] ), fr_item( big ) );
+                fr_next( big );
+            }
+            fr_destroy( big );
+        }
+    }
+#endif
+
+    fr_destroy( pos );
+}
+
+
+void test_small( void )
+{
+    fr_small_s sm = { 0 };
+    int        limit = 4 * FR_SMALL_SIZE;
+    int        items[ limit ];
+    fr_t       pos;
+
+    TEST_ASSERT_TRUE( sizeof( fr_small_s ) <= FR_CACHE_LINE_SIZE );
+
+    /* Empty and inline. */
+    TEST_ASSERT_EQUAL( 0, fr_small_length( &sm ) );
+    TEST_ASSERT_EQUAL( NULL, fr_small_item( &sm, 0 ) );
+    TEST_ASSERT_EQUAL( NULL, fr_small_delete( &sm, 0 ) );
+
+    for ( int i = 0; i < limit; i++ )
+        items[ i ] = i;
+
+    /* Odd items pushed, even items inserted in between. */
+    for ( int i = 1; i < (int)FR_SMALL_SIZE; i += 2 )
+        fr_small_push( &sm, &( items[ i ] ) );
+    TEST_ASSERT_EQUAL( NULL, sm.pos );
+
+    for ( int i = 0; i < limit; i += 2 ) {
+        if ( i + 1 >= (int)FR_SMALL_SIZE )
+            fr_small_push( &sm, &( items[ i + 1 ] ) );
+        fr_small_insert( &sm, i, &( items[ i ] ) );
+    }
+    TEST_ASSERT_TRUE( sm.pos != NULL );
+    TEST_ASSERT_EQUAL( limit, fr_small_length( &sm ) );
+
+    for ( int i = 0; i < limit; i++ )
+        TEST_ASSERT_EQUAL( &( items[ i ] ), fr_small_item( &sm, i ) );
+
+    /* Normal Framer access. */
+    pos = fr_small_pos( &sm );
+    fr_to_first( pos );
+    TEST_ASSERT_EQUAL( &( items[ 0 ] ), fr_item( pos ) );
+    fr_to_last( pos );
+    TEST_ASSERT_EQUAL( &( items[ limit - 1 ] ), fr_item( pos ) );
+
+    /* Delete back to inline. */
+    for ( int i = limit - 1; i >= 1; i -= 2 )
+        TEST_ASSERT_EQUAL( &( items[ i ] ), fr_small_delete( &sm, i ) );
+    while ( fr_small_length( &sm ) > (fr_size_t)FR_SMALL_SIZE / 2 )
+        fr_small_delete( &sm, fr_small_length( &sm ) - 1 );
+    TEST_ASSERT_EQUAL( NULL, sm.pos );
+
+    for ( int i = 0; i < fr_small_length( &sm ); i++ )
+        TEST_ASSERT_EQUAL( &( items[ 2 * i ] ), fr_small_item( &sm, i ) );
+
+    while ( fr_small_length( &sm ) > 0 )
+        fr_small_delete( &sm, 0 );
+    TEST_ASSERT_EQUAL( NULL, sm.pos );
+
+    /* Clear after growth. */
+    for ( int i = 0; i < limit; i++ )
+        fr_small_push( &sm, &( items[ i ] ) );
+    fr_small_clear( &sm );
+    TEST_ASSERT_EQUAL( NULL, sm.pos );
+    TEST_ASSERT_EQUAL( 0, fr_small_length( &sm ) );
+}
+
+
+#define SYNC_ITEMS 2000
+
+int sync_items[ SYNC_ITEMS ];
+
+void* sync_reader( void* arg )
+{
+    fr_sync_t sync = arg;
+
+    for ( int n = 0; n < 100; n++ ) {
+
+        fr_s      pos = fr_sync_read_begin( sync );
+        fr_s      cur = fr_first( &pos );
+        fr_size_t cnt = 0;
+        int*      item;
+
+        fr_each( &cur, item, int* )
+        {
+            if ( item ) {
+                /* Items are in order and complete. */
+                TEST_ASSERT_EQUAL( &( sync_items[ cnt ] ), item );
+                cnt++;
+            }
+        }
+        TEST_ASSERT_EQUAL( pos.icnt, cnt );
+
+        fr_sync_read_end( sync );
+        sched_yield();
+    }
+
+    return NULL;
+}
+
+
+void test_sync( void )
+{
+    fr_sync_t sync;
+    pthread_t readers[ 4 ];
+    fr_size_t gen;
+    fr_t      pos;
+
+    sync = fr_sync_new( fr_create_sized( FR_SEG_MIN ) );
+    TEST_ASSERT_EQUAL( 0, fr_sync_gen( sync ) );
+
+    for ( int i = 0; i < 4; i++ )
+        pthread_create( &( readers[ i ] ), NULL, sync_reader, sync );
+
+    for ( int i = 0; i < SYNC_ITEMS; i += 10 ) {
+        pos = fr_sync_write_begin( sync );
+        for ( int j = i; j < i + 10; j++ ) {
+            sync_items[ j ] = j;
+            fr_push( pos, &( sync_items[ j ] ) );
+        }
+        fr_sync_write_end( sync );
+    }
+
+    for ( int i = 0; i < 4; i++ )
+        pthread_join( readers[ i ], NULL );
+
+    gen = fr_sync_gen( sync );
+    TEST_ASSERT_EQUAL( SYNC_ITEMS / 10, gen );
+
+    /* Reader Position is valid while generation is unchanged. */
+    {
+        fr_s cur = fr_sync_read_begin( sync );
+        fr_sync_read_end( sync );
+        fr_sync_read_begin( sync );
+        TEST_ASSERT_EQUAL( gen, fr_sync_gen( sync ) );
+        TEST_ASSERT_EQUAL( &( sync_items[ SYNC_ITEMS - 1 ] ), fr_item( &cur ) );
+        fr_sync_read_end( sync );
+    }
+
+    fr_sync_destroy( sync );
+}
+
+
+#ifdef FRAMER_USE_CURSORS
+
+#define CURS_ITEMS 400
+#define CURS_CNT 40
+#define CURS_OPS 4000
+
+fr_s curs_seek( fr_t pos, int idx )
+{
+    fr_s tmp = fr_first( pos );
+    for ( int i = 0; i < idx; i++ )
+        fr_next( &tmp );
+    return tmp;
+}
+
+#endif
+
+
+void test_cursors( void )
+{
+#ifdef FRAMER_USE_CURSORS
+
+    fr_t        pos;
+    fr_s        tmp;
+    fr_cursor_t curs[ CURS_CNT ];
+    int*        expect[ CURS_CNT ];
+    int*        model[ 2 * CURS_ITEMS ];
+    int         items[ CURS_ITEMS + CURS_OPS ];
+    int         len = 0;
+    int         idx;
+
+    srand( 4321 );
+
+    pos = fr_create_sized( FR_SEG_MIN );
+    for ( int i = 0; i < CURS_ITEMS; i++ ) {
+        items[ i ] = i;
+        model[ len++ ] = &( items[ i ] );
+        fr_push( pos, &( items[ i ] ) );
+    }
+
+    for ( int c = 0; c < CURS_CNT; c++ ) {
+        idx = rand_within( len );
+        tmp = curs_seek( pos, idx );
+        curs[ c ] = fr_cursor_new( &tmp );
+        expect[ c ] = model[ idx ];
+    }
+
+    for ( int op = 0; op < CURS_OPS; op++ ) {
+
+        int kind = rand_within( 10 );
+
+        if ( kind < 4 && len < 2 * CURS_ITEMS ) {
+
+            /* Insert. */
+            idx = rand_within( len );
+            tmp = curs_seek( pos, idx );
+            items[ CURS_ITEMS + op ] = op;
+            fr_insert( &tmp, &( items[ CURS_ITEMS + op ] ) );
+            memmove( &( model[ idx + 1 ] ), &( model[ idx ] ), ( len - idx ) * sizeof( int* ) );
+            model[ idx ] = &( items[ CURS_ITEMS + op ] );
+            len++;
+
+        } else if ( kind < 8 && len > 1 ) {
+
+            /* Delete, cursors move to next (or prev). */
+            idx = rand_within( len );
+            tmp = curs_seek( pos, idx );
+            if ( kind & 1 )
+                fr_delete( &tmp );
+            else
+                fr_delete_even( &tmp );
+            for ( int c = 0; c < CURS_CNT; c++ ) {
+                if ( expect[ c ] == model[ idx ] )
+                    expect[ c ] = ( idx < len - 1 ) ? model[ idx + 1 ] : model[ idx - 1 ];
+            }
+            memmove( &( model[ idx ] ), &( model[ idx + 1 ] ), ( len - idx - 1 ) * sizeof( int* ) );
+            len--;
+
+        } else if ( kind == 8 ) {
+
+            tmp = fr_first( pos );
+            while ( fr_compact_step( pos, &tmp, 8 ) )
+                ;
+            fr_pos_cpy( pos, &tmp );
+
+        } else {
+
+            tmp = fr_first( pos );
+            if ( op % 3 == 0 )
+                fr_defrag( &tmp, NULL, 0, op & 1 );
+            else
+                fr_pack_range( &tmp, NULL, FR_SEG_MIN );
+        }
+
+        fr_pos_cpy( &tmp, pos );
+
+        for ( int c = 0; c < CURS_CNT; c++ )
+            TEST_ASSERT_EQUAL( expect[ c ], fr_cursor_item( curs[ c ] ) );
+    }
+
+    /* Cursor navigation. */
+    tmp = fr_first( pos );
+    fr_cursor_set( curs[ 0 ], &tmp );
+    TEST_ASSERT_EQUAL( 0, fr_cursor_prev( curs[ 0 ] ) );
+    for ( int i = 1; i < len; i++ ) {
+        TEST_ASSERT_EQUAL( 1, fr_cursor_next( curs[ 0 ] ) );
+        TEST_ASSERT_EQUAL( model[ i ], fr_cursor_item( curs[ 0 ] ) );
+    }
+    TEST_ASSERT_EQUAL( 0, fr_cursor_next( curs[ 0 ] ) );
+    TEST_ASSERT_EQUAL( 1, fr_cursor_prev( curs[ 0 ] ) );
+    tmp = fr_cursor_pos( curs[ 0 ] );
+    TEST_ASSERT_EQUAL( model[ len - 2 ], fr_item( &tmp ) );
+
+    for ( int c = 0; c < CURS_CNT; c++ )
+        fr_cursor_del( curs[ c ] );
+
+    fr_destroy( pos );
+
+#endif
+}
+
+
+#define QUEUE_ITEMS 200000
+
+void* queue_producer( void* arg )
+{
+    fr_queue_t queue = arg;
+    void*      batch[ 37 ];
+    intptr_t   i = 1;
+
+    while ( i <= QUEUE_ITEMS ) {
+        if ( i % 3 ) {
+            fr_queue_put( queue, (void*)i );
+            i++;
+        } else {
+            int n = 0;
+            while ( n < 37 && i <= QUEUE_ITEMS )
+                batch[ n++ ] = (void*)i++;
+            fr_queue_put_n( queue, batch, n );
+        }
+    }
+
+    return NULL;
+}
+
+
+void test_queue( void )
+{
+    fr_queue_t queue;
+    pthread_t  producer;
+    void*      batch[ 50 ];
+    intptr_t   expect = 1;
+    fr_size_t  n;
+
+    queue = fr_queue_new( FR_SEG_MIN );
+
+    /* Single thread. */
+    TEST_ASSERT_EQUAL( NULL, fr_queue_get( queue ) );
+    for ( intptr_t i = 1; i <= 10; i++ )
+        fr_queue_put( queue, (void*)i );
+    TEST_ASSERT_EQUAL( 10, fr_queue_get_n( queue, batch, 50 ) );
+    for ( intptr_t i = 1; i <= 10; i++ )
+        TEST_ASSERT_EQUAL( (void*)i, batch[ i - 1 ] );
+    TEST_ASSERT_EQUAL( NULL, fr_queue_get( queue ) );
+
+    /* Producer and consumer threads. */
+    pthread_create( &producer, NULL, queue_producer, queue );
+
+    while ( expect <= QUEUE_ITEMS ) {
+        if ( expect % 2 ) {
+            void* item = fr_queue_get( queue );
+            if ( item ) {
+                TEST_ASSERT_EQUAL( (void*)expect, item );
+                expect++;
+            }
+        } else {
+            n = fr_queue_get_n( queue, batch, 50 );
+            for ( fr_size_t i = 0; i < n; i++ ) {
+                TEST_ASSERT_EQUAL( (void*)expect, batch[ i ] );
+                expect++;
+            }
+        }
+    }
+
+    pthread_join( producer, NULL );
+    TEST_ASSERT_EQUAL( NULL, fr_queue_get( queue ) );
+
+    fr_queue_del( queue );
+}
+
+
+#define LOG_PRODUCERS 4
+#define LOG_ITEMS 20000
+
+intptr_t log_items[ LOG_PRODUCERS ][ LOG_ITEMS ];
+
+void* log_producer( void* arg )
+{
+    fr_log_t log = arg;
+    int      id;
+
+    /* Pick unused producer id. */
+    static int next_id = 0;
+    id = __atomic_fetch_add( &next_id, 1, __ATOMIC_RELAXED );
+
+    for ( int i = 0; i < LOG_ITEMS; i++ ) {
+        log_items[ id ][ i ] = ( id << 24 ) | i;
+        fr_log_push( log, &( log_items[ id ][ i ] ) );
+    }
+
+    return NULL;
+}
+
+
+void test_log( void )
+{
+    fr_log_t  log;
+    pthread_t producers[ LOG_PRODUCERS ];
+    fr_s      rd;
+    fr_t      pos;
+    int       last[ LOG_PRODUCERS ];
+    intptr_t* item;
+    fr_size_t cnt = 0;
+
+    log = fr_log_new( FR_SEG_MIN );
+    rd = fr_log_first( log );
+    TEST_ASSERT_EQUAL( NULL, fr_log_read( &rd ) );
+
+    for ( int i = 0; i < LOG_PRODUCERS; i++ ) {
+        last[ i ] = -1;
+        pthread_create( &( producers[ i ] ), NULL, log_producer, log );
+    }
+
+    /* Read committed prefix concurrently. Items of each producer are
+     * in order. */
+    while ( cnt < LOG_PRODUCERS * LOG_ITEMS ) {
+        item = fr_log_read( &rd );
+        if ( item ) {
+            int id = *item >> 24;
+            TEST_ASSERT_EQUAL( last[ id ] + 1, *item & 0xffffff );
+            last[ id ]++;
+            cnt++;
+        }
+    }
+
+    for ( int i = 0; i < LOG_PRODUCERS; i++ )
+        pthread_join( producers[ i ], NULL );
+    TEST_ASSERT_EQUAL( NULL, fr_log_read( &rd ) );
+
+    /* Closed to a normal Framer. */
+    pos = fr_log_close( log );
+    TEST_ASSERT_EQUAL( LOG_PRODUCERS * LOG_ITEMS, fr_length( pos ) );
+    TEST_ASSERT_EQUAL( LOG_PRODUCERS * LOG_ITEMS, fr_tail_length( pos ) );
+    fr_to_last( pos );
+    fr_push( pos, &( log_items[ 0 ][ 0 ] ) );
+    TEST_ASSERT_EQUAL( LOG_PRODUCERS * LOG_ITEMS + 1, fr_length( pos ) );
+
+    fr_destroy( pos );
+}
+
+
+#ifdef FRAMER_USE_NODE_LOCKS
+
+#define LOCK_THREADS 4
+#define LOCK_REGION 1000
+
+int  lock_items[ LOCK_THREADS * LOCK_REGION ];
+fr_s lock_pos[ LOCK_THREADS ];
+
+void* lock_editor( void* arg )
+{
+    intptr_t id = (intptr_t)arg;
+    int      extra[ 16 ];
+    fr_s     pos = lock_pos[ id ];
+
+    for ( int n = 0; n < 200; n++ ) {
+        for ( int i = 0; i < 16; i++ )
+            fr_insert_locked( &pos, &( extra[ i ] ) );
+        for ( int i = 15; i >= 0; i-- )
+            TEST_ASSERT_EQUAL( &( extra[ i ] ), fr_delete_locked( &pos ) );
+    }
+
+    TEST_ASSERT_EQUAL( &( lock_items[ id * LOCK_REGION + LOCK_REGION / 2 ] ),
+                       fr_item_locked( &pos ) );
+
+    /* Retired Nodes are reclaimed after all threads are done. */
+    lock_pos[ id ] = pos;
+
+    return NULL;
+}
+
+#endif
+
+
+void test_node_locks( void )
+{
+#ifdef FRAMER_USE_NODE_LOCKS
+
+    pthread_t threads[ LOCK_THREADS ];
+    fr_t      lock_framer;
+    fr_s      cur;
+    int*      item;
+    int       i;
+
+    lock_framer = fr_create_sized( 8 );
+    for ( i = 0; i < LOCK_THREADS * LOCK_REGION; i++ )
+        fr_push( lock_framer, &( lock_items[ i ] ) );
+
+    /* Each thread edits the middle of own region. */
+    for ( int t = 0; t < LOCK_THREADS; t++ ) {
+        lock_pos[ t ] = fr_first( lock_framer );
+        fr_next_n( &( lock_pos[ t ] ), t * LOCK_REGION + LOCK_REGION / 2 );
+    }
+
+    for ( intptr_t t = 0; t < LOCK_THREADS; t++ )
+        pthread_create( &( threads[ t ] ), NULL, lock_editor, (void*)t );
+    for ( int t = 0; t < LOCK_THREADS; t++ )
+        pthread_join( threads[ t ], NULL );
+    for ( int t = 0; t < LOCK_THREADS; t++ )
+        fr_locked_reclaim( &( lock_pos[ t ] ) );
+
+    cur = fr_first( lock_framer );
+    i = 0;
+    fr_each( &cur, item, int* )
+    {
+        TEST_ASSERT_EQUAL( &( lock_items[ i ] ), item );
+        i++;
+    }
+    TEST_ASSERT_EQUAL( LOCK_THREADS * LOCK_REGION, i );
+
+    fr_destroy( lock_framer );
+
+    /* Position in Node retired by another Position moves on. */
+    {
+        fr_s a;
+        fr_s b;
+
+        lock_framer = fr_create_sized( FR_SEG_MIN );
+        for ( i = 0; i < 3 * FR_SEG_MIN; i++ )
+            fr_push( lock_framer, &( lock_items[ i ] ) );
+
+        a = fr_first( lock_framer );
+        fr_next_n( &a, FR_SEG_MIN );
+        b = a;
+        fr_next_n( &b, 2 );
+
+        for ( i = 0; i < FR_SEG_MIN; i++ )
+            TEST_ASSERT_EQUAL( &( lock_items[ FR_SEG_MIN + i ] ), fr_delete_locked( &a ) );
+        TEST_ASSERT_NOT_NULL( a.dead );
+        TEST_ASSERT_EQUAL( &( lock_items[ 2 * FR_SEG_MIN ] ), fr_item_locked( &a ) );
+
+        TEST_ASSERT_EQUAL( &( lock_items[ 2 * FR_SEG_MIN ] ), fr_item_locked( &b ) );
+        TEST_ASSERT_EQUAL( &( lock_items[ 2 * FR_SEG_MIN ] ), fr_delete_locked( &b ) );
+        fr_locked_reclaim( &a );
+        TEST_ASSERT_NULL( a.dead );
+
+        cur = fr_first( lock_framer );
+        i = 0;
+        fr_each( &cur, item, int* )
+        {
+            TEST_ASSERT_EQUAL( &( lock_items[ i < FR_SEG_MIN ? i : i + FR_SEG_MIN + 1 ] ), item );
+            i++;
+        }
+        TEST_ASSERT_EQUAL( 2 * FR_SEG_MIN - 1, i );
+
+        fr_destroy( lock_framer );
+    }
+
+#endif
+}
+
+
+#define EPOCH_READERS 3
+
+/* Items from EPOCH_TAIL onwards are beyond the Nodes edited by writer. */
+#define EPOCH_TAIL 180
+
+int epoch_done;
+int epoch_errors;
+
+void* epoch_reader( void* arg )
+{
+    fr_epoch_rec_t rec = arg;
+    fr_s           pos;
+    int*           item;
+    int            tail;
+
+    while ( !__atomic_load_n( &epoch_done, __ATOMIC_ACQUIRE ) ) {
+
+        pos = fr_epoch_enter( rec );
+        tail = EPOCH_TAIL;
+        do {
+            item = fr_epoch_item( &pos );
+            if ( item == NULL )
+                continue;
+            /* Only live items, and the tail exactly once in order. */
+            if ( !( ( *item >= 0 && *item < 8 ) || ( *item >= 110 && *item < 200 ) ) )
+                __atomic_fetch_add( &epoch_errors, 1, __ATOMIC_RELAXED );
+            else if ( *item >= EPOCH_TAIL && *item != tail++ )
+                __atomic_fetch_add( &epoch_errors, 1, __ATOMIC_RELAXED );
+        } while ( fr_epoch_next( &pos ) );
+        fr_epoch_exit( rec );
+
+        if ( tail != 200 )
+            __atomic_fetch_add( &epoch_errors, 1, __ATOMIC_RELAXED );
+
+        sched_yield();
+    }
+
+    return NULL;
+}
+
+
+void test_epoch( void )
+{
+    fr_t       pos;
+    fr_epoch_t epoch;
+    pthread_t  readers[ EPOCH_READERS ];
+    int        items[ 200 ];
+
+    pos = fr_create_sized( FR_SEG_MIN );
+    epoch = fr_epoch_use( pos );
+
+    for ( int i = 0; i < 200; i++ ) {
+        items[ i ] = i;
+        fr_push( pos, &( items[ i ] ) );
+    }
+
+    /* Retired Nodes are freed when there are no readers. */
+    fr_to_first( pos );
+    for ( int i = 0; i < 100; i++ )
+        fr_delete( pos );
+    fr_epoch_reclaim( epoch );
+    fr_epoch_reclaim( epoch );
+    TEST_ASSERT_EQUAL( 0, fr_epoch_reclaim( epoch ) );
+
+    /* Retired Nodes are kept while reader is active. */
+    {
+        fr_epoch_rec_t rec = fr_epoch_reader( epoch );
+        fr_s           cur = fr_epoch_enter( rec );
+
+        TEST_ASSERT_EQUAL( &( items[ 100 ] ), fr_epoch_item( &cur ) );
+        fr_to_first( pos );
+        for ( int i = 0; i < 10; i++ )
+            fr_delete( pos );
+        TEST_ASSERT_TRUE( fr_epoch_reclaim( epoch ) > 0 );
+
+        /* Scan from the retired Node is still safe. */
+        while ( fr_epoch_next( &cur ) )
+            ;
+        TEST_ASSERT_EQUAL( &( items[ 199 ] ), fr_epoch_item( &cur ) );
+
+        fr_epoch_exit( rec );
+        fr_epoch_reclaim( epoch );
+        fr_epoch_reclaim( epoch );
+        TEST_ASSERT_EQUAL( 0, fr_epoch_reclaim( epoch ) );
+    }
+
+    /* Concurrent readers with editing writer. */
+    epoch_done = 0;
+    epoch_errors = 0;
+    for ( int i = 0; i < EPOCH_READERS; i++ )
+        pthread_create( &( readers[ i ] ), NULL, epoch_reader, fr_epoch_reader( epoch ) );
+
+    for ( int n = 0; n < 2000; n++ ) {
+        fr_to_first( pos );
+        fr_next_n( pos, n % 50 );
+        for ( int i = 0; i < 8; i++ )
+            fr_insert( pos, &( items[ i ] ) );
+        for ( int i = 0; i < 8; i++ )
+            fr_delete_even( pos );
+        if ( n % 64 == 0 )
+            sched_yield();
+    }
+
+    __atomic_store_n( &epoch_done, 1, __ATOMIC_RELEASE );
+    for ( int i = 0; i < EPOCH_READERS; i++ )
+        pthread_join( readers[ i ], NULL );
+
+    TEST_ASSERT_EQUAL( 0, epoch_errors );
+    TEST_ASSERT_EQUAL( 90, fr_length( pos ) );
+
+    fr_destroy( pos );
+
+#ifdef FRAMER_USE_NODE_LOCKS
+    /* Nodes retired by locked delete, in the middle and at head. */
+    pos = fr_create_sized( FR_SEG_MIN );
+    epoch = fr_epoch_use( pos );
+    for ( int i = 0; i < 3 * FR_SEG_MIN; i++ )
+        fr_push( pos, &( items[ i ] ) );
+
+    for ( int round = 0; round < 2; round++ ) {
+        fr_epoch_rec_t rec = fr_epoch_reader( epoch );
+        fr_s           cur;
+        int            cnt = 0;
+
+        fr_to_first( pos );
+        if ( round == 0 )
+            fr_next_n( pos, FR_SEG_MIN );
+        for ( int i = 0; i < FR_SEG_MIN; i++ )
+            fr_delete_locked( pos );
+        fr_locked_reclaim( pos );
+
+        cur = fr_epoch_enter( rec );
+        do {
+            if ( fr_epoch_item( &cur ) )
+                cnt++;
+        } while ( fr_epoch_next( &cur ) );
+        fr_epoch_exit( rec );
+        TEST_ASSERT_EQUAL( ( 2 - round ) * FR_SEG_MIN, cnt );
+    }
+
+    fr_destroy( pos );
+#endif
+}
+
+
+#ifdef FRAMER_USE_SNAPSHOTS
+
+#define SNAP_ITEMS 1000
+
+int snap_items[ SNAP_ITEMS ];
+int snap_done;
+
+/* Check that snapshot has items from "a" upto "b" (exclusive). */
+void snap_check( fr_snap_t snap, int a, int b )
+{
+    fr_snap_iter_s it;
+    fr_size_t      cnt;
+    int            i = a;
+
+    TEST_ASSERT_EQUAL( b - a, fr_snap_length( snap ) );
+
+    fr_snap_iter( snap, &it );
+    while ( ( cnt = fr_snap_read( &it ) ) ) {
+        for ( fr_size_t k = 0; k < cnt; k++ ) {
+            TEST_ASSERT_EQUAL( &( snap_items[ i ] ), it.items[ k ] );
+            i++;
+        }
+    }
+    fr_snap_iter_done( &it );
+
+    TEST_ASSERT_EQUAL( b, i );
+}
+
+
+void* snap_reader( void* arg )
+{
+    fr_snap_t snap = arg;
+
+    while ( !__atomic_load_n( &snap_done, __ATOMIC_ACQUIRE ) ) {
+        snap_check( snap, 0, SNAP_ITEMS );
+        sched_yield();
+    }
+
+    return NULL;
+}
+
+#endif
+
+
+void test_snapshot( void )
+{
+#ifdef FRAMER_USE_SNAPSHOTS
+
+    fr_t      pos;
+    fr_snap_t s1;
+    fr_snap_t s2;
+    fr_snap_t s3;
+    pthread_t reader;
+    int       extra[ 16 ];
+
+    pos = fr_create_sized( FR_SEG_MIN );
+    for ( int i = 0; i < SNAP_ITEMS; i++ )
+        fr_push( pos, &( snap_items[ i ] ) );
+
+    /* Snapshot copies nothing until Framer is modified. */
+    s1 = fr_snapshot( pos );
+    TEST_ASSERT_EQUAL( 0, fr_snap_copies( s1 ) );
+    snap_check( s1, 0, SNAP_ITEMS );
+
+    /* Only modified Nodes are copied. */
+    fr_to_first( pos );
+    fr_next_n( pos, SNAP_ITEMS / 2 );
+    fr_insert( pos, &( extra[ 0 ] ) );
+    TEST_ASSERT_TRUE( fr_snap_copies( s1 ) > 0 );
+    TEST_ASSERT_TRUE( fr_snap_copies( s1 ) <= 3 );
+    TEST_ASSERT_EQUAL( &( extra[ 0 ] ), fr_delete( pos ) );
+    snap_check( s1, 0, SNAP_ITEMS );
+
+    /* Reader scans snapshot while Framer is edited. */
+    snap_done = 0;
+    pthread_create( &reader, NULL, snap_reader, s1 );
+
+    for ( int n = 0; n < 500; n++ ) {
+        fr_to_first( pos );
+        fr_next_n( pos, ( n * 7 ) % ( SNAP_ITEMS - 16 ) );
+        for ( int i = 0; i < 16; i++ )
+            fr_insert( pos, &( extra[ i ] ) );
+        for ( int i = 0; i < 16; i++ )
+            fr_delete_even( pos );
+        if ( n % 64 == 0 )
+            sched_yield();
+    }
+
+    /* Delete head, i.e. release Nodes. */
+    fr_to_first( pos );
+    for ( int i = 0; i < 100; i++ )
+        fr_delete( pos );
+
+    __atomic_store_n( &snap_done, 1, __ATOMIC_RELEASE );
+    pthread_join( reader, NULL );
+    snap_check( s1, 0, SNAP_ITEMS );
+
+    /* Second snapshot sees the edited Framer. */
+    s2 = fr_snapshot( pos );
+    snap_check( s2, 100, SNAP_ITEMS );
+
+    fr_to_last( pos );
+    for ( int i = 0; i < 100; i++ )
+        fr_pop( pos );
+    fr_to_first( pos );
+    fr_pack_range( pos, NULL, FR_SEG_MIN );
+    fr_to_first( pos );
+    {
+        fr_s cur = fr_first( pos );
+        while ( fr_compact_step( pos, &cur, 8 ) )
+            ;
+    }
+    fr_defrag( pos, NULL, 0, 1 );
+
+    s3 = fr_snapshot( pos );
+    snap_check( s1, 0, SNAP_ITEMS );
+    snap_check( s2, 100, SNAP_ITEMS );
+    snap_check( s3, 100, SNAP_ITEMS - 100 );
+
+    /* Snapshots survive the Framer. */
+    fr_snap_del( s2 );
+    fr_destroy( pos );
+    snap_check( s1, 0, SNAP_ITEMS );
+    snap_check( s3, 100, SNAP_ITEMS - 100 );
+    fr_snap_del( s1 );
+    fr_snap_del( s3 );
+
+#endif
+}
+
+
+void test_clone( void )
+{
+    fr_t       pos;
+    fr_t       dup;
+    fr_s       cur;
+    fr_stats_s st;
+    int*       item;
+    int        items[ 1000 ];
+    int        i;
+
+    pos = fr_create_adaptive( FR_SEG_MIN, 4 * FR_SEG_MIN );
+    for ( i = 0; i < 1000; i++ ) {
+        items[ i ] = i;
+        fr_push( pos, &( items[ i ] ) );
+    }
+
+    /* Leave partial segments. */
+    fr_to_first( pos );
+    for ( i = 0; i < 500; i++ ) {
+        fr_delete( pos );
+        fr_next( pos );
+    }
+
+    for ( int pack = 0; pack < 2; pack++ ) {
+        for ( int threads = 1; threads <= 4; threads += 3 ) {
+
+            dup = fr_clone_parallel( pos, pack, threads );
+            TEST_ASSERT_EQUAL( 500, fr_length( dup ) );
+
+            fr_stats( dup, &st );
+            TEST_ASSERT_EQUAL( 500, st.items );
+            TEST_ASSERT_EQUAL( st.nodes, fr_node_count( dup ) );
+            TEST_ASSERT_EQUAL( st.bytes, fr_memory_bytes( dup ) );
+            if ( pack )
+                TEST_ASSERT_EQUAL( ( 500 + st.slots / st.nodes - 1 ) / ( st.slots / st.nodes ),
+                                   st.nodes );
+            else
+                TEST_ASSERT_EQUAL( fr_node_count( pos ), st.nodes );
+
+            cur = fr_first( dup );
+            i = 1;
+            fr_each( &cur, item, int* )
+            {
+                TEST_ASSERT_EQUAL( &( items[ i ] ), item );
+                i += 2;
+            }
+            TEST_ASSERT_EQUAL( 1001, i );
+
+            /* Clone is independent of source. */
+            fr_to_first( dup );
+            fr_insert( dup, &( items[ 0 ] ) );
+            fr_to_last( dup );
+            for ( int k = 0; k < 100; k++ )
+                fr_push( dup, &( items[ k ] ) );
+            TEST_ASSERT_EQUAL( 601, fr_length( dup ) );
+            TEST_ASSERT_EQUAL( 500, fr_length( pos ) );
+
+            fr_destroy( dup );
+        }
+    }
+
+    fr_destroy( pos );
+}
+
+
+int ser_items[ 1000 ];
+
+fr_size_t ser_encode( void* item, void* buf, fr_size_t size )
+{
+    fr_size_t n;
+
+    /* Variable length records, and one large record. */
+    if ( item == &( ser_items[ 500 ] ) ) {
+        if ( size >= 100000 ) {
+            memset( buf, 'x', 100000 );
+            memcpy( buf, "500", 3 );
+        }
+        return 100000;
+    }
+
+    n = snprintf( buf, size, "%d", *(int*)item );
+    return ( n < size ) ? n : n + 1;
+}
+
+
+void* ser_decode( void* buf, fr_size_t size )
+{
+    char str[ 16 ];
+
+    if ( size == 100000 )
+        size = 3;
+    memcpy( str, buf, size );
+    str[ size ] = 0;
+
+    return &( ser_items[ atoi( str ) ] );
+}
+
+
+void test_serialize( void )
+{
+    fr_t       pos;
+    fr_t       rd;
+    fr_s       cur;
+    fr_stats_s st;
+    FILE*      fh;
+    int        fd;
+    void*      item;
+    intptr_t   i;
+
+    pos = fr_create_sized( FR_SEG_MIN );
+    for ( i = 0; i < 1000; i++ ) {
+        ser_items[ i ] = i;
+        fr_push( pos, (void*)( i + 1 ) );
+    }
+
+    /* Partial segments. */
+    fr_to_first( pos );
+    for ( i = 0; i < 500; i++ ) {
+        fr_delete( pos );
+        fr_next( pos );
+    }
+
+    /* Raw items. */
+    fh = tmpfile();
+    fd = fileno( fh );
+    TEST_ASSERT_EQUAL( 0, fr_write( pos, fd, NULL ) );
+    lseek( fd, 0, SEEK_SET );
+    TEST_ASSERT_EQUAL( NULL, fr_read( fd, ser_decode ) );
+    lseek( fd, 0, SEEK_SET );
+    rd = fr_read( fd, NULL );
+    TEST_ASSERT_NOT_NULL( rd );
+    TEST_ASSERT_EQUAL( 500, fr_length( rd ) );
+
+    fr_stats( rd, &st );
+    TEST_ASSERT_EQUAL( 500 / FR_SEG_MIN, st.nodes );
+    TEST_ASSERT_EQUAL( st.nodes, fr_node_count( rd ) );
+    TEST_ASSERT_EQUAL( st.bytes, fr_memory_bytes( rd ) );
+
+    cur = fr_first( rd );
+    i = 2;
+    fr_each( &cur, item, void* )
+    {
+        TEST_ASSERT_EQUAL( (void*)i, item );
+        i += 2;
+    }
+    TEST_ASSERT_EQUAL( 1002, i );
+
+    fr_destroy( rd );
+    fclose( fh );
+
+    /* Truncated file. */
+    fh = tmpfile();
+    fd = fileno( fh );
+    TEST_ASSERT_EQUAL( 0, fr_write( pos, fd, NULL ) );
+    TEST_ASSERT_EQUAL( 0, ftruncate( fd, 100 ) );
+    lseek( fd, 0, SEEK_SET );
+    TEST_ASSERT_EQUAL( NULL, fr_read( fd, NULL ) );
+    fclose( fh );
+
+    fr_destroy( pos );
+
+    /* Encoded items. */
+    pos = fr_create_sized( FR_SEG_MIN );
+    for ( i = 0; i < 1000; i++ )
+        fr_push( pos, &( ser_items[ i ] ) );
+
+    fh = tmpfile();
+    fd = fileno( fh );
+    TEST_ASSERT_EQUAL( 0, fr_write( pos, fd, ser_encode ) );
+    lseek( fd, 0, SEEK_SET );
+    TEST_ASSERT_EQUAL( NULL, fr_read( fd, NULL ) );
+    lseek( fd, 0, SEEK_SET );
+    rd = fr_read( fd, ser_decode );
+    TEST_ASSERT_NOT_NULL( rd );
+    TEST_ASSERT_EQUAL( 1000, fr_length( rd ) );
+
+    cur = fr_first( rd );
+    i = 0;
+    fr_each( &cur, item, void* )
+    {
+        TEST_ASSERT_EQUAL( &( ser_items[ i ] ), item );
+        i++;
+    }
+    TEST_ASSERT_EQUAL( 1000, i );
+
+    fr_destroy( rd );
+    fclose( fh );
+    fr_destroy( pos );
+}
+
+
+/* Write Framer to temporary file, and patch header field at offset. */
+FILE* ser_patched( fr_t pos, fr_encode_f encode, off_t off, uint64_t val )
+{
+    FILE* fh = tmpfile();
+    int   fd = fileno( fh );
+
+    TEST_ASSERT_EQUAL( 0, fr_write( pos, fd, encode ) );
+    if ( off > 0 )
+        TEST_ASSERT_EQUAL( sizeof( val ), pwrite( fd, &val, sizeof( val ), off ) );
+    lseek( fd, 0, SEEK_SET );
+
+    return fh;
+}
+
+
+void test_read_invalid( void )
+{
+    fr_t  pos;
+    fr_t  rd;
+    FILE* fh;
+
+    /* Header offsets of item count and segment size. */
+    const off_t icnt = 16;
+    const off_t size = 24;
+
+    pos = fr_create_sized( FR_SEG_MIN );
+    for ( int i = 0; i < 100; i++ ) {
+        ser_items[ i ] = i;
+        fr_push( pos, &( ser_items[ i ] ) );
+    }
+
+    fh = ser_patched( pos, NULL, size, (uint64_t)1 << 40 );
+    TEST_ASSERT_EQUAL( NULL, fr_read( fileno( fh ), NULL ) );
+    fclose( fh );
+
+    fh = ser_patched( pos, NULL, icnt, (uint64_t)1 << 63 );
+    TEST_ASSERT_EQUAL( NULL, fr_read( fileno( fh ), NULL ) );
+    fclose( fh );
+
+    /* Item count must match items in file. */
+    fh = ser_patched( pos, NULL, icnt, 99 );
+    TEST_ASSERT_EQUAL( NULL, fr_read( fileno( fh ), NULL ) );
+    fclose( fh );
+
+    fh = ser_patched( pos, NULL, icnt, 101 );
+    TEST_ASSERT_EQUAL( NULL, fr_read( fileno( fh ), NULL ) );
+    fclose( fh );
+
+    fh = ser_patched( pos, ser_encode, icnt, 99 );
+    TEST_ASSERT_EQUAL( NULL, fr_read( fileno( fh ), ser_decode ) );
+    fclose( fh );
+
+    fh = ser_patched( pos, ser_encode, icnt, 101 );
+    TEST_ASSERT_EQUAL( NULL, fr_read( fileno( fh ), ser_decode ) );
+    fclose( fh );
+
+    fh = ser_patched( pos, ser_encode, 0, 0 );
+    rd = fr_read( fileno( fh ), ser_decode );
+    TEST_ASSERT_NOT_NULL( rd );
+    TEST_ASSERT_EQUAL( 100, fr_length( rd ) );
+    fr_destroy( rd );
+    fclose( fh );
+
+    fr_destroy( pos );
+}
+
+
+void test_map( void )
+{
+#ifdef FRAMER_COMPACT_LINKS
+
+    char     path[] = "/tmp/framer_map_XXXXXX";
+    fr_map_t map;
+    fr_t     pos;
+    fr_s     cur;
+    void*    item;
+    intptr_t i;
+    int      fd;
+
+    fd = mkstemp( path );
+    TEST_ASSERT_TRUE( fd >= 0 );
+    close( fd );
+
+    TEST_ASSERT_EQUAL( NULL, fr_map_open( path ) );
+
+    map = fr_map_create( path, FR_SEG_MIN, 4096 );
+    TEST_ASSERT_NOT_NULL( map );
+    pos = fr_map_pos( map );
+    for ( i = 0; i < 1000; i++ )
+        fr_push( pos, (void*)i );
+    fr_to_first( pos );
+    for ( i = 0; i < 500; i++ ) {
+        fr_delete( pos );
+        fr_next( pos );
+    }
+    TEST_ASSERT_EQUAL( 0, fr_map_sync( map ) );
+    fr_map_close( map );
+
+    /* Nodes are used in place. */
+    map = fr_map_open( path );
+    TEST_ASSERT_NOT_NULL( map );
+    pos = fr_map_pos( map );
+    TEST_ASSERT_EQUAL( 500, fr_length( pos ) );
+
+    cur = fr_first( pos );
+    i = 1;
+    fr_each( &cur, item, void* )
+    {
+        TEST_ASSERT_EQUAL( (void*)i, item );
+        i += 2;
+    }
+    TEST_ASSERT_EQUAL( 1001, i );
+
+    /* Released slots are reused, and file grows. */
+    fr_to_first( pos );
+    for ( i = 0; i < 100; i++ )
+        fr_delete( pos );
+    fr_to_last( pos );
+    for ( i = 0; i < 2000; i++ )
+        fr_push( pos, (void*)i );
+    fr_map_close( map );
+
+    map = fr_map_open( path );
+    pos = fr_map_pos( map );
+    TEST_ASSERT_EQUAL( 2400, fr_length( pos ) );
+    TEST_ASSERT_EQUAL( 2400, fr_tail_length( pos ) );
+    fr_to_last( pos );
+    TEST_ASSERT_EQUAL( (void*)1999, fr_item( pos ) );
+    fr_map_close( map );
+
+    /* Room is checked against maximum Node count. */
+    TEST_ASSERT_NULL( fr_map_create( path, FR_SEG_MIN, 0 ) );
+    TEST_ASSERT_NULL( fr_map_create( path, FR_SEG_MIN - 1, 4 ) );
+    map = fr_map_create( path, FR_SEG_MIN, 4 );
+    pos = fr_map_pos( map );
+    TEST_ASSERT_EQUAL( -1, fr_map_reserve( map, 4 ) );
+    TEST_ASSERT_EQUAL( 0, fr_map_reserve( map, 3 ) );
+    for ( i = 0; i < 4 * FR_SEG_MIN; i++ )
+        fr_push( pos, (void*)i );
+    TEST_ASSERT_EQUAL( -1, fr_map_reserve( map, 1 ) );
+    fr_to_first( pos );
+    for ( i = 0; i < FR_SEG_MIN; i++ )
+        fr_delete( pos );
+    TEST_ASSERT_EQUAL( 0, fr_map_reserve( map, 1 ) );
+    fr_to_last( pos );
+    fr_push( pos, (void*)i );
+    TEST_ASSERT_EQUAL( -1, fr_map_reserve( map, 1 ) );
+    fr_map_close( map );
+
+    /* Slot counts and indexes are checked against file size. */
+    {
+        uint64_t val;
+
+        map = fr_map_open( path );
+        TEST_ASSERT_NOT_NULL( map );
+        fr_map_close( map );
+
+        /* Slot count in file (at offset 40), and first slot (72). */
+        fd = open( path, O_RDWR );
+        val = 1000;
+        TEST_ASSERT_EQUAL( sizeof( val ), pwrite( fd, &val, sizeof( val ), 40 ) );
+        close( fd );
+        TEST_ASSERT_NULL( fr_map_open( path ) );
+
+        fd = open( path, O_RDWR );
+        val = 4;
+        TEST_ASSERT_EQUAL( sizeof( val ), pwrite( fd, &val, sizeof( val ), 40 ) );
+        TEST_ASSERT_EQUAL( sizeof( val ), pwrite( fd, &val, sizeof( val ), 72 ) );
+        close( fd );
+        TEST_ASSERT_NULL( fr_map_open( path ) );
+    }
+
+    unlink( path );
+
+#endif
+}
+
+
+void test_shm( void )
+{
+#ifdef FRAMER_COMPACT_LINKS
+
+    char     name[ 64 ];
+    fr_map_t map;
+    fr_map_t peer;
+    fr_t     pos;
+    fr_s     cur;
+    void*    item;
+    intptr_t i;
+    pid_t    pid;
+    int      status;
+
+    snprintf( name, sizeof( name ), "/framer_test_%d", (int)getpid() );
+    TEST_ASSERT_EQUAL( NULL, fr_shm_attach( name ) );
+
+    map = fr_shm_create( name, FR_SEG_MIN, 1024 );
+    TEST_ASSERT_NOT_NULL( map );
+    TEST_ASSERT_EQUAL( 0, fr_shm_gen( map ) );
+
+    pos = fr_shm_write_begin( map );
+    for ( i = 0; i < 1000; i++ )
+        fr_push( pos, (void*)i );
+    fr_shm_write_end( map );
+    TEST_ASSERT_EQUAL( 1, fr_shm_gen( map ) );
+
+    /* Second attach maps the same Nodes. */
+    peer = fr_shm_attach( name );
+    TEST_ASSERT_NOT_NULL( peer );
+    cur = fr_shm_read_begin( peer );
+    TEST_ASSERT_EQUAL( 1000, fr_length( &cur ) );
+    i = 0;
+    fr_each( &cur, item, void* )
+    {
+        TEST_ASSERT_EQUAL( (void*)i, item );
+        i++;
+    }
+    fr_shm_read_end( peer );
+
+    /* Child process edits, and parent reads. */
+    pid = fork();
+    TEST_ASSERT_TRUE( pid >= 0 );
+    if ( pid == 0 ) {
+        map = fr_shm_attach( name );
+        if ( map == NULL )
+            _exit( 1 );
+        pos = fr_shm_write_begin( map );
+        for ( i = 0; i < 500; i++ ) {
+            fr_delete( pos );
+            fr_next( pos );
+        }
+        fr_shm_write_end( map );
+        fr_map_close( map );
+        _exit( 0 );
+    }
+    TEST_ASSERT_EQUAL( pid, waitpid( pid, &status, 0 ) );
+    TEST_ASSERT_TRUE( WIFEXITED( status ) && WEXITSTATUS( status ) == 0 );
+    TEST_ASSERT_EQUAL( 2, fr_shm_gen( peer ) );
+
+    cur = fr_shm_read_begin( peer );
+    TEST_ASSERT_EQUAL( 500, fr_length( &cur ) );
+    i = 1;
+    fr_each( &cur, item, void* )
+    {
+        TEST_ASSERT_EQUAL( (void*)i, item );
+        i += 2;
+    }
+    fr_shm_read_end( peer );
+
+    /* Writer reloads home Position from the header. */
+    pos = fr_shm_write_begin( map );
+    TEST_ASSERT_EQUAL( 500, fr_length( pos ) );
+    TEST_ASSERT_EQUAL( (void*)1, fr_item( pos ) );
+    fr_to_last( pos );
+    fr_push( pos, (void*)-1 );
+    fr_shm_write_end( map );
+
+    cur = fr_shm_read_begin( peer );
+    TEST_ASSERT_EQUAL( 501, fr_length( &cur ) );
+    fr_shm_read_end( peer );
+
+    fr_map_close( peer );
+    fr_map_close( map );
+    TEST_ASSERT_EQUAL( 0, fr_shm_unlink( name ) );
+    TEST_ASSERT_EQUAL( NULL, fr_shm_attach( name ) );
+
+#endif
+}
+
+
+/**
+ * Counting source for load tests.
+ */
+typedef struct
+{
+    intptr_t  next;  /**< Next item. */
+    intptr_t  end;   /**< End of items. */
+    fr_size_t chunk; /**< Maximum items per call. */
+} count_src_s;
+
+static fr_size_t count_src( void* ctx, void** items, fr_size_t cnt )
+{
+    count_src_s* src = ctx;
+    fr_size_t    n = 0;
+
+    while ( n < cnt && n < src->chunk && src->next < src->end )
+        items[ n++ ] = (void*)src->next++;
+
+    return n;
+}
+
+
+void test_load_stream( void )
+{
+    fr_t        pos;
+    fr_s        cur;
+    fn_t        node;
+    count_src_s src;
+    FILE*       fh;
+    int         fd;
+    void*       item;
+    intptr_t    i;
+
+    for ( int par = 0; par < 2; par++ ) {
+
+        /* Empty Framer, with partial segments. */
+        pos = fr_create_sized( 32 );
+        src = ( count_src_s ){ 0, 1000, 7 };
+        if ( par )
+            TEST_ASSERT_EQUAL( 1000, fr_load_stream_parallel( pos, count_src, &src, 10 ) );
+        else
+            TEST_ASSERT_EQUAL( 1000, fr_load_stream( pos, count_src, &src, 10 ) );
+        TEST_ASSERT_EQUAL( 1000, fr_length( pos ) );
+        TEST_ASSERT_EQUAL( 100, pos->ncnt );
+        TEST_ASSERT_EQUAL( (void*)0, fr_item( pos ) );
+        for ( node = fn_first( pos->seg ); node; node = fn_next( node ) )
+            TEST_ASSERT_EQUAL( 10, node->used );
+
+        /* Appended to end, and Position is not moved. */
+        src = ( count_src_s ){ 1000, 2000, 1000 };
+        if ( par )
+            TEST_ASSERT_EQUAL( 1000, fr_load_stream_parallel( pos, count_src, &src, 0 ) );
+        else
+            TEST_ASSERT_EQUAL( 1000, fr_load_stream( pos, count_src, &src, 0 ) );
+        TEST_ASSERT_EQUAL( 2000, fr_length( pos ) );
+        TEST_ASSERT_EQUAL( (void*)0, fr_item( pos ) );
+
+        cur = fr_first( pos );
+        i = 0;
+        fr_each( &cur, item, void* )
+        {
+            TEST_ASSERT_EQUAL( (void*)i, item );
+            i++;
+        }
+        TEST_ASSERT_EQUAL( 2000, i );
+
+        /* Empty source. */
+        if ( par )
+            TEST_ASSERT_EQUAL( 0, fr_load_stream_parallel( pos, count_src, &src, 0 ) );
+        else
+            TEST_ASSERT_EQUAL( 0, fr_load_stream( pos, count_src, &src, 0 ) );
+        TEST_ASSERT_EQUAL( 2000, fr_length( pos ) );
+        fr_destroy( pos );
+
+        pos = fr_create_sized( FR_SEG_MIN );
+        TEST_ASSERT_EQUAL( 0, fr_load_stream( pos, count_src, &src, 0 ) );
+        TEST_ASSERT_EQUAL( 0, fr_length( pos ) );
+        TEST_ASSERT_EQUAL( 1, pos->ncnt );
+        fr_destroy( pos );
+    }
+
+    /* Raw items from file. */
+    fh = tmpfile();
+    fd = fileno( fh );
+    for ( i = 0; i < 3000; i++ )
+        TEST_ASSERT_EQUAL( sizeof( i ), write( fd, &i, sizeof( i ) ) );
+    lseek( fd, 0, SEEK_SET );
+
+    pos = fr_create_sized( FR_SEG_MIN );
+    TEST_ASSERT_EQUAL( 3000, fr_load_stream_parallel( pos, fr_source_fd, &fd, 0 ) );
+    cur = fr_first( pos );
+    i = 0;
+    fr_each( &cur, item, void* )
+    {
+        TEST_ASSERT_EQUAL( (void*)i, item );
+        i++;
+    }
+    TEST_ASSERT_EQUAL( 3000, i );
+    fr_destroy( pos );
+    fclose( fh );
+}
+
+
+void test_dirty( void )
+{
+#ifdef FRAMER_USE_DIRTY
+
+    fr_t       pos;
+    fr_dirty_s dirty[ 8 ];
+    intptr_t   i;
+
+    pos = fr_create_sized( 10 );
+    for ( i = 0; i < 100; i++ )
+        fr_push( pos, (void*)i );
+    TEST_ASSERT_EQUAL( 10, pos->ncnt );
+
+    /* New Nodes are dirty. */
+    TEST_ASSERT_EQUAL( 10, fr_dirty( pos, NULL, 0 ) );
+    fr_checkpoint( pos );
+    TEST_ASSERT_EQUAL( 0, fr_dirty( pos, NULL, 0 ) );
+
+    /* Changed Node is listed with its location. */
+    fr_to_first( pos );
+    for ( i = 0; i < 55; i++ )
+        fr_next( pos );
+    fr_delete( pos );
+    TEST_ASSERT_EQUAL( 1, fr_dirty( pos, dirty, 8 ) );
+    TEST_ASSERT_EQUAL( pos->seg, dirty[ 0 ].node );
+    TEST_ASSERT_EQUAL( 5, dirty[ 0 ].ord );
+    TEST_ASSERT_EQUAL( 50, dirty[ 0 ].first );
+    fr_dirty_clear( dirty, 1 );
+    TEST_ASSERT_EQUAL( 0, fr_dirty( pos, NULL, 0 ) );
+
+    /* Appended item. */
+    fr_to_last( pos );
+    fr_pop( pos );
+    TEST_ASSERT_EQUAL( 1, fr_dirty( pos, dirty, 8 ) );
+    TEST_ASSERT_EQUAL( 9, dirty[ 0 ].ord );
+    fr_checkpoint( pos );
+
+    /* Packing changes a range of Nodes. */
+    fr_to_first( pos );
+    fr_delete( pos );
+    for ( i = 0; i < 30; i++ )
+        fr_next( pos );
+    fr_delete( pos );
+    TEST_ASSERT_EQUAL( 2, fr_dirty( pos, dirty, 1 ) );
+    TEST_ASSERT_EQUAL( 0, dirty[ 0 ].ord );
+    fr_checkpoint( pos );
+    fr_to_first( pos );
+    TEST_ASSERT_EQUAL( 1, fr_pack_range( pos, NULL, 10 ) );
+    TEST_ASSERT_TRUE( fr_dirty( pos, NULL, 0 ) > 0 );
+    fr_checkpoint( pos );
+
+    /* Removed Node makes its neighbours dirty. */
+    TEST_ASSERT_EQUAL( 10, pos->ncnt );
+    fr_to_first( pos );
+    for ( i = 0; i < 50; i++ )
+        fr_next( pos );
+    for ( i = 0; i < 10; i++ )
+        fr_delete( pos );
+    TEST_ASSERT_EQUAL( 9, pos->ncnt );
+    TEST_ASSERT_EQUAL( 5, fr_dirty( pos, dirty, 8 ) );
+    TEST_ASSERT_EQUAL( 4, dirty[ 0 ].ord );
+    TEST_ASSERT_EQUAL( 5, dirty[ 1 ].ord );
+
+    /* Nodes after the removed Node have moved. */
+    TEST_ASSERT_EQUAL( 8, dirty[ 4 ].ord );
+    fr_dirty_clear( dirty, 5 );
+    TEST_ASSERT_EQUAL( 0, fr_dirty( pos, NULL, 0 ) );
+
+    fr_destroy( pos );
+
+#endif
+}
+
+
+#ifdef FRAMER_USE_DIRTY
+
+#define REPLAY_NODES 64
+#define REPLAY_SIZE 4
+
+void*     replay_items[ REPLAY_NODES ][ REPLAY_SIZE ];
+fr_size_t replay_used[ REPLAY_NODES ];
+fr_size_t replay_ncnt;
+
+/* Write incremental checkpoint to replay image, by Node index. */
+void replay_write( fr_t pos )
+{
+    fr_dirty_s dirty[ REPLAY_NODES ];
+    fr_size_t  cnt;
+    fn_t       node;
+
+    cnt = fr_dirty( pos, dirty, REPLAY_NODES );
+    TEST_ASSERT_TRUE( cnt <= REPLAY_NODES );
+    for ( fr_size_t i = 0; i < cnt; i++ ) {
+        node = dirty[ i ].node;
+        memcpy( replay_items[ dirty[ i ].ord ], node->data, node->used * sizeof( void* ) );
+        replay_used[ dirty[ i ].ord ] = node->used;
+    }
+    replay_ncnt = fr_node_count( pos );
+    fr_dirty_clear( dirty, cnt );
+}
+
+/* Check that replay image has the Framer items. */
+void replay_check( fr_t pos )
+{
+    fr_s      cur = fr_first( pos );
+    fr_size_t cnt = 0;
+
+    for ( fr_size_t n = 0; n < replay_ncnt; n++ ) {
+        for ( fr_size_t i = 0; i < replay_used[ n ]; i++ ) {
+            TEST_ASSERT_EQUAL( fr_item( &cur ), replay_items[ n ][ i ] );
+            fr_next( &cur );
+            cnt++;
+        }
+    }
+    TEST_ASSERT_EQUAL( fr_length( pos ), cnt );
+}
+
+#endif
+
+
+void test_dirty_replay( void )
+{
+#ifdef FRAMER_USE_DIRTY
+
+    fr_t     pos;
+    intptr_t i;
+
+    pos = fr_create_sized( REPLAY_SIZE );
+    for ( i = 0; i < 20; i++ )
+        fr_push( pos, (void*)( i + 1 ) );
+    replay_write( pos );
+    replay_check( pos );
+
+    /* Removed Node. */
+    fr_to_first( pos );
+    fr_next_n( pos, 4 );
+    for ( i = 4; i < 8; i++ )
+        fr_delete( pos );
+    replay_write( pos );
+    replay_check( pos );
+
+    /* Split Node. */
+    fr_to_first( pos );
+    fr_next_n( pos, 2 );
+    for ( i = 0; i < 6; i++ )
+        fr_insert( pos, (void*)( 100 + i ) );
+    replay_write( pos );
+    replay_check( pos );
+
+    /* Item count change before Nodes, and removed Nodes at end. */
+    fr_to_first( pos );
+    fr_delete_even( pos );
+    fr_to_last( pos );
+    for ( i = 0; i < 6; i++ )
+        fr_pop( pos );
+    replay_write( pos );
+    replay_check( pos );
+
+    /* Packing. */
+    fr_to_first( pos );
+    fr_pack_range( pos, NULL, REPLAY_SIZE );
+    replay_write( pos );
+    replay_check( pos );
+
+    fr_destroy( pos );
+
+#endif
+}
+
+
+int merge_comp( void* a, void* b )
+{
+    if ( (intptr_t)a > (intptr_t)b )
+        return 1;
+    else if ( (intptr_t)a < (intptr_t)b )
+        return -1;
+    else
+        return 0;
+}
+
+void merge_check( fr_t pos, fr_size_t icnt )
+{
+    fr_size_t ncnt = 0;
+    fr_size_t cnt = 0;
+    intptr_t  prev = -1;
+
+    TEST_ASSERT_EQUAL( NULL, fn_prev( pos->seg ) );
+    TEST_ASSERT_EQUAL( icnt, pos->icnt );
+
+    for ( fn_t node = pos->seg; node; node = fn_next( node ) ) {
+        if ( icnt > 0 )
+            TEST_ASSERT_TRUE( node->used * 2 >= node->size );
+        for ( fr_size_t i = 0; i < node->used; i++ ) {
+            TEST_ASSERT_TRUE( (intptr_t)node->data[ i ] >= prev );
+            prev = (intptr_t)node->data[ i ];
+        }
+        cnt += node->used;
+        ncnt++;
+    }
+
+    TEST_ASSERT_EQUAL( icnt, cnt );
+    TEST_ASSERT_EQUAL( ncnt, pos->ncnt );
+}
+
+
+void test_merge( void )
+{
+    fr_t      dst;
+    fr_t      src;
+    fn_t      node;
+    intptr_t  i;
+    fr_s      cur;
+    void*     item;
+    void*     prev;
+    char      seen[ 3000 ];
+    fr_size_t cnt;
+
+    /* Interleaved, with partial segments. */
+    dst = fr_create_sized( 8 );
+    src = fr_create_sized( 8 );
+    for ( i = 0; i < 1000; i++ )
+        fr_push( dst, (void*)( 2 * i ) );
+    for ( i = 0; i < 700; i++ )
+        fr_push( src, (void*)( 3 * i ) );
+    fr_to_first( dst );
+    for ( i = 0; i < 100; i++ ) {
+        fr_next( dst );
+        fr_next( dst );
+        fr_delete( dst );
+    }
+
+    fr_merge( dst, src, merge_comp, 0 );
+    merge_check( dst, 1600 );
+    merge_check( src, 0 );
+    TEST_ASSERT_EQUAL( 200, dst->ncnt );
+    TEST_ASSERT_EQUAL( 1, src->ncnt );
+    TEST_ASSERT_EQUAL( 0, fr_length( src ) );
+    TEST_ASSERT_EQUAL( (void*)0, fr_item( dst ) );
+
+    /* Equal items are dropped. */
+    memset( seen, 0, sizeof( seen ) );
+    cnt = 0;
+    cur = fr_first( dst );
+    fr_each( &cur, item, void* )
+    {
+        seen[ (intptr_t)item ] = 1;
+    }
+    for ( i = 0; i < 500; i++ ) {
+        fr_push( src, (void*)( 3 * i ) );
+        seen[ 3 * i ] = 1;
+    }
+    for ( i = 0; i < 3000; i++ )
+        cnt += seen[ i ];
+    fr_merge( dst, src, merge_comp, 1 );
+    merge_check( dst, cnt );
+    cur = fr_first( dst );
+    prev = (void*)-1;
+    fr_each( &cur, item, void* )
+    {
+        TEST_ASSERT_TRUE( item != prev );
+        prev = item;
+    }
+
+    /* Empty inputs. */
+    fr_merge( dst, src, merge_comp, 0 );
+    merge_check( dst, cnt );
+    fr_merge( src, dst, merge_comp, 0 );
+    merge_check( src, cnt );
+    merge_check( dst, 0 );
+    fr_destroy( src );
+
+    /* Tail Nodes are relinked. */
+    src = fr_create_sized( 8 );
+    for ( i = 0; i < 100; i++ )
+        fr_push( dst, (void*)i );
+    for ( i = 1000; i < 2000; i++ )
+        fr_push( src, (void*)i );
+    node = fn_next( fn_next( fn_first( src->seg ) ) );
+    fr_merge( dst, src, merge_comp, 0 );
+    merge_check( dst, 1100 );
+    for ( fn_t n = dst->seg; n != node; n = fn_next( n ) )
+        TEST_ASSERT_NOT_NULL( n );
+
+    /* Different Memory API. */
+    for ( i = 0; i < 1000; i++ )
+        fr_push( src, (void*)( 2 * i + 1 ) );
+    fr_defrag( src, NULL, 0, 0 );
+#ifdef FRAMER_USE_SNAPSHOTS
+    fr_snap_t snap = fr_snapshot( dst );
+#endif
+    fr_merge( dst, src, merge_comp, 0 );
+    merge_check( dst, 2100 );
+    merge_check( src, 0 );
+#ifdef FRAMER_USE_SNAPSHOTS
+    /* Snapshot keeps the Nodes before merge. */
+    fr_snap_iter_s it;
+    fr_snap_iter( snap, &it );
+    i = 0;
+    for ( fr_size_t n; ( n = fr_snap_read( &it ) ); i += n )
+        TEST_ASSERT_EQUAL( (void*)( i < 100 ? i : i + 900 ), it.items[ 0 ] );
+    TEST_ASSERT_EQUAL( 1100, i );
+    fr_snap_iter_done( &it );
+    fr_snap_del( snap );
+#endif
+
+    fr_destroy( src );
+    fr_destroy( dst );
+
+    /* Different segment sizes. */
+    intptr_t seq[] = { 2, 3, 4, 5, 6, 6, 7, 7, 9, 9, 10, 11, 11 };
+    for ( int rnd = 0; rnd < 3; rnd++ ) {
+        fr_size_t big = rnd == 0 ? 14 : 64 * rnd;
+        dst = fr_create_sized( rnd == 2 ? FR_SEG_MIN : big );
+        src = fr_create_sized( rnd == 2 ? big : 6 );
+        for ( i = 0; i < 13 * ( rnd + 1 ); i++ )
+            fr_push( dst, (void*)( seq[ i % 13 ] + 12 * ( i / 13 ) ) );
+        for ( i = 0; i < 2 + 30 * rnd; i++ )
+            fr_push( src, (void*)( 2 + 3 * i ) );
+        cnt = fr_length( dst ) + fr_length( src );
+        fr_merge( dst, src, merge_comp, 0 );
+        TEST_ASSERT_EQUAL( cnt, fr_length( dst ) );
+        prev = (void*)0;
+        for ( node = dst->seg; node; node = fn_next( node ) ) {
+            TEST_ASSERT_TRUE( node->used <= node->size );
+            for ( fr_size_t k = 0; k < node->used; k++ ) {
+                TEST_ASSERT_TRUE( node->data[ k ] >= prev );
+                prev = node->data[ k ];
+                cnt--;
+            }
+        }
+        TEST_ASSERT_EQUAL( 0, cnt );
+        fr_destroy( src );
+        fr_destroy( dst );
+    }
+}
+
+
+fr_size_t unique_hash( void* item )
+{
+    return (fr_size_t)item * 0x9e3779b97f4a7c15ULL;
+}
+
+
+void test_unique( void )
+{
+    fr_t     pos;
+    fr_s     cur;
+    void*    item;
+    intptr_t i;
+    char     seen[ 1000 ];
+
+    /* Sorted, with runs of duplicates. */
+    pos = fr_create_sized( 8 );
+    for ( i = 0; i < 1000; i++ ) {
+        for ( int k = 0; k <= i % 4; k++ )
+            fr_push( pos, (void*)i );
+    }
+    TEST_ASSERT_EQUAL( 2500, fr_length( pos ) );
+
+    TEST_ASSERT_EQUAL( 1500, fr_unique( pos, merge_comp ) );
+    merge_check( pos, 1000 );
+    TEST_ASSERT_EQUAL( 125, pos->ncnt );
+    cur = fr_first( pos );
+    i = 0;
+    fr_each( &cur, item, void* )
+    {
+        TEST_ASSERT_EQUAL( (void*)i, item );
+        i++;
+    }
+    TEST_ASSERT_EQUAL( 0, fr_unique( pos, merge_comp ) );
+    fr_destroy( pos );
+
+    /* Unsorted, first occurrence is kept. */
+    pos = fr_create_sized( 8 );
+    for ( i = 0; i < 5000; i++ )
+        fr_push( pos, (void*)(intptr_t)( ( i * 7919 ) % 500 ) );
+
+    TEST_ASSERT_EQUAL( 4500, fr_unique_hashed( pos, unique_hash, merge_comp ) );
+    TEST_ASSERT_EQUAL( 500, fr_length( pos ) );
+    TEST_ASSERT_EQUAL( 63, pos->ncnt );
+    memset( seen, 0, sizeof( seen ) );
+    cur = fr_first( pos );
+    i = 0;
+    fr_each( &cur, item, void* )
+    {
+        TEST_ASSERT_EQUAL( (void*)(intptr_t)( ( i * 7919 ) % 500 ), item );
+        TEST_ASSERT_EQUAL( 0, seen[ (intptr_t)item ] );
+        seen[ (intptr_t)item ] = 1;
+        i++;
+    }
+    fr_destroy( pos );
+
+    /* Empty Framer. */
+    pos = fr_create_sized( 8 );
+    TEST_ASSERT_EQUAL( 0, fr_unique( pos, merge_comp ) );
+    TEST_ASSERT_EQUAL( 0, fr_unique_hashed( pos, unique_hash, merge_comp ) );
+    TEST_ASSERT_EQUAL( 1, pos->ncnt );
+    fr_destroy( pos );
+}
+
+
+void set_count( void* ctx, void* item )
+{
+    (void)item;
+    ( *(fr_size_t*)ctx )++;
+}
+
+
+void set_check( fr_t pos, char* expect, int limit )
+{
+    fr_s  cur;
+    void* item;
+    int   i = 0;
+
+    cur = fr_first( pos );
+    fr_each( &cur, item, void* )
+    {
+        while ( i < limit && expect[ i ] == 0 )
+            i++;
+        TEST_ASSERT_EQUAL( (void*)(intptr_t)i, item );
+        expect[ i ]--;
+    }
+    for ( i = 0; i < limit; i++ )
+        TEST_ASSERT_EQUAL( 0, expect[ i ] );
+}
+
+
+void test_set_ops( void )
+{
+    fr_t      a;
+    fr_t      b;
+    fr_t      r;
+    fr_size_t cnt;
+    char      in_a[ 3000 ];
+    char      in_b[ 3000 ];
+    char      expect[ 3000 ];
+    intptr_t  i;
+
+    /* Dense a, sparse b with duplicates, and partial segments. */
+    a = fr_create_sized( 8 );
+    b = fr_create_sized( 8 );
+    memset( in_a, 0, sizeof( in_a ) );
+    memset( in_b, 0, sizeof( in_b ) );
+    for ( i = 0; i < 3000; i++ ) {
+        if ( i % 5 != 0 ) {
+            fr_push( a, (void*)i );
+            in_a[ i ]++;
+        }
+        if ( i % 5 == 0 ) {
+            fr_push( a, (void*)i );
+            fr_push( a, (void*)i );
+            in_a[ i ] += 2;
+        }
+    }
+    for ( i = 0; i < 3000; i += 97 ) {
+        fr_push( b, (void*)i );
+        in_b[ i ]++;
+        if ( i % 2 ) {
+            fr_push( b, (void*)i );
+            in_b[ i ]++;
+        }
+    }
+    fr_to_first( a );
+    for ( i = 0; i < 50; i++ ) {
+        fr_next( a );
+        fr_next( a );
+        in_a[ (intptr_t)fr_item( a ) ]--;
+        fr_delete( a );
+    }
+
+    for ( i = 0; i < 3000; i++ )
+        expect[ i ] = in_a[ i ] < in_b[ i ] ? in_a[ i ] : in_b[ i ];
+    r = fr_intersect( a, b, merge_comp );
+    set_check( r, expect, 3000 );
+    cnt = 0;
+    TEST_ASSERT_EQUAL( fr_length( r ), fr_intersect_emit( a, b, merge_comp, set_count, &cnt ) );
+    TEST_ASSERT_EQUAL( fr_length( r ), cnt );
+    fr_destroy( r );
+
+    for ( i = 0; i < 3000; i++ )
+        expect[ i ] = in_a[ i ] > in_b[ i ] ? in_a[ i ] : in_b[ i ];
+    r = fr_union( a, b, merge_comp );
+    set_check( r, expect, 3000 );
+    TEST_ASSERT_EQUAL( fr_length( r ), fr_union_emit( b, a, merge_comp, set_count, &cnt ) );
+    fr_destroy( r );
+
+    for ( i = 0; i < 3000; i++ )
+        expect[ i ] = in_a[ i ] > in_b[ i ] ? in_a[ i ] - in_b[ i ] : 0;
+    r = fr_difference( a, b, merge_comp );
+    set_check( r, expect, 3000 );
+    fr_destroy( r );
+
+    for ( i = 0; i < 3000; i++ )
+        expect[ i ] = in_b[ i ] > in_a[ i ] ? in_b[ i ] - in_a[ i ] : 0;
+    r = fr_difference( b, a, merge_comp );
+    set_check( r, expect, 3000 );
+    fr_destroy( r );
+
+    /* Empty input. */
+    fr_destroy( b );
+    b = fr_create_sized( 8 );
+    r = fr_intersect( a, b, merge_comp );
+    TEST_ASSERT_EQUAL( 0, fr_length( r ) );
+    fr_destroy( r );
+    r = fr_union( b, a, merge_comp );
+    TEST_ASSERT_EQUAL( fr_length( a ), fr_length( r ) );
+    fr_destroy( r );
+    r = fr_difference( a, b, merge_comp );
+    TEST_ASSERT_EQUAL( fr_length( a ), fr_length( r ) );
+    fr_destroy( r );
+
+    fr_destroy( a );
+    fr_destroy( b );
+}
+
+
+void order_check( fr_t pos, intptr_t start, intptr_t step, intptr_t cnt, intptr_t mod )
+{
+    fr_s     cur;
+    void*    item;
+    intptr_t i = 0;
+
+    TEST_ASSERT_EQUAL( cnt, fr_length( pos ) );
+    cur = fr_first( pos );
+    fr_each( &cur, item, void* )
+    {
+        TEST_ASSERT_EQUAL( (void*)( ( start + i * step + mod ) % mod ), item );
+        i++;
+    }
+    TEST_ASSERT_EQUAL( cnt, i );
+}
+
+
+void test_reverse_rotate( void )
+{
+    fr_t     pos;
+    intptr_t i;
+
+    pos = fr_create_sized( 8 );
+    for ( i = 0; i < 1000; i++ )
+        fr_push( pos, (void*)i );
+    fr_to_first( pos );
+    for ( i = 0; i < 100; i++ ) {
+        fr_next( pos );
+        fr_insert( pos, (void*)-1 );
+        fr_delete( pos );
+    }
+
+#ifdef FRAMER_USE_CURSORS
+    fr_s        tmp = fr_first( pos );
+    fr_cursor_t cur;
+    for ( i = 0; i < 333; i++ )
+        fr_next( &tmp );
+    cur = fr_cursor_new( &tmp );
+#endif
+
+    /* Position stays at its item. */
+    fr_to_first( pos );
+    for ( i = 0; i < 123; i++ )
+        fr_next( pos );
+    fr_reverse( pos );
+    TEST_ASSERT_EQUAL( (void*)123, fr_item( pos ) );
+    order_check( pos, 999, -1, 1000, 1000 );
+    fr_reverse( pos );
+    order_check( pos, 0, 1, 1000, 1000 );
+    TEST_ASSERT_EQUAL( (void*)123, fr_item( pos ) );
+
+    /* Rotate within Node, and from Node start. */
+    fr_rotate( pos );
+    TEST_ASSERT_EQUAL( (void*)123, fr_item( pos ) );
+    order_check( pos, 123, 1, 1000, 1000 );
+    fr_rotate( pos );
+    order_check( pos, 123, 1, 1000, 1000 );
+    fr_to_last( pos );
+    fr_rotate( pos );
+    order_check( pos, 122, 1, 1000, 1000 );
+    for ( i = 0; i < 500; i++ )
+        fr_next( pos );
+    fr_rotate( pos );
+    order_check( pos, 622, 1, 1000, 1000 );
+    TEST_ASSERT_EQUAL( 1000, pos->icnt );
+
+#ifdef FRAMER_USE_CURSORS
+    TEST_ASSERT_EQUAL( (void*)333, fr_cursor_item( cur ) );
+    fr_cursor_del( cur );
+#endif
+
+    fr_destroy( pos );
+
+    /* Single Node. */
+    pos = fr_create_sized( 8 );
+    for ( i = 0; i < 7; i++ )
+        fr_push( pos, (void*)i );
+    fr_reverse( pos );
+    order_check( pos, 6, -1, 7, 7 );
+    fr_to_first( pos );
+    fr_next( pos );
+    fr_next( pos );
+    fr_rotate( pos );
+    order_check( pos, 4, -1, 7, 7 );
+    fr_destroy( pos );
+
+    /* Empty Framer. */
+    pos = fr_create_sized( 8 );
+    fr_reverse( pos );
+    fr_rotate( pos );
+    TEST_ASSERT_EQUAL( 0, fr_length( pos ) );
+    fr_destroy( pos );
+}
+
+
+/* Check that Framer has the model items in order. */
+void gap_check( fr_t pos, intptr_t* model, intptr_t cnt )
+{
+    fr_s     cur;
+    void*    item;
+    intptr_t i = 0;
+
+    TEST_ASSERT_EQUAL( cnt, fr_length( pos ) );
+    cur = fr_first( pos );
+    fr_each( &cur, item, void* )
+    {
+        TEST_ASSERT_EQUAL( (void*)model[ i ], item );
+        i++;
+    }
+    TEST_ASSERT_EQUAL( cnt, i );
+}
+
+
+void test_gaps( void )
+{
+    fr_t     pos;
+    fr_t     dup;
+    fr_s     tmp;
+    intptr_t model[ 4000 ];
+    intptr_t cnt;
+    intptr_t k;
+    intptr_t val = 1000;
+    uint32_t seed = 1;
+    uint32_t r;
+    FILE*    fh;
+    int      fd;
+
+    /* Typing in the middle of a Node. */
+    pos = fr_create_sized( 16 );
+    for ( cnt = 0; cnt < 12; cnt++ )
+        fr_push( pos, (void*)cnt );
+    fr_to_first( pos );
+    for ( k = 0; k < 4; k++ )
+        fr_next( pos );
+    for ( k = 0; k < 3; k++ ) {
+        fr_insert( pos, (void*)( 100 + k ) );
+        fr_next( pos );
+    }
+#ifdef FRAMER_USE_GAPS
+    TEST_ASSERT_EQUAL( 8, pos->seg->gap );
+#endif
+    TEST_ASSERT_EQUAL( (void*)4, fr_item( pos ) );
+    TEST_ASSERT_EQUAL( (void*)102, fr_item_at( pos, 6 ) );
+    TEST_ASSERT_EQUAL( (void*)11, fr_item_at( pos, 14 ) );
+    fr_prev( pos );
+    TEST_ASSERT_EQUAL( (void*)102, fr_delete( pos ) );
+    TEST_ASSERT_EQUAL( (void*)4, fr_item( pos ) );
+    tmp = fr_first( pos );
+    tmp = fr_find( &tmp, (void*)9 );
+    TEST_ASSERT_EQUAL( 11, tmp.idx );
+    fr_destroy( pos );
+
+    /* Random edits at a moving cursor, against a model. */
+    pos = fr_create_sized( 32 );
+    for ( cnt = 0; cnt < 200; cnt++ ) {
+        model[ cnt ] = cnt;
+        fr_push( pos, (void*)cnt );
+    }
+
+#ifdef FRAMER_USE_CURSORS
+    fr_cursor_t cur;
+    tmp = fr_last( pos );
+    cur = fr_cursor_new( &tmp );
+#endif
+
+    fr_to_first( pos );
+    for ( k = 0; k < 100; k++ )
+        fr_next( pos );
+
+    for ( int step = 0; step < 3000; step++ ) {
+
+        seed = seed * 1103515245 + 12345;
+        r = ( seed >> 16 ) % 20;
+
+        if ( r < 11 && cnt < 4000 ) {
+            /* Insert before cursor. */
+            fr_insert( pos, (void*)val );
+            fr_next( pos );
+            memmove( &( model[ k + 1 ] ), &( model[ k ] ), ( cnt - k ) * sizeof( intptr_t ) );
+            model[ k++ ] = val++;
+            cnt++;
+        } else if ( r < 16 && k > 0 ) {
+            /* Delete before cursor. */
+            fr_prev( pos );
+            fr_delete( pos );
+            memmove( &( model[ k - 1 ] ), &( model[ k ] ), ( cnt - k ) * sizeof( intptr_t ) );
+            k--;
+            cnt--;
+        } else if ( r < 18 && k < cnt - 1 ) {
+            /* Delete at cursor. */
+            fr_delete( pos );
+            memmove( &( model[ k ] ), &( model[ k + 1 ] ), ( cnt - k - 1 ) * sizeof( intptr_t ) );
+            cnt--;
+        } else if ( r == 18 && k < cnt - 1 ) {
+            fr_next( pos );
+            k++;
+        } else if ( r == 19 && k > 0 ) {
+            fr_prev( pos );
+            k--;
+        }
+
+        TEST_ASSERT_EQUAL( (void*)model[ k ], fr_item( pos ) );
+    }
+
+    gap_check( pos, model, cnt );
+    tmp = fr_first( pos );
+    tmp = fr_find( &tmp, (void*)model[ cnt - 1 ] );
+    TEST_ASSERT_EQUAL( (void*)model[ cnt - 1 ], fr_item( &tmp ) );
+
+#ifdef FRAMER_USE_CURSORS
+    TEST_ASSERT_EQUAL( (void*)199, fr_cursor_item( cur ) );
+    fr_cursor_del( cur );
+#endif
+
+    /* Copies have the items in order. */
+    fh = tmpfile();
+    fd = fileno( fh );
+    TEST_ASSERT_EQUAL( 0, fr_write( pos, fd, NULL ) );
+    lseek( fd, 0, SEEK_SET );
+    dup = fr_read( fd, NULL );
+    gap_check( dup, model, cnt );
+    fr_destroy( dup );
+    fclose( fh );
+
+    dup = fr_clone( pos, 0 );
+    gap_check( dup, model, cnt );
+    fr_destroy( dup );
+    dup = fr_clone( pos, 1 );
+    gap_check( dup, model, cnt );
+    fr_destroy( dup );
+
+#ifdef FRAMER_USE_SNAPSHOTS
+    fr_snap_t      snap;
+    fr_snap_iter_s it;
+    fr_size_t      n;
+    intptr_t       i = 0;
+
+    TEST_ASSERT_TRUE( k > 0 );
+    snap = fr_snapshot( pos );
+    fr_insert( pos, (void*)val );
+    fr_prev( pos );
+    fr_delete( pos );
+    fr_snap_iter( snap, &it );
+    while ( ( n = fr_snap_read( &it ) ) ) {
+        for ( fr_size_t j = 0; j < n; j++ )
+            TEST_ASSERT_EQUAL( (void*)model[ i++ ], it.items[ j ] );
+    }
+    fr_snap_iter_done( &it );
+    TEST_ASSERT_EQUAL( cnt, i );
+    fr_snap_del( snap );
+    fr_delete( pos );
+    fr_insert( pos, (void*)model[ k - 1 ] );
+    fr_next( pos );
+    gap_check( pos, model, cnt );
+#endif
+
+#ifdef FRAMER_USE_GAPS
+    fr_flatten( pos );
+    for ( fn_t node = fr_first( pos ).seg; node; node = fn_next( node ) )
+        TEST_ASSERT_EQUAL( 0, node->gap );
+    gap_check( pos, model, cnt );
+#endif
+
+    fr_destroy( pos );
+}
+
+
+void test_pack_limit( void )
+{
+    fr_t       pos;
+    fr_stats_s st;
+    intptr_t   i;
+
+    /* Limit above the segment size of small adaptive Nodes. */
+    pos = fr_create_adaptive( 4, 16 );
+    for ( i = 0; i < 60; i++ )
+        fr_push( pos, (void*)i );
+    fr_to_first( pos );
+    for ( i = 0; i < 3; i++ )
+        fr_delete( pos );
+    fr_to_first( pos );
+    TEST_ASSERT_EQUAL( 1, fr_pack_range( pos, NULL, 10 ) );
+    order_check( pos, 3, 1, 57, 1000 );
+    fr_stats( pos, &st );
+    TEST_ASSERT_EQUAL( fr_node_count( pos ), st.nodes );
+    fr_destroy( pos );
+
+    /* Writer reaches the reader Node: [8][9..16][17]. */
+    pos = fr_create_sized( 8 );
+    for ( i = 1; i < 18; i++ )
+        fr_push( pos, (void*)i );
+    fr_to_first( pos );
+    for ( i = 0; i < 7; i++ )
+        fr_delete( pos );
+    TEST_ASSERT_EQUAL( 3, fr_node_count( pos ) );
+    fr_to_first( pos );
+    TEST_ASSERT_EQUAL( 1, fr_pack_range( pos, NULL, 4 ) );
+    order_check( pos, 8, 1, 10, 1000 );
+    fr_stats( pos, &st );
+    TEST_ASSERT_EQUAL( fr_node_count( pos ), st.nodes );
+    fr_destroy( pos );
+}
+
+
+fn_t fixed_mem_alloc( fr_t pos, void* env )
+{
+    (void)pos;
+    (void)env;
+    return fn_new_sized( 4 );
+}
+
+
+fn_t fixed_mem_free( fr_t pos, void* env )
+{
+    (void)env;
+    pos->seg = fn_delete( pos->seg );
+    return NULL;
+}
+
+
+intptr_t adaptive_churn( fr_t pos, intptr_t* model, intptr_t cnt, intptr_t cap, uint32_t seed )
+{
+    intptr_t k;
+    intptr_t val = 100000;
+
+    for ( int op = 0; op < 3000; op++ ) {
+        seed = seed * 1103515245 + 12345;
+        k = ( seed >> 8 ) % ( cnt + 1 );
+        if ( k == cnt ) {
+            if ( cnt >= cap )
+                continue;
+            fr_to_last( pos );
+            fr_append( pos, (void*)val );
+            model[ cnt++ ] = val++;
+        } else {
+            fr_to_first( pos );
+            fr_next_n( pos, k );
+            if ( ( seed >> 4 ) % 5 == 0 && cnt > 1 ) {
+                fr_delete( pos );
+                cnt--;
+                memmove( &( model[ k ] ), &( model[ k + 1 ] ), ( cnt - k ) * sizeof( intptr_t ) );
+            } else if ( ( seed >> 4 ) % 5 == 1 ) {
+                fr_rotate( pos );
+                for ( intptr_t i = 0; i < k; i++ ) {
+                    intptr_t first = model[ 0 ];
+                    memmove( model, &( model[ 1 ] ), ( cnt - 1 ) * sizeof( intptr_t ) );
+                    model[ cnt - 1 ] = first;
+                }
+            } else if ( cnt < cap ) {
+                fr_insert( pos, (void*)val );
+                memmove( &( model[ k + 1 ] ), &( model[ k ] ), ( cnt - k ) * sizeof( intptr_t ) );
+                model[ k ] = val++;
+                cnt++;
+            }
+        }
+    }
+
+    gap_check( pos, model, cnt );
+
+    return cnt;
+}
+
+
+void test_adaptive_arena( void )
+{
+    fr_t       pos;
+    fr_t       dup;
+    fr_arena_t arena;
+    intptr_t   model[ 6000 ];
+    intptr_t   cnt;
+    intptr_t   cap = 6000;
+
+    /* Segment size grows past the arena slot size after defrag. */
+    pos = fr_create_adaptive( 4, 4096 );
+    for ( cnt = 0; cnt < 200; cnt++ ) {
+        model[ cnt ] = cnt;
+        fr_push( pos, (void*)cnt );
+    }
+    fr_defrag( pos, NULL, 0, 0 );
+    arena = pos->mem->env;
+    fr_to_last( pos );
+    for ( ; cnt < 2000; cnt++ ) {
+        model[ cnt ] = cnt;
+        fr_push( pos, (void*)cnt );
+    }
+    TEST_ASSERT_TRUE( pos->size > arena->size );
+
+    /* Released slots are not reused for larger segments. */
+    fr_to_first( pos );
+    for ( cnt = 0; cnt < 100; cnt++ )
+        fr_delete( pos );
+    memmove( model, &( model[ 100 ] ), 1900 * sizeof( intptr_t ) );
+    fr_to_last( pos );
+    for ( cnt = 1900; cnt < 2000; cnt++ ) {
+        model[ cnt ] = cnt + 100;
+        fr_push( pos, (void*)( cnt + 100 ) );
+    }
+    TEST_ASSERT_EQUAL( pos->size, fr_last( pos ).seg->size );
+    gap_check( pos, model, cnt );
+    cnt = adaptive_churn( pos, model, cnt, cap, 1 );
+
+    fr_destroy( pos );
+
+    /* Clone has an arena of its own, and keeps growing. */
+    pos = fr_create_adaptive( 4, 4096 );
+    for ( cnt = 0; cnt < 200; cnt++ ) {
+        model[ cnt ] = cnt;
+        fr_push( pos, (void*)cnt );
+    }
+    dup = fr_clone_parallel( pos, 1, 4 );
+    fr_destroy( pos );
+    arena = dup->mem->env;
+    TEST_ASSERT_EQUAL( 4096, dup->max );
+    fr_to_last( dup );
+    while ( dup->size <= arena->size ) {
+        model[ cnt ] = cnt;
+        fr_push( dup, (void*)cnt );
+        cnt++;
+    }
+    fr_to_first( dup );
+    for ( int i = 0; i < 100; i++ )
+        fr_delete( dup );
+    cnt -= 100;
+    memmove( model, &( model[ 100 ] ), cnt * sizeof( intptr_t ) );
+    fr_to_last( dup );
+    for ( int i = 0; i < 100; i++ ) {
+        model[ cnt ] = cnt + 100000;
+        fr_push( dup, (void*)model[ cnt ] );
+        cnt++;
+    }
+    TEST_ASSERT_EQUAL( dup->size, fr_last( dup ).seg->size );
+    cnt = adaptive_churn( dup, model, cnt, cap, 2 );
+    fr_destroy( dup );
+
+    /* Memory API with Nodes smaller than the split tail. */
+    pos = fr_create_using( fr_pos_new_with_mem( NULL, 4, fixed_mem_alloc, fixed_mem_free, NULL ) );
+    pos->max = 4096;
+    for ( cnt = 0; cnt < 500; cnt++ ) {
+        model[ cnt ] = cnt;
+        fr_push( pos, (void*)cnt );
+    }
+    fr_defrag( pos, NULL, 0, 1 );
+    adaptive_churn( pos, model, cnt, cap, 3 );
+    fr_destroy( pos );
+}